@@ -6,6 +6,10 @@
 #include <in6addr.h>
 #else
 #include <arpa/inet.h>
+#if defined(__linux__)
+#include <endian.h>
+#define htonll(x) htobe64(x)
+#endif
 #define IN_ADDR in_addr
 #define IN6_ADDR in6_addr
 #endif // _WIN32
@@ -115,14 +119,14 @@ public:
   KFC_NODISCARD uint8_t operator[](const size_t index) const { return m_octets[index]; }
 
   KFC_NODISCARD IPv6Addr toIPv6Compatible() const {
-    const uint16_t g = (m_octets[1] << 8) | m_octets[0];
-    const uint16_t h = (m_octets[3] << 8) | m_octets[2];
+    const uint16_t g = (m_octets[0] << 8) | m_octets[1];
+    const uint16_t h = (m_octets[2] << 8) | m_octets[3];
     return IPv6Addr(0, 0, 0, 0, 0, 0, g, h);
   }
 
   KFC_NODISCARD IPv6Addr toIPv6Mapped() const {
-    const uint16_t g = (m_octets[1] << 8) | m_octets[0];
-    const uint16_t h = (m_octets[3] << 8) | m_octets[2];
+    const uint16_t g = (m_octets[0] << 8) | m_octets[1];
+    const uint16_t h = (m_octets[2] << 8) | m_octets[3];
     return IPv6Addr(0, 0, 0, 0, 0, 0xFFFF, g, h);
   }
 
@@ -2,25 +2,68 @@
 #include "KFC/Memory.h"
 #include "KFC/Mutex.h"
 #include "KFC/Preclude.h"
+#include "KFC/StackTrace.h"
 #include "KFC/Thread.h"
 #include "KFC/ThreadLocal.h"
 #include "KFC/Trace.h"
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
 #include <utility>
 
+#if (defined(__x86_64__) || defined(__aarch64__)) && (defined(__linux__) || defined(__APPLE__))
+// Fibers switch stacks with the few instructions below rather than `swapcontext`, which also
+// saves and restores the signal mask with a syscall on every switch.
+#define KFC_FIBER_ASM 1
+#else
+#define KFC_FIBER_ASM 0
+#include <ucontext.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define KFC_FIBER_ASAN 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define KFC_FIBER_ASAN 1
+#endif
+#endif
+#ifdef KFC_FIBER_ASAN
+// ASAN tracks the bounds of the stack it runs on, fibers tell it when they switch stacks.
+#include <sanitizer/common_interface_defs.h>
+#else
+#define KFC_FIBER_ASAN 0
+#endif
+
 KFC_NAMESPACE_BEG
 
 #define KFC_ALREADY_READY reinterpret_cast<KFC::_::Event *>(114514)
 
 static KFC_THREAD_LOCAL EventLoop *threadLocalEventLoop;
+// The fiber running on this thread, if any.
+static KFC_THREAD_LOCAL _::FiberBase *threadLocalFiber;
 
 EventLoop::EventLoop()
-    : m_current(nullptr), m_head(nullptr), m_tail(&m_head), m_depthFirstInsertPoint(&m_head),
-      m_breadthFirstInsertPoint(&m_head), m_port(None), m_executor(None),
-      m_threadName(getCurrentThreadName()) {}
+    : m_current(nullptr), m_maxTurnEvents(0), m_maxTurnTime(0), m_eventsSincePoll(0),
+      m_lastPollTime(0), m_port(None), m_executor(None), m_threadName(getCurrentThreadName()) {}
 EventLoop::EventLoop(EventPort &port)
-    : m_current(nullptr), m_head(nullptr), m_tail(&m_head), m_depthFirstInsertPoint(&m_head),
-      m_breadthFirstInsertPoint(&m_head), m_port(port), m_executor(None),
-      m_threadName(getCurrentThreadName()) {}
+    : m_current(nullptr), m_maxTurnEvents(0), m_maxTurnTime(0), m_eventsSincePoll(0),
+      m_lastPollTime(0), m_port(port), m_executor(None), m_threadName(getCurrentThreadName()) {}
+
+EventLoop::~EventLoop() noexcept(false) {
+  // Unlink the events still queued, so that destroying them later doesn't touch the loop.
+  std::vector<_::XThreadEventBase *> taken;
+  for (_::EventQueue &queue : m_queues) {
+    for (_::Event *event = KFC_EXCHANGE(queue.head, nullptr); event;) {
+      _::Event *next = KFC_EXCHANGE(event->m_next, nullptr);
+      event->m_prev = nullptr;
+      if (auto *x = dynamic_cast<_::XThreadEventBase *>(event)) taken.push_back(x);
+      event = next;
+    }
+    queue.tail = queue.depthFirstInsertPoint = queue.breadthFirstInsertPoint = &queue.head;
+  }
+  // Other threads may still hold the executor, make it refuse their events from now on.
+  KFC_IF_SOME(e, m_executor) { e->disconnect(taken); }
+}
 
 EventLoop &EventLoop::current() {
   EventLoop *runLoop = threadLocalEventLoop;
@@ -38,15 +81,36 @@ void EventLoop::leave() const {
   threadLocalEventLoop = nullptr;
 }
 
+// The events and polls measured are often shorter than a tick of the coarse clock.
+static Duration monotonicNow() {
+  const Clock::TimePoint t = Clock::preciseMonotonic();
+  return Duration::fromSecond(t.sec) + t.nsec;
+}
+
 Ref<Executor> EventLoop::getExecutor() {
   KFC_IF_SOME_CONST(e, m_executor) { return e; }
   return m_executor.emplace(Executor::create(*this));
 }
 
-void EventLoop::poll() {
+void EventLoop::poll() { poll(true); }
+
+void EventLoop::poll(const bool block) {
+  KFC_IF_SOME(i, m_instrumentation) {
+    const Duration start = monotonicNow();
+    pollPortOrExecutor(block);
+    i.polled(monotonicNow() - start);
+  }
+  else {
+    pollPortOrExecutor(block);
+  }
+  m_eventsSincePoll = 0;
+  if (m_maxTurnTime > 0) m_lastPollTime = monotonicNow();
+}
+
+void EventLoop::pollPortOrExecutor(const bool block) {
   KFC_IF_SOME(p, m_port) {
     // Poll the EventPort if there is one.
-    if (p.poll()) {
+    if (block ? p.poll() : p.tryPoll()) {
       // Another thread woke up the poller, check for cross-thread events.
       KFC_IF_SOME_CONST(e, m_executor) { (*e).poll(); }
     }
@@ -55,36 +119,140 @@ void EventLoop::poll() {
     // No EventPort, try the executor.
     (*e).poll();
   }
-  else KFC_THROW_FATAL(KFC::Exception::Kind::Logic,
-                 "Neither a poller nor an executor is set for the EventLoop");
+  else if (block) KFC_THROW_FATAL(KFC::Exception::Kind::Logic,
+                            "Neither a poller nor an executor is set for the EventLoop");
+}
+
+void EventLoop::setInstrumentation(Option<EventLoopInstrumentation &> instrumentation) {
+  KFC_IF_SOME(i, instrumentation) {
+    size_t depth = 0;
+    for (const _::EventQueue &queue : m_queues) {
+      for (const _::Event *e = queue.head; e; e = e->m_next) depth++;
+    }
+    i.m_stats.queueDepth = depth;
+    i.m_stats.maxQueueDepth = std::max(i.m_stats.maxQueueDepth, depth);
+  }
+  m_instrumentation = instrumentation;
+}
+
+void EventLoop::setTurnBudget(const uint32_t maxEvents, const Duration maxTime) {
+  m_maxTurnEvents = maxEvents;
+  m_maxTurnTime = maxTime;
+  m_eventsSincePoll = 0;
+  m_lastPollTime = monotonicNow();
+}
+
+bool EventLoop::isTurnBudgetExhausted() const {
+  if (m_maxTurnEvents && m_eventsSincePoll >= m_maxTurnEvents) return true;
+  return m_maxTurnTime > 0 && monotonicNow() - m_lastPollTime >= m_maxTurnTime;
+}
+
+void EventLoop::resetDepthFirstInsertPoints() {
+  for (_::EventQueue &queue : m_queues) queue.depthFirstInsertPoint = &queue.head;
+}
+
+EventLoopInstrumentation::EventLoopInstrumentation()
+    : m_stats(), m_slowThreshold(0), m_captureSites(false) {}
+
+void EventLoopInstrumentation::onSlowEvent(const Duration threshold, SlowEventCallback callback,
+                                           const bool captureCreationSites) {
+  m_slowThreshold = threshold;
+  m_slowCallback = std::move(callback);
+  m_captureSites = captureCreationSites;
+  if (!m_captureSites) m_sites.clear();
+}
+
+void EventLoopInstrumentation::resetStats() {
+  const size_t depth = m_stats.queueDepth;
+  m_stats = EventLoopStats();
+  m_stats.queueDepth = depth;
+  m_stats.maxQueueDepth = depth;
+}
+
+void EventLoopInstrumentation::armed(uint64_t EventLoopStats::*counter) {
+  ++(m_stats.*counter);
+  m_stats.maxQueueDepth = std::max(m_stats.maxQueueDepth, ++m_stats.queueDepth);
+}
+
+void EventLoopInstrumentation::constructed(const _::Event &event) {
+  if (!m_captureSites) return;
+  Site &site = m_sites[&event];
+  // Skip the constructors of Event and of the derived class.
+  site.size = getStackTrace(site.frames, kCreationSiteFrames, 2);
+}
+
+void EventLoopInstrumentation::destroyed(const _::Event &event) {
+  if (!m_sites.empty()) m_sites.erase(&event);
+}
+
+Option<Own<_::Event>> EventLoopInstrumentation::fire(_::Event &event) {
+  m_stats.queueDepth--;
+  // Take what the report needs before firing, the event may not outlive `fire`.
+  const std::type_info &type = typeid(event);
+  Option<Site> site;
+  if (m_slowCallback && m_captureSites) {
+    const auto it = m_sites.find(&event);
+    if (it != m_sites.end()) site = it->second;
+  }
+
+  const Duration start = monotonicNow();
+  Option<Own<_::Event>> result = event.fire();
+  const Duration duration = monotonicNow() - start;
+
+  m_stats.eventsFired++;
+  m_stats.busyTime += duration;
+  const auto us = static_cast<uint64_t>(duration.toMicroSeconds());
+  const size_t bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+  m_stats.fireHistogram[std::min(bucket, kFireHistogramBuckets - 1)]++;
+
+  if (m_slowCallback && duration >= m_slowThreshold) {
+    SlowEvent slow{demangleTypeName(type.name()), String(), duration};
+    KFC_IF_SOME(s, site) { slow.creationSite = stringifyStackTrace(s.frames, s.size); }
+    m_slowCallback(slow);
+  }
+  return result;
 }
 
 bool EventLoop::turn() {
-  _::Event *event = m_head;
-  if (!event) {
+  if ((m_maxTurnEvents || m_maxTurnTime > 0) && isTurnBudgetExhausted()) {
+    // Let the I/O that became ready in the meantime get in line, it may well go before the events
+    // already queued.
+    KFC_IF_SOME(i, m_instrumentation) { i.m_stats.budgetPolls++; }
+    poll(false);
+  }
+
+  _::EventQueue *queue = nullptr;
+  for (_::EventQueue &q : m_queues) {
+    if (q.head) {
+      queue = &q;
+      break;
+    }
+  }
+  if (!queue) {
     // No event in the queue.
     return false;
   }
 
-  m_head = event->m_next;
-  if (m_head) {
+  _::Event *event = queue->head;
+  queue->head = event->m_next;
+  if (queue->head) {
     // The next event is not null, update its prev pointer.
     // That's to say, there is more than one event in the queue.
-    m_head->m_prev = &m_head;
+    queue->head->m_prev = &queue->head;
   }
 
-  if (m_tail == &event->m_next) {
+  if (queue->tail == &event->m_next) {
     // The tail is the next pointer of the current event, update it.
     // That's to say, we are removing the last event from the queue.
-    m_tail = &m_head;
+    queue->tail = &queue->head;
   }
 
-  // Reset the depth-first insert point.
-  m_depthFirstInsertPoint = &m_head;
-  if (m_breadthFirstInsertPoint == &event->m_next) {
+  // Reset the depth-first insert points.
+  resetDepthFirstInsertPoints();
+  if (queue->breadthFirstInsertPoint == &event->m_next) {
     // The breadth-first insert point is the next pointer of the current event, update it.
     // That's to say, we are removing the last event from the queue.
-    m_breadthFirstInsertPoint = &m_head;
+    queue->breadthFirstInsertPoint = &queue->head;
   }
 
   event->m_next = nullptr;
@@ -92,28 +260,101 @@ bool EventLoop::turn() {
 
   // Fire the event.
   m_current = event;
+  m_eventsSincePoll++;
   event->m_firing = true;
-  auto eventToDestroy = event->fire();
+  Option<Own<_::Event>> eventToDestroy;
+  KFC_IF_SOME(i, m_instrumentation) { eventToDestroy = i.fire(*event); }
+  else {
+    eventToDestroy = event->fire();
+  }
   event->m_firing = false;
   m_current = nullptr;
 
-  // Reset the depth-first insert point again because the event might have armed more events.
-  m_depthFirstInsertPoint = &m_head;
+  // Reset the depth-first insert points again because the event might have armed more events.
+  resetDepthFirstInsertPoints();
   return true;
 }
 
 namespace _ {
+Arena::Arena() : m_freeLists(), m_freeCounts() {}
+
+Arena::~Arena() {
+  for (FreeBlock *&head : m_freeLists) {
+    while (FreeBlock *block = head) {
+      head = block->next;
+      ::operator delete(block);
+    }
+  }
+}
+
+void *Arena::allocate(const size_t size) {
+  if (size > kMaxSize) return ::operator new(size);
+  const size_t c = classOf(size);
+  if (FreeBlock *block = m_freeLists[c]) {
+    m_freeLists[c] = block->next;
+    --m_freeCounts[c];
+    return block;
+  }
+  return allocateFromHeap(size);
+}
+
+void Arena::deallocate(void *ptr, const size_t size) noexcept {
+  if (size <= kMaxSize) {
+    const size_t c = classOf(size);
+    if (m_freeCounts[c] < kMaxCachedBlocks) {
+      auto *block = static_cast<FreeBlock *>(ptr);
+      block->next = m_freeLists[c];
+      m_freeLists[c] = block;
+      ++m_freeCounts[c];
+      return;
+    }
+  }
+  ::operator delete(ptr);
+}
+
+void *Arena::allocateFromHeap(const size_t size) {
+  if (size > kMaxSize) return ::operator new(size);
+  return ::operator new((classOf(size) + 1) * kGranularity);
+}
+
+void *ArenaAllocated::operator new(const size_t size) {
+  if (EventLoop *loop = threadLocalEventLoop) return loop->m_arena.allocate(size);
+  return Arena::allocateFromHeap(size);
+}
+
+void ArenaAllocated::operator delete(void *ptr, const size_t size) noexcept {
+  // The block may have been allocated by another thread or outside any EventLoop, which is fine
+  // since all blocks are interchangeable.
+  if (EventLoop *loop = threadLocalEventLoop) {
+    loop->m_arena.deallocate(ptr, size);
+  } else {
+    ::operator delete(ptr);
+  }
+}
+
 Event::Event() : Event(EventLoop::current()) {}
 
-Event::Event(EventLoop &loop)
-    : m_loop(loop), m_prev(nullptr), m_next(nullptr), m_firing(false),
-      m_alive(kEventLivenessMagic) {}
+Event::Event(EventLoop &loop) : Event(loop, EventPriority::Normal) {}
+
+Event::Event(EventLoop &loop, const EventPriority priority)
+    : m_loop(loop), m_prev(nullptr), m_next(nullptr), m_firing(false), m_priority(priority),
+      m_alive(kEventLivenessMagic) {
+  // Cross-thread events are constructed in the requesting thread, see the destructor.
+  if (&m_loop == threadLocalEventLoop) {
+    KFC_IF_SOME(i, m_loop.m_instrumentation) { i.constructed(*this); }
+  }
+}
 
 Event::~Event() noexcept(false) {
   m_alive = 0;
   // Make sure `m_alive = 0` won't be optimized away.
   std::atomic_signal_fence(std::memory_order_acq_rel);
   disarm();
+  // Cross-thread events may be destroyed in another thread than their loop's, whose
+  // instrumentation is not ours to touch.
+  if (&m_loop == threadLocalEventLoop) {
+    KFC_IF_SOME(i, m_loop.m_instrumentation) { i.destroyed(*this); }
+  }
 }
 
 void Event::disarm() {
@@ -124,23 +365,24 @@ void Event::disarm() {
 
   KFC_CHECK(&m_loop == threadLocalEventLoop,
             "Disarming an event from a different thread than it was armed");
+  EventQueue &queue = m_loop.m_queues[static_cast<size_t>(m_priority)];
 
-  if (m_loop.m_tail == &m_next) {
+  if (queue.tail == &m_next) {
     // The tail is the next pointer of the current event, update it.
     // That's to say, we are removing the last event from the queue.
-    m_loop.m_tail = m_prev;
+    queue.tail = m_prev;
   }
 
-  if (m_loop.m_depthFirstInsertPoint == &m_next) {
+  if (queue.depthFirstInsertPoint == &m_next) {
     // The depth-first insert point is the next pointer of the current event, update it.
     // That's to say, we are removing the last event from the queue.
-    m_loop.m_depthFirstInsertPoint = m_prev;
+    queue.depthFirstInsertPoint = m_prev;
   }
 
-  if (m_loop.m_breadthFirstInsertPoint == &m_next) {
+  if (queue.breadthFirstInsertPoint == &m_next) {
     // The breadth-first insert point is the next pointer of the current event, update it.
     // That's to say, we are removing the last event from the queue.
-    m_loop.m_breadthFirstInsertPoint = m_prev;
+    queue.breadthFirstInsertPoint = m_prev;
   }
 
   *m_prev = m_next;
@@ -152,6 +394,7 @@ void Event::disarm() {
 
   m_prev = nullptr;
   m_next = nullptr;
+  KFC_IF_SOME(i, m_loop.m_instrumentation) { i.disarmed(); }
 }
 
 void Event::armDepthFirst() {
@@ -163,9 +406,10 @@ void Event::armDepthFirst() {
     // Already armed.
     return;
   }
+  EventQueue &queue = m_loop.m_queues[static_cast<size_t>(m_priority)];
 
   // Link the current event to its next event.
-  m_next = *m_loop.m_depthFirstInsertPoint;
+  m_next = *queue.depthFirstInsertPoint;
   if (m_next) {
     // The next event is not null, update its prev pointer.
     // That's to say, there is more than one event in the queue.
@@ -173,23 +417,24 @@ void Event::armDepthFirst() {
   }
 
   // Link the current event to its previous event.
-  m_prev = m_loop.m_depthFirstInsertPoint;
+  m_prev = queue.depthFirstInsertPoint;
   *m_prev = this;
 
   // Update the depth-first insert point.
-  m_loop.m_depthFirstInsertPoint = &m_next;
+  queue.depthFirstInsertPoint = &m_next;
 
-  if (m_loop.m_breadthFirstInsertPoint == m_prev) {
+  if (queue.breadthFirstInsertPoint == m_prev) {
     // The breadth-first insert point is the previous pointer of the current event, update it.
     // That's to say, we are inserting the first event into the queue.
-    m_loop.m_breadthFirstInsertPoint = &m_next;
+    queue.breadthFirstInsertPoint = &m_next;
   }
 
-  if (m_loop.m_tail == m_prev) {
+  if (queue.tail == m_prev) {
     // The tail is the previous pointer of the current event, update it.
     // That's to say, we are inserting the first event into the queue.
-    m_loop.m_tail = &m_next;
+    queue.tail = &m_next;
   }
+  KFC_IF_SOME(i, m_loop.m_instrumentation) { i.armed(&EventLoopStats::depthFirstArms); }
 }
 
 void Event::armBreadthFirst() {
@@ -201,9 +446,10 @@ void Event::armBreadthFirst() {
     // Already armed.
     return;
   }
+  EventQueue &queue = m_loop.m_queues[static_cast<size_t>(m_priority)];
 
   // Link the current event to its next event.
-  m_next = *m_loop.m_breadthFirstInsertPoint;
+  m_next = *queue.breadthFirstInsertPoint;
   if (m_next) {
     // The next event is not null, update its prev pointer.
     // That's to say, there is more than one event in the queue.
@@ -211,17 +457,18 @@ void Event::armBreadthFirst() {
   }
 
   // Link the current event to its previous event.
-  m_prev = m_loop.m_breadthFirstInsertPoint;
+  m_prev = queue.breadthFirstInsertPoint;
   *m_prev = this;
 
   // Update the breadth-first insert point.
-  m_loop.m_breadthFirstInsertPoint = &m_next;
+  queue.breadthFirstInsertPoint = &m_next;
 
-  if (m_loop.m_tail == m_prev) {
+  if (queue.tail == m_prev) {
     // The tail is the previous pointer of the current event, update it.
     // That's to say, we are inserting the first event into the queue.
-    m_loop.m_tail = &m_next;
+    queue.tail = &m_next;
   }
+  KFC_IF_SOME(i, m_loop.m_instrumentation) { i.armed(&EventLoopStats::breadthFirstArms); }
 }
 
 void Event::armLast() {
@@ -233,32 +480,34 @@ void Event::armLast() {
     // Already armed.
     return;
   }
+  EventQueue &queue = m_loop.m_queues[static_cast<size_t>(m_priority)];
 
-  // Link the current event to its next event.
-  m_next = *m_loop.m_breadthFirstInsertPoint;
-  if (m_next) {
-    // The next event is not null, update its prev pointer.
-    // That's to say, there is more than one event in the queue.
-    m_next->m_prev = &m_next;
-  }
+  // The event goes last, nothing comes after it.
+  m_next = nullptr;
 
   // Link the current event to its previous event.
-  m_prev = m_loop.m_tail;
+  m_prev = queue.tail;
   *m_prev = this;
 
-  // We don't do `m_loop.m_breadthFirstInsertPoint = &m_next` here like that in `armBreadthFirst`,
+  // We don't do `queue.breadthFirstInsertPoint = &m_next` here like that in `armBreadthFirst`,
   // because we want further breadth-first inserts to go before this event.
 
-  if (m_loop.m_tail == m_prev) {
+  if (queue.tail == m_prev) {
     // The tail is the previous pointer of the current event, update it.
     // That's to say, we are inserting the first event into the queue.
-    m_loop.m_tail = &m_next;
+    queue.tail = &m_next;
   }
+  KFC_IF_SOME(i, m_loop.m_instrumentation) { i.armed(&EventLoopStats::lastArms); }
 }
 
 void wait(OwnPromiseNode &node, PromiseResultBase &result, const WaitScope &scope) {
+  KFC_IF_SOME(fiber, scope.m_fiber) {
+    fiber.wait(node, result);
+    return;
+  }
   EventLoop &loop = scope.m_loop;
   KFC_CHECK(&loop == threadLocalEventLoop, "Waiting in a different thread than the EventLoop");
+  KFC_CHECK(!threadLocalFiber, "Waiting on the EventLoop from a fiber, use the fiber's WaitScope");
 
   RootEvent event;
   node->poll(&event);
@@ -357,14 +606,151 @@ Option<Own<Event>> ChainPromiseNode::fire() {
   return None;
 }
 
+PromiseBase::PromiseBase(PromiseBase &&other) noexcept
+    : m_node(std::move(other.m_node)), m_inlineOps(other.m_inlineOps) {
+  if (m_inlineOps) {
+    m_inlineOps->move(m_inline, other.m_inline);
+    other.m_inlineOps = nullptr;
+  }
+}
+
+PromiseBase &PromiseBase::operator=(PromiseBase &&other) noexcept {
+  if (this == &other) return *this;
+  if (m_inlineOps) m_inlineOps->destroy(m_inline);
+  m_node = std::move(other.m_node);
+  m_inlineOps = KFC_EXCHANGE(other.m_inlineOps, nullptr);
+  if (m_inlineOps) m_inlineOps->move(m_inline, other.m_inline);
+  return *this;
+}
+
+PromiseBase::~PromiseBase() noexcept(false) {
+  if (m_inlineOps) m_inlineOps->destroy(m_inline);
+}
+
+OwnPromiseNode &PromiseBase::node() {
+  if (const InlineOps *ops = KFC_EXCHANGE(m_inlineOps, nullptr)) m_node = ops->toNode(m_inline);
+  return m_node;
+}
+
+PriorityPromiseNodeBase::PriorityPromiseNodeBase(OwnPromiseNode &&dep, PromiseResultBase &result,
+                                                 const EventPriority priority)
+    : Event(EventLoop::current(), priority), m_dep(std::move(dep)), m_result(result) {
+  m_dep->poll(this);
+}
+
+PriorityPromiseNodeBase::~PriorityPromiseNodeBase() noexcept(false) = default;
+
+void PriorityPromiseNodeBase::poll(Event *event) { m_pollEvent.init(event); }
+
+Option<Own<Event>> PriorityPromiseNodeBase::fire() {
+  m_dep->read(m_result);
+  m_dep = nullptr;
+  m_pollEvent.arm();
+  return None;
+}
+
+ForkBranchBase::ForkBranchBase(ForkHubBase &hub) : m_hub(hub) {
+  if (hub.m_ready) {
+    m_pollEvent.arm();
+  } else {
+    hub.m_branches.add(*this);
+  }
+}
+
+ForkBranchBase::~ForkBranchBase() noexcept(false) {
+  if (m_link.isLinked()) m_hub->m_branches.remove(*this);
+}
+
+void ForkBranchBase::poll(Event *event) { m_pollEvent.init(event); }
+
+void ForkBranchBase::hubReady() { m_pollEvent.arm(); }
+
+ForkHubBase::ForkHubBase(OwnPromiseNode &&inner, PromiseResultBase &result)
+    : m_inner(std::move(inner)), m_result(result), m_ready(false) {
+  m_inner->poll(this);
+}
+
+ForkHubBase::~ForkHubBase() noexcept(false) = default;
+
+Option<Own<Event>> ForkHubBase::fire() {
+  m_inner->read(m_result);
+  m_inner = nullptr;
+  m_ready = true;
+  // Every branch gets the result in the same turn, in the order they were added.
+  while (!m_branches.empty()) {
+    ForkBranchBase &branch = m_branches.front();
+    m_branches.remove(branch);
+    branch.hubReady();
+  }
+  return None;
+}
+
+CancelerNode::CancelerNode(Canceler &canceler, OwnPromiseNode &&inner)
+    : m_canceler(canceler), m_inner(std::move(inner)) {
+  m_canceler.m_nodes.add(*this);
+  m_inner->poll(this);
+}
+
+CancelerNode::~CancelerNode() noexcept(false) {
+  if (m_link.isLinked()) m_canceler.m_nodes.remove(*this);
+}
+
+void CancelerNode::poll(Event *event) { m_pollEvent.init(event); }
+
+void CancelerNode::read(PromiseResultBase &result) noexcept {
+  KFC_IF_SOME(e, m_reason) { result.assignException(Exception(e)); }
+  else {
+    m_inner->read(result);
+  }
+}
+
+Option<Own<Event>> CancelerNode::fire() {
+  // Settled, the result stands no matter what the Canceler does from now on.
+  m_canceler.m_nodes.remove(*this);
+  m_pollEvent.arm();
+  return None;
+}
+
+void CancelerNode::cancel(const Exception &reason) {
+  m_canceler.m_nodes.remove(*this);
+  // The wrapped node may already have armed us in this turn, its result is discarded all the same.
+  disarm();
+  m_reason = reason;
+  // Dropping the node runs the destructors down the chain, which is what withdraws its timers, fd
+  // waits and cross-thread events.
+  m_inner = nullptr;
+  m_pollEvent.arm();
+}
+
 class XThreadEventBase::DelayedDoneDisposer final : public Disposer {
 public:
   void disposePtr(void *ptr) override { static_cast<XThreadEventBase *>(ptr)->done(); }
 };
 
-XThreadEventBase::XThreadEventBase(PromiseResultBase &result, const Executor &targetExecutor,
+XThreadEventBase::XThreadEventBase(PromiseResultBase &result, Executor &targetExecutor,
                                    EventLoop &loop)
-    : Event(loop), m_result(result), m_targetExecutor(targetExecutor) {}
+    : Event(loop), m_result(result), m_link(nullptr), m_cancelLink(nullptr),
+      m_targetExecutor(targetExecutor), m_syncDone(false), m_state(Queued), m_detached(false),
+      m_finished(false), m_cancelSeen(false) {}
+
+void XThreadEventBase::destroy() {
+  // Once the state is swapped, the target may release the event, keep its executor.
+  Ref<Executor> target = m_targetExecutor;
+  switch (m_state.exchange(Canceled, std::memory_order_acq_rel)) {
+  case Queued:
+    // The target executor may still refer to the event, let it know. It hands the event back once
+    // it has let go of it. If its EventLoop has exited, the event is either still in the queue of
+    // the executor, which releases it, or went down with the loop.
+    KFC_DISCARD(target->send(target->m_canceledEvents, *this));
+    return;
+  case Ready:
+    // On its way back, it's released when our executor takes it.
+    return;
+  default:
+    break;
+  }
+  delete this;
+}
 
 void XThreadEventBase::poll(Event *event) { m_pollEvent.init(event); }
 
@@ -372,24 +758,94 @@ Option<Own<Event>> XThreadEventBase::fire() {
   static DelayedDoneDisposer disposer;
   KFC_IF_SOME(n, m_promiseNode) {
     n->read(m_result);
-    m_promiseNode = None;
+    dropPromiseNode();
+    return Own<Event>(this, &disposer);
+  }
+  if (m_cancelSeen || m_state.load(std::memory_order_acquire) == Canceled) {
+    // Dropped by the requester before it could start, don't bother calling the function.
     return Own<Event>(this, &disposer);
   }
   KFC_IF_SOME(e, runCatchingExceptions([&] { m_promiseNode = execute(); })) {
     m_result.assignException(std::move(e));
   }
-  KFC_IF_SOME(n, m_promiseNode) { n->poll(this); }
+  KFC_IF_SOME(n, m_promiseNode) {
+    n->poll(this);
+    m_targetExecutor->m_waitingEvents.add(*this);
+  }
   else {
     return Own<Event>(this, &disposer);
   }
   return None;
 }
 
+void XThreadEventBase::dropPromiseNode() {
+  m_promiseNode = None;
+  if (m_waitingLink.isLinked()) m_targetExecutor->m_waitingEvents.remove(*this);
+}
+
 void XThreadEventBase::done() {
-  KFC_CHECK(&m_targetExecutor == &getCurrentThreadExecutor().get(),
+  KFC_CHECK(m_targetExecutor.ptr() == getCurrentThreadExecutor().ptr(),
             "calling `XThreadEventBase::done` from wrong thread.");
-  KFC_IF_SOME(e, m_requestExecutor) { e.sendReady(*this); }
-  else {
+  if (m_detached) {
+    delete this;
+    return;
+  }
+  KFC_IF_SOME(e, m_requestExecutor) {
+    m_finished = true;
+    State expected = Queued;
+    if (m_state.compare_exchange_strong(expected, Ready, std::memory_order_acq_rel)) {
+      e->sendReady(*this);
+    } else if (m_cancelSeen) {
+      // Dropped by the requester, which only has to release it. If its EventLoop has exited in the
+      // meantime, release it here.
+      if (!e->send(e->m_readyEvents, *this)) delete this;
+    }
+    // Otherwise the cancellation is on its way, the event is handed back when it arrives.
+  } else {
+    // The waiter may destroy the event as soon as the lock is released, don't touch it afterward.
+    auto guard = m_targetExecutor->m_syncMutex.lock();
+    m_syncDone = true;
+    m_condvar.notifyOne();
+  }
+}
+
+void XThreadEventBase::cancel() {
+  m_cancelSeen = true;
+  if (m_finished) {
+    // Done before the cancellation arrived, `done` held the event back.
+    done();
+  } else if (m_promiseNode.isSome()) {
+    // Waiting for the promise returned by the function, drop it in its own EventLoop. The promise
+    // may have armed the event already.
+    dropPromiseNode();
+    disarm();
+    done();
+  }
+  // Otherwise the event is yet to fire, which skips the function.
+}
+
+void XThreadEventBase::disconnect() {
+  // Waiting for the promise returned by the function, which can't be polled anymore.
+  dropPromiseNode();
+  if (m_detached) {
+    delete this;
+    return;
+  }
+  KFC_IF_SOME(e, m_requestExecutor) {
+    // The requester reads the result only once the event is back.
+    setDisconnected();
+    State expected = Queued;
+    if (m_state.compare_exchange_strong(expected, Ready, std::memory_order_acq_rel)) {
+      // The requester may be this very loop, its promise releases the event then.
+      if (!e->send(e->m_readyEvents, *this)) m_state.store(Armed, std::memory_order_release);
+    } else {
+      // Dropped by the requester, which leaves the event to the queue it's in.
+      delete this;
+    }
+  } else {
+    auto guard = m_targetExecutor->m_syncMutex.lock();
+    setDisconnected();
+    m_syncDone = true;
     m_condvar.notifyOne();
   }
 }
@@ -400,32 +856,104 @@ void XThreadEventBase::setDisconnected() const {
                     "Executor's event loop exited before cross-thread event could complete"));
 }
 
+void XThreadQueue::push(XThreadEventBase &event) { pushAll(event, event); }
+
+void XThreadQueue::pushAll(XThreadEventBase &newest, XThreadEventBase &oldest) {
+  XThreadEventBase *head = m_head.load(std::memory_order_relaxed);
+  do {
+    oldest.*m_linkMember = head;
+  } while (!m_head.compare_exchange_weak(head, &newest, std::memory_order_release,
+                                         std::memory_order_relaxed));
+}
+
+XThreadEventBase *XThreadQueue::takeAll() {
+  XThreadEventBase *head = m_head.exchange(nullptr, std::memory_order_acquire);
+  // The events are linked newest first, reverse them to fire in the order they were sent.
+  XThreadEventBase *oldest = nullptr;
+  while (head) {
+    XThreadEventBase *next = head->*m_linkMember;
+    head->*m_linkMember = oldest;
+    oldest = head;
+    head = next;
+  }
+  return oldest;
+}
+
 } // namespace _
 
-Executor::Executor(EventLoop &loop) : m_shared(loop) {}
+Canceler::~Canceler() noexcept(false) {
+  if (!m_nodes.empty()) cancel("Canceler was destroyed");
+}
+
+void Canceler::cancel(const String &reason) {
+  const Exception e = KFC_EXCEPTION(Exception::Kind::Canceled, "%s", reason.c_str());
+  while (!m_nodes.empty()) m_nodes.front().cancel(e);
+}
+
+Executor::Executor(EventLoop &loop)
+    : m_loop(&loop), m_sending(0), m_canceledEvents(&_::XThreadEventBase::m_cancelLink),
+      m_wakePending(false) {}
 Executor::~Executor() noexcept(false) = default;
 Ref<Executor> Executor::create(EventLoop &loop) { return adoptRef(*new Executor(loop)); }
 
 bool Executor::poll() {
-  auto guard = m_shared.lock();
-  if (guard->m_pendingEvents.empty() && guard->m_readyEvents.empty()) {
+  // Clear the flag before draining, so that an event sent after the queues have been drained
+  // always wakes the port again.
+  m_wakePending.store(false);
+  _::XThreadEventBase *pending = m_pendingEvents.takeAll();
+  _::XThreadEventBase *ready = m_readyEvents.takeAll();
+  _::XThreadEventBase *canceled = m_canceledEvents.takeAll();
+  if (!pending && !ready && !canceled) {
     return false;
   }
 
   // Arm all pending events to the target EventLoop.
-  for (auto &event : guard->m_pendingEvents) {
-    guard->m_pendingEvents.remove(event);
-    event.armBreadthFirst();
+  while (_::XThreadEventBase *event = pending) {
+    pending = KFC_EXCHANGE(event->m_link, nullptr);
+    event->armBreadthFirst();
   }
 
   // Arm all ready events to the requesting EventLoop.
-  for (auto &event : guard->m_readyEvents) {
-    guard->m_readyEvents.remove(event);
-    event.m_pollEvent.arm();
+  while (_::XThreadEventBase *event = ready) {
+    ready = KFC_EXCHANGE(event->m_link, nullptr);
+    if (event->m_state.load(std::memory_order_acquire) == _::XThreadEventBase::Canceled) {
+      // The promise was dropped while the event was on its way back.
+      delete event;
+    } else {
+      event->m_state.store(_::XThreadEventBase::Armed, std::memory_order_relaxed);
+      event->m_pollEvent.arm();
+    }
+  }
+
+  // Withdraw the events dropped by their requesters.
+  while (_::XThreadEventBase *event = canceled) {
+    canceled = KFC_EXCHANGE(event->m_cancelLink, nullptr);
+    event->cancel();
   }
   return true;
 }
 
+bool Executor::send(_::XThreadQueue &queue, _::XThreadEventBase &event) {
+  return send(queue, event, event);
+}
+
+bool Executor::send(_::XThreadQueue &queue, _::XThreadEventBase &newest,
+                    _::XThreadEventBase &oldest) {
+  // Announce ourselves before looking at the loop, `disconnect` clears it before waiting for the
+  // announced senders: either we see it cleared, or it sees us and waits for the push.
+  m_sending.fetch_add(1);
+  EventLoop *loop = m_loop.load();
+  if (loop) {
+    queue.pushAll(newest, oldest);
+    if (!m_wakePending.exchange(true)) {
+      // Wake up the port for the next call to `Executor::poll`. Events sent until then ride along.
+      KFC_IF_SOME_CONST(p, loop->m_port) { p.wake(); }
+    }
+  }
+  m_sending.fetch_sub(1, std::memory_order_release);
+  return loop != nullptr;
+}
+
 void Executor::sendPending(_::XThreadEventBase &event, const bool sync) {
   if (sync) {
     // The event is expected to be executed synchronously, check if we are on the Executor's own
@@ -439,66 +967,429 @@ void Executor::sendPending(_::XThreadEventBase &event, const bool sync) {
   } else {
     // The event is expected to be executed asynchronously, record the requesting Executor to
     // receive the result after the event completes.
-    event.m_requestExecutor = getCurrentThreadExecutor().get();
+    event.m_requestExecutor = getCurrentThreadExecutor();
   }
 
-  auto guard = m_shared.lock();
-  KFC_IF_SOME(l, guard->m_loop) {
-    // Queue the event to the pending queue so that the next call to `Executor::poll` could arm it
-    // to the target EventLoop.
-    guard->m_pendingEvents.add(event);
-    KFC_IF_SOME_CONST(p, l.m_port) {
-      // Wake up the port for the next call to `Executor::poll`.
-      p.wake();
-    }
-  }
-  else {
+  if (!send(m_pendingEvents, event)) {
     // The EventLoop has exited.
     event.setDisconnected();
+    if (!sync) {
+      event.m_state = _::XThreadEventBase::Armed;
+      event.m_pollEvent.arm();
+    }
     return;
   }
 
   if (sync) {
     // Wait for the event to complete.
-    event.m_condvar.wait(guard);
+    auto guard = m_syncMutex.lock();
+    while (!event.m_syncDone) event.m_condvar.wait(guard);
   }
 }
 
-void Executor::sendReady(_::XThreadEventBase &event) {
-  auto guard = m_shared.lock();
-  KFC_IF_SOME(l, guard->m_loop) {
-    // Queue the event to the ready queue so that the next call to `Executor::poll` could arm it
-    // to the requesting EventLoop.
-    guard->m_readyEvents.add(event);
-    // Drop the lock to avoid deadlock.
-    KFC_GIVE_UP_GUARD(guard);
-    // Wake up the event port for the next call to `Executor::poll`.
-    KFC_IF_SOME_CONST(p, l.m_port) { p.wake(); }
+void Executor::sendPendingBatch(_::XThreadEventBase &newest, _::XThreadEventBase &oldest) {
+  const Ref<Executor> requestExecutor = getCurrentThreadExecutor();
+  for (_::XThreadEventBase *event = &newest; event; event = event->m_link) {
+    event->m_requestExecutor = requestExecutor;
   }
-  else {
+  if (send(m_pendingEvents, newest, oldest)) return;
+  // The EventLoop has exited.
+  for (_::XThreadEventBase *event = &newest; event;) {
+    _::XThreadEventBase *next = KFC_EXCHANGE(event->m_link, nullptr);
+    event->setDisconnected();
+    event->m_state = _::XThreadEventBase::Armed;
+    event->m_pollEvent.arm();
+    event = next;
+  }
+}
+
+void Executor::sendReady(_::XThreadEventBase &event) {
+  if (!send(m_readyEvents, event)) {
     KFC_THROW_FATAL(KFC::Exception::Kind::Logic,
               "The requesting executor has exited its EventLoop without canceling the "
               "cross-thread event. This is yet an undefined behavior, so crash it now");
   }
 }
 
+void Executor::sendDetached(_::XThreadEventBase &event) {
+  event.m_detached = true;
+  // The EventLoop has exited, nothing will run the event.
+  if (!send(m_pendingEvents, event)) delete &event;
+}
+
 EventLoop &Executor::getEventLoop() {
-  KFC_IF_SOME(l, m_shared.lock()->m_loop) { return l; }
+  if (EventLoop *loop = m_loop.load(std::memory_order_acquire)) return *loop;
   KFC_THROW_FATAL(KFC::Exception::Kind::Logic, "Executor's EventLoop has exited");
 }
 
+void Executor::disconnect(const std::vector<_::XThreadEventBase *> &taken) {
+  m_loop.store(nullptr);
+  while (m_sending.load(std::memory_order_acquire) != 0) std::this_thread::yield();
+
+  // The events dropped by their requesters are also in one of the lists below, unless they were
+  // done already and only held back for the cancellation: those are ours to release. Take them
+  // first, the others are released below.
+  _::XThreadEventBase *canceled = m_canceledEvents.takeAll();
+  while (_::XThreadEventBase *event = canceled) {
+    canceled = KFC_EXCHANGE(event->m_cancelLink, nullptr);
+    if (event->m_finished) delete event;
+  }
+  // The events the loop has taken but not fired, then those it hasn't taken yet, then those
+  // waiting for the promise returned by their function, which can't be polled anymore.
+  for (_::XThreadEventBase *event : taken) event->disconnect();
+  _::XThreadEventBase *pending = m_pendingEvents.takeAll();
+  while (_::XThreadEventBase *event = pending) {
+    pending = KFC_EXCHANGE(event->m_link, nullptr);
+    event->disconnect();
+  }
+  while (!m_waitingEvents.empty()) m_waitingEvents.front().disconnect();
+  _::XThreadEventBase *ready = m_readyEvents.takeAll();
+  while (_::XThreadEventBase *event = ready) {
+    ready = KFC_EXCHANGE(event->m_link, nullptr);
+    if (event->m_state.load(std::memory_order_acquire) == _::XThreadEventBase::Canceled) {
+      delete event;
+    } else {
+      // Its promise is released from now on, without waiting for the loop.
+      event->m_state.store(_::XThreadEventBase::Armed, std::memory_order_relaxed);
+    }
+  }
+}
+
 bool Executor::belongsToCurrentThread() const {
   if (!threadLocalEventLoop) return false;
   KFC_IF_SOME_CONST(e, threadLocalEventLoop->m_executor) { return e.ptr() == this; }
   return false;
 }
 
+#if KFC_FIBER_ASM
+#if defined(__APPLE__)
+#define KFC_FIBER_SWITCH_SYMBOL "_kfcSwitchFiber"
+#define KFC_FIBER_SECTION_BEG ".text\n"
+#define KFC_FIBER_SECTION_END ""
+#else
+#define KFC_FIBER_SWITCH_SYMBOL "kfcSwitchFiber"
+#define KFC_FIBER_SECTION_BEG ".pushsection .text\n"
+#define KFC_FIBER_SECTION_END ".popsection\n"
+#endif
+
+// Save the callee-saved registers on the current stack, store the stack pointer to `*saveSp`,
+// then switch to `loadSp` and restore the registers saved there. Returns on the other stack.
+extern "C" void kfcSwitchFiber(void **saveSp, void *loadSp);
+
+#if defined(__x86_64__)
+asm(KFC_FIBER_SECTION_BEG
+    ".globl " KFC_FIBER_SWITCH_SYMBOL "\n"
+    ".p2align 4\n"
+    KFC_FIBER_SWITCH_SYMBOL ":\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n" KFC_FIBER_SECTION_END);
+#elif defined(__aarch64__)
+asm(KFC_FIBER_SECTION_BEG
+    ".globl " KFC_FIBER_SWITCH_SYMBOL "\n"
+    ".p2align 4\n"
+    KFC_FIBER_SWITCH_SYMBOL ":\n"
+    "  sub sp, sp, #160\n"
+    "  stp x19, x20, [sp, #0]\n"
+    "  stp x21, x22, [sp, #16]\n"
+    "  stp x23, x24, [sp, #32]\n"
+    "  stp x25, x26, [sp, #48]\n"
+    "  stp x27, x28, [sp, #64]\n"
+    "  stp x29, x30, [sp, #80]\n"
+    "  stp d8, d9, [sp, #96]\n"
+    "  stp d10, d11, [sp, #112]\n"
+    "  stp d12, d13, [sp, #128]\n"
+    "  stp d14, d15, [sp, #144]\n"
+    "  mov x9, sp\n"
+    "  str x9, [x0]\n"
+    "  mov sp, x1\n"
+    "  ldp x19, x20, [sp, #0]\n"
+    "  ldp x21, x22, [sp, #16]\n"
+    "  ldp x23, x24, [sp, #32]\n"
+    "  ldp x25, x26, [sp, #48]\n"
+    "  ldp x27, x28, [sp, #64]\n"
+    "  ldp x29, x30, [sp, #80]\n"
+    "  ldp d8, d9, [sp, #96]\n"
+    "  ldp d10, d11, [sp, #112]\n"
+    "  ldp d12, d13, [sp, #128]\n"
+    "  ldp d14, d15, [sp, #144]\n"
+    "  add sp, sp, #160\n"
+    "  ret\n" KFC_FIBER_SECTION_END);
+#endif
+#endif // KFC_FIBER_ASM
+
+namespace _ {
+// A stack with a guard page below it, and the contexts to switch to it and back.
+class FiberStack final {
+public:
+  explicit FiberStack(size_t size);
+  ~FiberStack() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(FiberStack)
+
+  // Run `main` from the top of the stack. Return when it suspends or returns.
+  void start(FiberMain &main);
+  // Go on from where the stack suspended.
+  void resume();
+  // Called on the stack: switch back to the caller of `start` or `resume`.
+  void suspend();
+
+private:
+  static void entry() noexcept;
+  // Switch from the caller to the stack, where it started or suspended last.
+  void switchIn();
+
+  void *m_base;  // The lowest address of the mapping, the guard page.
+  size_t m_size; // The size of the mapping, guard page included.
+  FiberMain *m_main;
+#if KFC_FIBER_ASAN
+  void *m_fakeStack;          // ASAN's fake stack of the fiber while it's suspended.
+  const void *m_callerBottom; // The stack of the caller of `start` or `resume`.
+  size_t m_callerSize;
+#endif
+#if KFC_FIBER_ASM
+  void *m_sp;
+  void *m_callerSp;
+#else
+  ucontext_t m_context;
+  ucontext_t m_callerContext;
+#endif
+};
+
+// The stack being started on this thread, picked up by `FiberStack::entry`.
+static KFC_THREAD_LOCAL FiberStack *threadLocalStartingStack;
+
+FiberStack::FiberStack(const size_t size) : m_main(nullptr) {
+#if KFC_FIBER_ASAN
+  m_fakeStack = nullptr;
+  m_callerBottom = nullptr;
+  m_callerSize = 0;
+#endif
+  const size_t page = sysconf(_SC_PAGESIZE);
+  m_size = (size + page - 1) / page * page + page;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_STACK
+  flags |= MAP_STACK;
+#endif
+  m_base = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  KFC_CHECK(m_base != MAP_FAILED, "mmap(fiber stack) errno: %d", errno);
+  KFC_CHECK_SYSCALL(mprotect(m_base, page, PROT_NONE));
+}
+
+FiberStack::~FiberStack() noexcept(false) { KFC_CHECK_SYSCALL(munmap(m_base, m_size)); }
+
+void FiberStack::start(FiberMain &main) {
+  m_main = &main;
+  threadLocalStartingStack = this;
+  void **top = reinterpret_cast<void **>(static_cast<char *>(m_base) + m_size);
+#if KFC_FIBER_ASM
+  // Lay out a frame as if `kfcSwitchFiber` had been called from the beginning of `entry`.
+#if defined(__x86_64__)
+  // The return address of `entry`, which never returns, then where `ret` jumps to, so that `entry`
+  // starts with the stack aligned the way a call leaves it. Below are rbp, rbx and r12 to r15.
+  *--top = nullptr;
+  *--top = reinterpret_cast<void *>(&entry);
+  for (int i = 0; i < 6; i++) *--top = nullptr;
+#elif defined(__aarch64__)
+  // x19 to x28, x29 and x30, then d8 to d15. `ret` jumps to x30.
+  top -= 20;
+  for (int i = 0; i < 20; i++) top[i] = nullptr;
+  top[11] = reinterpret_cast<void *>(&entry);
+#endif
+  m_sp = top;
+#else
+  KFC_CHECK_SYSCALL(getcontext(&m_context));
+  m_context.uc_stack.ss_sp = static_cast<char *>(m_base);
+  m_context.uc_stack.ss_size = m_size;
+  m_context.uc_link = nullptr;
+  makecontext(&m_context, &entry, 0);
+#endif
+  switchIn();
+}
+
+void FiberStack::resume() { switchIn(); }
+
+void FiberStack::switchIn() {
+#if KFC_FIBER_ASAN
+  void *fakeStack = nullptr;
+  __sanitizer_start_switch_fiber(&fakeStack, m_base, m_size);
+#endif
+#if KFC_FIBER_ASM
+  kfcSwitchFiber(&m_callerSp, m_sp);
+#else
+  KFC_CHECK_SYSCALL(swapcontext(&m_callerContext, &m_context));
+#endif
+#if KFC_FIBER_ASAN
+  __sanitizer_finish_switch_fiber(fakeStack, nullptr, nullptr);
+#endif
+}
+
+void FiberStack::suspend() {
+#if KFC_FIBER_ASAN
+  // A fiber that has returned is never resumed, ASAN can release its fake stack right away.
+  __sanitizer_start_switch_fiber(m_main ? &m_fakeStack : nullptr, m_callerBottom, m_callerSize);
+#endif
+#if KFC_FIBER_ASM
+  kfcSwitchFiber(&m_sp, m_callerSp);
+#else
+  KFC_CHECK_SYSCALL(swapcontext(&m_context, &m_callerContext));
+#endif
+#if KFC_FIBER_ASAN
+  // Resumed, maybe from another stack than the one that started it.
+  __sanitizer_finish_switch_fiber(m_fakeStack, &m_callerBottom, &m_callerSize);
+#endif
+}
+
+void FiberStack::entry() noexcept {
+  FiberStack *stack = threadLocalStartingStack;
+#if KFC_FIBER_ASAN
+  __sanitizer_finish_switch_fiber(nullptr, &stack->m_callerBottom, &stack->m_callerSize);
+#endif
+  stack->m_main->run();
+  stack->m_main = nullptr;
+  // Never resumed, the next `start` lays out a new frame.
+  stack->suspend();
+  KFC_UNREACHABLE();
+}
+
+FiberBase::FiberBase(FiberPool &pool)
+    : m_pool(pool), m_stack(&pool.acquireStack()), m_state(Waiting) {
+  armBreadthFirst();
+}
+
+FiberBase::~FiberBase() noexcept(false) {
+  if (m_stack) m_pool.releaseStack(*m_stack);
+}
+
+void FiberBase::destroy() {
+  if (m_state == Running) {
+    KFC_CHECK(threadLocalFiber != this, "A fiber cannot drop its own promise");
+    // Suspended in `wait`, which throws when resumed. Unwinding the stack destroys everything the
+    // function owns, the promise it was waiting on included.
+    m_state = Canceled;
+    disarm();
+    switchIn();
+  }
+  delete this;
+}
+
+void FiberBase::poll(Event *event) { m_pollEvent.init(event); }
+
+void FiberBase::wait(OwnPromiseNode &node, PromiseResultBase &result) {
+  KFC_CHECK(threadLocalFiber == this, "Waiting on the WaitScope of another fiber");
+  // Own the node on the fiber's stack, so that unwinding a canceled fiber drops it too, rather than
+  // leaving it to arm a destroyed event.
+  OwnPromiseNode owned = std::move(node);
+  if (m_state != Canceled) {
+    owned->poll(this);
+    m_stack->suspend();
+  }
+  if (m_state == Canceled) throw KFC_EXCEPTION(Exception::Kind::Canceled, "Fiber was canceled");
+  owned->read(result);
+}
+
+Option<Own<Event>> FiberBase::fire() {
+  switchIn();
+  if (m_state == Finished) {
+    m_pool.releaseStack(*KFC_EXCHANGE(m_stack, nullptr));
+    m_pollEvent.arm();
+  }
+  return None;
+}
+
+void FiberBase::run() {
+  WaitScope scope(EventLoop::current(), *this);
+  runFunc(scope);
+  m_state = Finished;
+}
+
+void FiberBase::switchIn() {
+  FiberBase *caller = KFC_EXCHANGE(threadLocalFiber, this);
+  if (m_state == Waiting) {
+    m_state = Running;
+    m_stack->start(*this);
+  } else {
+    m_stack->resume();
+  }
+  threadLocalFiber = caller;
+}
+} // namespace _
+
+FiberPool::FiberPool(const size_t stackSize)
+    : m_stackSize(stackSize), m_freelist(Freelist{{}, kDefaultFiberFreelist}) {}
+
+FiberPool::~FiberPool() noexcept(false) {
+  for (const _::FiberStack *stack : m_freelist.lock()->stacks) delete stack;
+}
+
+void FiberPool::setMaxFreelist(const size_t count) {
+  auto guard = m_freelist.lock();
+  guard->max = count;
+  while (guard->stacks.size() > count) {
+    delete guard->stacks.back();
+    guard->stacks.pop_back();
+  }
+}
+
+size_t FiberPool::getFreelistSize() { return m_freelist.lock()->stacks.size(); }
+
+_::FiberStack &FiberPool::acquireStack() {
+  {
+    auto guard = m_freelist.lock();
+    if (!guard->stacks.empty()) {
+      _::FiberStack *stack = guard->stacks.back();
+      guard->stacks.pop_back();
+      return *stack;
+    }
+  }
+  return *new _::FiberStack(m_stackSize);
+}
+
+void FiberPool::releaseStack(_::FiberStack &stack) {
+  {
+    auto guard = m_freelist.lock();
+    if (guard->stacks.size() < guard->max) {
+      guard->stacks.push_back(&stack);
+      return;
+    }
+  }
+  delete &stack;
+}
+
+void FiberPool::runOnStack(_::FiberMain &main) {
+  _::FiberStack &stack = acquireStack();
+  stack.start(main);
+  releaseStack(stack);
+}
+
 WaitScope::WaitScope(EventLoop &loop) : m_loop(loop) { m_loop.enter(); }
-WaitScope::~WaitScope() { m_loop.leave(); }
+WaitScope::WaitScope(EventLoop &loop, _::FiberBase &fiber) : m_loop(loop), m_fiber(fiber) {}
+
+WaitScope::~WaitScope() {
+  if (m_fiber.isNone()) m_loop.leave();
+}
+
+void WaitScope::runEventCallbacksOnStackPool(Option<FiberPool &> pool) {
+  KFC_CHECK(m_fiber.isNone(), "Only the EventLoop's own WaitScope runs event callbacks");
+  m_pool = pool;
+}
 
 template <class Func> void WaitScope::runOnStackPool(Func &&func) const {
-  // TODO: KJ uses Fiber APIs to implement stack pool that we don't need yet, but will some day.
-  func();
+  KFC_IF_SOME(pool, m_pool) { pool.runSynchronously(std::forward<Func>(func)); }
+  else {
+    func();
+  }
 }
 
 Promise<void> yield() { return _::PromiseNode::to<Promise<void>>(new _::YieldPromiseNode()); }
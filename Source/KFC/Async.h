@@ -11,20 +11,90 @@
 #include "KFC/Result.h"
 #include "KFC/RunCatchingExceptions.h"
 #include "KFC/Time.h"
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#if KFC_HAS_COROUTINE
+#include <coroutine>
+#endif
 
 KFC_NAMESPACE_BEG
 template <class T> class Promise;
+template <class T> class ForkedPromise;
 class EventLoop;
 class WaitScope;
 class Executor;
+class FiberPool;
+class EventLoopInstrumentation;
+class Timer;
+
+// The lanes of an EventLoop. An armed event is fired only when no event of a higher priority is
+// armed, so that, e.g., background prefetches don't add to the latency of interactive reads. A low
+// lane is starved for as long as higher lanes have work, it's meant for work that can wait.
+enum class EventPriority : uint8_t {
+  High,
+  Normal,
+  Low,
+};
+constexpr size_t kEventPriorities = 3;
 
 namespace _ {
+// A cache of freed blocks, bucketed by size class, that lets promise nodes and events reuse each
+// other's memory instead of going to malloc for every `then`. Every block comes from the global
+// heap at its full size class, so a block freed into one arena, or with plain `operator delete`,
+// is always valid for any other.
+class Arena {
+public:
+  // Sizes are rounded up to a multiple of `kGranularity`. Larger objects bypass the arena.
+  static constexpr size_t kGranularity = 16;
+  static constexpr size_t kMaxSize = 512;
+  // Blocks cached per size class. Frees beyond that go back to the global heap, so that a burst of
+  // promises doesn't pin its peak memory for the lifetime of the loop.
+  static constexpr uint32_t kMaxCachedBlocks = 4096;
+
+  explicit Arena();
+  ~Arena();
+  KFC_DISALLOW_COPY_AND_MOVE(Arena)
+
+  void *allocate(size_t size);
+  void deallocate(void *ptr, size_t size) noexcept;
+  // Allocate from the global heap a block that can later be cached by an arena.
+  static void *allocateFromHeap(size_t size);
+
+private:
+  struct FreeBlock {
+    FreeBlock *next;
+  };
+  static constexpr size_t kNumClasses = kMaxSize / kGranularity;
+  static size_t classOf(size_t size) { return (size ? size - 1 : 0) / kGranularity; }
+
+  FreeBlock *m_freeLists[kNumClasses];
+  uint32_t m_freeCounts[kNumClasses];
+};
+
+// Heap-allocated promise nodes and events derive from this to take their memory from the Arena of
+// the current thread's EventLoop. Outside an EventLoop they fall back to the global heap.
+class ArenaAllocated {
+public:
+  static void *operator new(size_t size);
+  static void *operator new(size_t, void *ptr) noexcept { return ptr; }
+  // Polymorphic deletes pass the size of the most derived type, which is what picks the size
+  // class, so no header is needed in front of the blocks.
+  static void operator delete(void *ptr, size_t size) noexcept;
+  static void operator delete(void *, void *) noexcept {}
+};
+
 // An event that is scheduled in a EventLoop.
-class Event {
+class Event : public ArenaAllocated {
 public:
   // ZSBD
   explicit Event();
   explicit Event(EventLoop &);
+  explicit Event(EventLoop &, EventPriority priority);
   virtual ~Event() noexcept(false);
   KFC_DISALLOW_COPY_AND_MOVE(Event)
   // Arm the event in depth-first order.
@@ -44,15 +114,29 @@ protected:
 
 private:
   friend class KFC::EventLoop;
+  friend class KFC::EventLoopInstrumentation;
   EventLoop &m_loop;
   Event **m_prev;
   Event *m_next;
   bool m_firing;
+  EventPriority m_priority;
 
   static constexpr uint32_t kEventLivenessMagic = 0xdeadc0de;
   uint32_t m_alive;
 };
 
+// The armed events of one lane of an EventLoop, in firing order.
+struct EventQueue {
+  explicit EventQueue()
+      : head(nullptr), tail(&head), depthFirstInsertPoint(&head), breadthFirstInsertPoint(&head) {}
+  KFC_DISALLOW_COPY_AND_MOVE(EventQueue)
+
+  Event *head;
+  Event **tail;
+  Event **depthFirstInsertPoint;
+  Event **breadthFirstInsertPoint;
+};
+
 class PromiseNode;
 class PromiseDisposer;
 template <class> class PromiseResult;
@@ -65,7 +149,13 @@ template <class U> struct ReducePromise<KFC::Promise<U>> { typedef U Type; };
 template <class T> using ReducedPromise = Promise<typename ReducePromise<T>::Type>;
 using OwnPromiseNode = Own<PromiseNode, PromiseDisposer>;
 
-class PromiseDisposer : public DeleteStaticDisposer<PromiseNode> {};
+// Disposes a node through `PromiseNode::destroy`. `ArenaAllocated` returns the memory of deleted
+// nodes to the current EventLoop.
+class PromiseDisposer {
+public:
+  using ValueType = PromiseNode;
+  static void dispose(const PromiseNode *node);
+};
 
 class PromiseResultBase {
 public:
@@ -104,18 +194,21 @@ public:
   virtual void resolve(PromiseResult<T> &&result = Void{}) = 0;
 };
 
-class PromiseNode {
+class PromiseNode : public ArenaAllocated {
 public:
   // Destructor.
   virtual ~PromiseNode() noexcept(false) = default;
+  // Destroy the node when its owning promise is dropped. Nodes that don't live on their own
+  // allocation, like coroutine frames, override this.
+  virtual void destroy() { delete this; }
   // Read the result of the promise.
   virtual void read(PromiseResultBase &result) noexcept = 0;
   // Arm the given event when ready.
   virtual void poll(Event *event) = 0;
   // Extract the node from the given promise.
-  template <class T> static OwnPromiseNode from(T &&promise) { return std::move(promise.m_node); }
+  template <class T> static OwnPromiseNode from(T &&promise) { return std::move(promise.node()); }
   // Extract the node reference from the given promise.
-  template <class T> static PromiseNode &from(T &promise) { return *promise.m_node; }
+  template <class T> static PromiseNode &from(T &promise) { return *promise.node(); }
   // Convert the node to a promise.
   template <class T> static T to(OwnPromiseNode &&node) { return T(false, std::move(node)); }
 
@@ -131,6 +224,10 @@ protected:
   };
 };
 
+inline void PromiseDisposer::dispose(const PromiseNode *node) {
+  const_cast<PromiseNode *>(node)->destroy();
+}
+
 template <class T> class ImmediatePromiseNode final : public PromiseNode {
 public:
   explicit ImmediatePromiseNode(PromiseResult<T> &&result) : m_result(std::move(result)) {}
@@ -209,6 +306,34 @@ private:
   Event *m_pollEvent;
 };
 
+// Moves the continuations of a chain to a lane of the EventLoop. The dependency is waited through
+// an event of the lane and evaluated when that event fires, so that the callbacks chained so far
+// run in the lane's turn rather than in the one of whoever reads the result.
+class PriorityPromiseNodeBase : public PromiseNode, public Event {
+public:
+  explicit PriorityPromiseNodeBase(OwnPromiseNode &&dep, PromiseResultBase &result,
+                                   EventPriority priority);
+  ~PriorityPromiseNodeBase() noexcept(false) override;
+  void poll(Event *event) override;
+
+private:
+  Option<Own<Event>> fire() override;
+
+  OwnPromiseNode m_dep; // Null once evaluated.
+  PromiseResultBase &m_result;
+  PollEvent m_pollEvent;
+};
+
+template <class T> class PriorityPromiseNode final : public PriorityPromiseNodeBase {
+public:
+  explicit PriorityPromiseNode(OwnPromiseNode &&dep, const EventPriority priority)
+      : PriorityPromiseNodeBase(std::move(dep), m_result, priority) {}
+  void read(PromiseResultBase &result) noexcept override { result.as<T>() = std::move(m_result); }
+
+private:
+  PromiseResult<T> m_result;
+};
+
 class YieldPromiseNode final : public PromiseNode {
 public:
   void read(PromiseResultBase &result) noexcept override {
@@ -245,22 +370,97 @@ private:
   PromiseResult<T> m_result;
 };
 
+// The type-erased state of a Promise<T>: either a node, or, for a promise that was fulfilled from
+// the start, the value itself. Small values are kept inline so that a ready promise costs no
+// allocation; the node is only made when the promise is handed to something that needs one.
+// Promise<T> must not add members, promises are read through PromiseResult<PromiseBase> by
+// ChainPromiseNode.
 class PromiseBase {
 public:
-  explicit PromiseBase() = default;
-  explicit PromiseBase(OwnPromiseNode &&node) : m_node(std::move(node)) {}
+  explicit PromiseBase() : m_inlineOps(nullptr) {}
+  explicit PromiseBase(OwnPromiseNode &&node) : m_node(std::move(node)), m_inlineOps(nullptr) {}
+  PromiseBase(PromiseBase &&other) noexcept;
+  PromiseBase &operator=(PromiseBase &&other) noexcept;
+  ~PromiseBase() noexcept(false);
+
+protected:
+  static constexpr size_t kInlineSize = 2 * sizeof(void *);
+  template <class T> static constexpr bool fitsInline() {
+    return sizeof(T) <= kInlineSize && alignof(T) <= alignof(void *) &&
+           std::is_nothrow_move_constructible<T>::value;
+  }
+
+  KFC_NODISCARD bool isReady() const { return m_inlineOps != nullptr; }
+  template <class T> void setReady(T &&value) {
+    static_assert(fitsInline<T>(), "The value doesn't fit inline");
+    new (m_inline) T(std::move(value));
+    m_inlineOps = &InlineValue<T>::kOps;
+  }
+  template <class T> T takeReady() {
+    T *value = reinterpret_cast<T *>(m_inline);
+    T result(std::move(*value));
+    value->~T();
+    m_inlineOps = nullptr;
+    return result;
+  }
+  // The node of the promise, made from the inline value if there is one.
+  OwnPromiseNode &node();
 
 private:
+  struct InlineOps {
+    void (*move)(void *to, void *from) noexcept; // Also destroys `from`.
+    void (*destroy)(void *value) noexcept;
+    OwnPromiseNode (*toNode)(void *value); // Also destroys `value`.
+  };
+
+  template <class T> struct InlineValue {
+    static void move(void *to, void *from) noexcept {
+      new (to) T(std::move(*static_cast<T *>(from)));
+      static_cast<T *>(from)->~T();
+    }
+    static void destroy(void *value) noexcept { static_cast<T *>(value)->~T(); }
+    static OwnPromiseNode toNode(void *value) {
+      OwnPromiseNode node =
+          new ImmediatePromiseNode<T>(PromiseResult<T>(std::move(*static_cast<T *>(value))));
+      static_cast<T *>(value)->~T();
+      return node;
+    }
+    static constexpr InlineOps kOps = {&move, &destroy, &toNode};
+  };
+
   template <class> friend class KFC::Promise;
   friend class PromiseNode;
   OwnPromiseNode m_node;
+  const InlineOps *m_inlineOps; // Set while the value is held inline, `m_node` is null then.
+  alignas(void *) unsigned char m_inline[kInlineSize];
 };
 
+// Wrap what a continuation returned into the promise returned by `then`.
+template <class Out, class V> Out toPromise(V &&value) { return Out(std::move(value)); }
+template <class Out, class X> Out toPromise(KFC::Promise<X> &&promise) {
+  return std::move(promise);
+}
+
+// Call the continuation of a promise that is ready from the start, rather than queueing it.
+template <class Out, class U, class T, class Func> Out evaluateNow(Func &func, T &&value) {
+  Option<Out> out;
+  KFC_IF_SOME(e, runCatchingExceptions([&] {
+                out.emplace(toPromise<Out>(FunctionCaller<U, T>::apply(func, std::move(value))));
+              })) {
+    return Out(PromiseResult<KFC::UnfixVoid<typename Out::ValueType>>(std::move(e)));
+  }
+  return std::move(out.unwrap());
+}
+
 // Cross-thread event, scheduled by an Executor.
 class XThreadEventBase : public PromiseNode, public Event {
 public:
-  explicit XThreadEventBase(PromiseResultBase &result, const Executor &targetExecutor,
-                            EventLoop &loop);
+  explicit XThreadEventBase(PromiseResultBase &result, Executor &targetExecutor, EventLoop &loop);
+
+  // Dropping the promise of an asynchronous event before it's done cancels it: the function is not
+  // called if it hasn't started yet, and the promise it returned, if any, is dropped in the target
+  // EventLoop. The memory is released once the target has let go of the event.
+  void destroy() override;
 
 protected:
   // Execute the underlying function. If the function returns a promise, returns the inner promise
@@ -270,28 +470,75 @@ protected:
   void poll(Event *event) override;
 
 private:
+  // Where an asynchronous event is, as seen from the requesting thread.
+  enum State : uint8_t {
+    Queued,   // Sent to the target executor, which may be executing it.
+    Ready,    // Done, queued back to the requesting executor.
+    Armed,    // Done and taken by the requesting executor, no other thread refers to it.
+    Canceled, // Dropped by the requesting thread before being armed.
+  };
+
   Option<Own<Event>> fire() override;
   void done();
+  // Called in the target EventLoop when the requesting thread has dropped the event.
+  void cancel();
+  // Called by the target executor when its EventLoop is destroyed before the event has fired.
+  void disconnect();
   void setDisconnected() const;
+  // Drop the promise returned by the function, the event stops waiting for it.
+  void dropPromiseNode();
 
   PollEvent m_pollEvent;
   Option<OwnPromiseNode> m_promiseNode;
+  // In the target executor's `m_waitingEvents` while the event waits for `m_promiseNode`.
+  ListLink<XThreadEventBase> m_waitingLink;
   PromiseResultBase &m_result;
-  ListLink<XThreadEventBase> m_link;
+  XThreadEventBase *m_link;       // The next event in an `XThreadQueue`.
+  XThreadEventBase *m_cancelLink; // The next event in the queue of canceled events.
 
-  const Executor &m_targetExecutor;     // The executor executing this event.
-  Option<Executor &> m_requestExecutor; // The executor requesting this event.
-  Condvar m_condvar;                    // Notify the `m_requestExecutor` when the event is done.
+  // The executors outlive their EventLoops as long as an event refers to them, so that a late
+  // event finds out that the loop is gone rather than touching it.
+  Ref<Executor> m_targetExecutor;          // The executor executing this event.
+  Option<Ref<Executor>> m_requestExecutor; // The executor requesting this event.
+  Condvar m_condvar; // Notify the thread waiting in `executeSync` when the event is done.
+  bool m_syncDone;   // Guarded by the `m_syncMutex` of `m_targetExecutor`.
+
+  std::atomic<State> m_state;
+  bool m_detached;   // Sent by `executeDetached`, nobody waits for the result.
+  bool m_finished;   // Owned by the target thread, `done` has been called.
+  bool m_cancelSeen; // Owned by the target thread, the cancellation has been received.
 
   class DelayedDoneDisposer;
+  friend class XThreadQueue;
   friend KFC::Executor;
 };
 
+// An intrusive lock-free queue of cross-thread events with many producers and one consumer, the
+// thread of the EventLoop owning the queue. Producers push with a CAS, the consumer takes all the
+// queued events at once. Events are linked through `link`, so that an event can sit in queues with
+// different links at the same time.
+class XThreadQueue {
+public:
+  explicit XThreadQueue(XThreadEventBase *XThreadEventBase::*link = &XThreadEventBase::m_link)
+      : m_head(nullptr), m_linkMember(link) {}
+  KFC_DISALLOW_COPY_AND_MOVE(XThreadQueue)
+
+  void push(XThreadEventBase &event);
+  // Push events already linked from `newest` to `oldest`, with a single CAS.
+  void pushAll(XThreadEventBase &newest, XThreadEventBase &oldest);
+  // Take all queued events, oldest first, linked through the queue's link.
+  XThreadEventBase *takeAll();
+
+private:
+  std::atomic<XThreadEventBase *> m_head; // The newest event.
+  XThreadEventBase *XThreadEventBase::*m_linkMember;
+};
+
 template <class Func, class T = KFC::FixVoid<KFC::ReturnType<Func, void>>>
 class XThreadEvent final : public XThreadEventBase {
 public:
-  explicit XThreadEvent(Func &&func, const Executor &targetExecutor, EventLoop &loop)
-      : XThreadEventBase(m_result, targetExecutor, loop), m_func(std::move(func)) {}
+  explicit XThreadEvent(Func &&func, Executor &targetExecutor, EventLoop &loop)
+      : XThreadEventBase(m_result, targetExecutor, loop), m_func(std::forward<Func>(func)) {}
 
   void read(PromiseResultBase &result) noexcept override { result.as<T>() = std::move(m_result); }
 
@@ -301,7 +548,7 @@ public:
   }
 
 private:
-  Func m_func;
+  std::decay_t<Func> m_func; // Held by value, an lvalue function may be gone before it runs.
   PromiseResult<T> m_result;
   friend KFC::Executor;
 };
@@ -309,11 +556,11 @@ private:
 template <class Func, class T>
 class XThreadEvent<Func, Promise<T>> final : public XThreadEventBase {
 public:
-  explicit XThreadEvent(Func &&func, const Executor &targetExecutor, EventLoop &loop)
-      : XThreadEventBase(m_result, targetExecutor, loop), m_func(std::move(func)) {}
+  explicit XThreadEvent(Func &&func, Executor &targetExecutor, EventLoop &loop)
+      : XThreadEventBase(m_result, targetExecutor, loop), m_func(std::forward<Func>(func)) {}
 
   void read(PromiseResultBase &result) noexcept override {
-    result.as<Promise<T>>() = std::move(m_result);
+    result.as<KFC::FixVoid<T>>() = std::move(m_result);
   }
 
   Option<OwnPromiseNode> execute() override {
@@ -323,8 +570,8 @@ public:
   }
 
 private:
-  Func m_func;
-  Promise<T> m_result;
+  std::decay_t<Func> m_func;
+  PromiseResult<KFC::FixVoid<T>> m_result; // The result of the returned promise.
   friend KFC::Executor;
 };
 
@@ -383,7 +630,7 @@ public:
     return Own<WeakPromiseResolver>(ptr, ptr);
   }
 
-  explicit WeakPromiseResolver() : m_resolver(nullptr) {}
+  explicit WeakPromiseResolver() : m_resolver(nullptr), m_disposed(false) {}
   bool isWaiting() override { return m_resolver && m_resolver->isWaiting(); }
   void resolve(PromiseResult<T> &&result) override {
     if (m_resolver) m_resolver->resolve(std::move(result));
@@ -398,15 +645,23 @@ public:
             KFC_EXCEPTION(KFC::Exception::Kind::Logic,
                           "PromiseResolver was destroyed without resolving the promise"));
       }
-      m_resolver = nullptr;
+      // The adapter still refers to us, the last of the two to let go frees us.
+      m_disposed = true;
     }
   }
 
 private:
   void attach(PromiseResolver<T> &resolver) { m_resolver = &resolver; }
-  void detach(PromiseResolver<T> &) { m_resolver = nullptr; }
+  void detach(PromiseResolver<T> &) {
+    if (m_disposed) {
+      delete this;
+    } else {
+      m_resolver = nullptr;
+    }
+  }
 
   PromiseResolver<T> *m_resolver;
+  bool m_disposed; // The owner has let go, while the adapter was still attached.
   template <class> friend class PromiseResolverAdapter;
 };
 
@@ -434,17 +689,34 @@ using PromiseForResult = Promise<typename _::ReducePromise<ReturnType<Func, T>>:
 
 template <class T> class Promise : public _::PromiseBase {
 public:
+  using ValueType = FixVoid<T>;
+
   // Construct a promise already fulfilled with the given result.
-  explicit Promise(_::PromiseResult<T> &&result)
-      : PromiseBase(Own<_::ImmediatePromiseNode<T>>(new _::ImmediatePromiseNode<T>(result))) {}
+  explicit Promise(_::PromiseResult<T> &&result) {
+    KFC_CONSTEXPR_IF(fitsInline<FixVoid<T>>()) {
+      if (result.isOk()) {
+        setReady(std::move(result.unwrap()));
+        return;
+      }
+    }
+    m_node = new _::ImmediatePromiseNode<T>(std::move(result));
+  }
+  // Construct a promise already fulfilled with `value`. Values of up to two pointers are held
+  // inline, such a promise allocates nothing and runs the callbacks of `then` right away.
+  explicit Promise(FixVoid<T> value) : Promise(_::PromiseResult<T>(std::move(value))) {}
   // Construct a promise from a PromiseNode.
   explicit Promise(bool, _::OwnPromiseNode &&node) : PromiseBase(std::move(node)) {}
   // Chain a function to the promise. The function will be called when the promise is fulfilled.
   // The function should be callable with T and return a value of type U. The returned promise will
-  // be fulfilled with the result of calling the function.
+  // be fulfilled with the result of calling the function. On a promise whose value is held inline,
+  // the function is called before `then` returns.
   template <class Func, class ErrFunc = _::PropagateException>
   PromiseForResult<Func, T> then(Func &&func, ErrFunc errFunc = _::PropagateException()) {
     using U = ReturnType<Func, T>;
+    if (isReady()) {
+      return _::evaluateNow<PromiseForResult<Func, T>, FixVoid<U>>(
+          func, takeReady<FixVoid<T>>());
+    }
     _::OwnPromiseNode intermediate =
         new _::TransformPromiseNode<FixVoid<U>, FixVoid<T>, Func, ErrFunc>(
             std::move(m_node), std::forward<Func>(func), std::forward<ErrFunc>(errFunc));
@@ -457,7 +729,11 @@ public:
   // will be thrown.
   T wait(WaitScope &scope) {
     _::PromiseResult<FixVoid<T>> result;
-    _::wait(m_node, result, scope);
+    if (isReady()) {
+      result = takeReady<FixVoid<T>>();
+    } else {
+      _::wait(m_node, result, scope);
+    }
     return _::maybeReturnVoid(std::move(result));
   }
 
@@ -467,6 +743,28 @@ public:
     return then([](T &&) {});
   }
 
+  // Turn the promise into a hub that hands out any number of branches, each fulfilled with a copy
+  // of the result. The upstream chain runs once no matter how many branches wait on it. T must be
+  // copyable.
+  ForkedPromise<T> fork();
+
+  // Fail with a `Timeout` exception unless the promise settles within `delay` of `timer`'s time,
+  // or by the deadline of the current DeadlineScope if that comes first. Whichever side loses is
+  // dropped: the timer event is removed when the promise wins, the promise is cancelled when the
+  // timer does. A ready promise is returned as is. Defined in Timer.h.
+  Promise<T> timeoutAfter(Duration delay, Timer &timer);
+  Promise<T> timeoutAt(Time deadline, Timer &timer);
+  // Apply the deadline of the current DeadlineScope, if any, see `timeoutAt`.
+  Promise<T> withinDeadline();
+
+  // Run the callbacks chained so far in the `priority` lane of the EventLoop, e.g. to let
+  // interactive reads overtake a bulk download running on the same loop. Callbacks chained to the
+  // returned promise run in the lane of whoever waits on it.
+  Promise<T> withPriority(const EventPriority priority) {
+    return _::PromiseNode::to<Promise<T>>(
+        new _::PriorityPromiseNode<FixVoid<T>>(std::move(node()), priority));
+  }
+
 private:
   friend _::PromiseNode;
 };
@@ -482,6 +780,388 @@ template <class T> PromiseResolverPair<T> createPromiseAndResolver() {
   return {std::move(promise), std::move(resolver)};
 }
 
+namespace _ {
+// A node waiting for many promises at once. The branches, one Event per child, are allocated
+// inline right after the node, so fanning in N promises costs a single allocation. `Policy`
+// decides what the children's results make of the node's result:
+//
+//   using Out = ...;                          // The type of the node's result.
+//   static bool settlesEarly(const PromiseResult<FixVoid<T>> &result);
+//   static PromiseResult<FixVoid<Out>> early(PromiseResult<FixVoid<T>> &&result);
+//   static PromiseResult<FixVoid<Out>> collect(Branch *branches, size_t count);
+//
+// When a child settles early, the remaining children are dropped, which cancels them.
+template <class T, class Policy> class FanInPromiseNode final : public PromiseNode {
+public:
+  using Out = typename Policy::Out;
+
+  class Branch final : public Event {
+  public:
+    explicit Branch(FanInPromiseNode &parent, OwnPromiseNode &&node)
+        : m_parent(parent), m_node(std::move(node)) {
+      m_node->poll(this);
+    }
+    void cancel() {
+      m_node = nullptr;
+      disarm();
+    }
+
+    PromiseResult<KFC::FixVoid<T>> result;
+
+  private:
+    Option<Own<Event>> fire() override {
+      m_node->read(result);
+      m_node = nullptr;
+      m_parent.onBranchReady(*this);
+      return None;
+    }
+
+    FanInPromiseNode &m_parent;
+    OwnPromiseNode m_node;
+  };
+
+  static OwnPromiseNode create(std::vector<Promise<T>> &&promises) {
+    const size_t count = promises.size();
+    void *ptr = ArenaAllocated::operator new(allocSize(count));
+    auto *node = new (ptr) FanInPromiseNode(count);
+    OwnPromiseNode own(node);
+    // `m_count` only counts constructed branches, in case constructing one throws.
+    for (; node->m_count < count; node->m_count++) {
+      new (&node->branches()[node->m_count])
+          Branch(*node, PromiseNode::from(std::move(promises[node->m_count])));
+    }
+    if (count == 0) node->settle(Policy::collect(node->branches(), 0));
+    return own;
+  }
+
+  ~FanInPromiseNode() noexcept(false) override {
+    for (size_t i = m_count; i > 0; i--) dtor(branches()[i - 1]);
+  }
+
+  void destroy() override {
+    const size_t size = allocSize(m_capacity);
+    this->~FanInPromiseNode();
+    ArenaAllocated::operator delete(this, size);
+  }
+
+  void poll(Event *event) override { m_pollEvent.init(event); }
+  void read(PromiseResultBase &result) noexcept override {
+    result.as<KFC::FixVoid<Out>>() = std::move(m_result);
+  }
+
+private:
+  explicit FanInPromiseNode(const size_t capacity)
+      : m_capacity(capacity), m_count(0), m_ready(0), m_settled(false) {}
+
+  static constexpr size_t branchOffset() {
+    return (sizeof(FanInPromiseNode) + alignof(Branch) - 1) / alignof(Branch) * alignof(Branch);
+  }
+  static size_t allocSize(const size_t count) { return branchOffset() + count * sizeof(Branch); }
+  Branch *branches() {
+    return reinterpret_cast<Branch *>(reinterpret_cast<char *>(this) + branchOffset());
+  }
+
+  void onBranchReady(Branch &branch) {
+    if (m_settled) return;
+    if (Policy::settlesEarly(branch.result)) {
+      for (size_t i = 0; i < m_count; i++) {
+        if (&branches()[i] != &branch) branches()[i].cancel();
+      }
+      settle(Policy::early(std::move(branch.result)));
+    } else if (++m_ready == m_count) {
+      settle(Policy::collect(branches(), m_count));
+    }
+  }
+
+  void settle(PromiseResult<KFC::FixVoid<Out>> &&result) {
+    m_settled = true;
+    m_result = std::move(result);
+    m_pollEvent.arm();
+  }
+
+  PollEvent m_pollEvent;
+  size_t m_capacity; // Number of branches allocated.
+  size_t m_count;    // Number of branches constructed.
+  size_t m_ready;
+  bool m_settled;
+  PromiseResult<KFC::FixVoid<Out>> m_result;
+};
+
+template <class T> struct JoinPolicy {
+  using Out = std::vector<T>;
+  template <class R> static bool settlesEarly(const R &result) { return result.isErr(); }
+  template <class R> static PromiseResult<Out> early(R &&result) {
+    return PromiseResult<Out>(std::move(result.unwrapErr()));
+  }
+  template <class Branch> static PromiseResult<Out> collect(Branch *branches, const size_t count) {
+    Out values;
+    values.reserve(count);
+    for (size_t i = 0; i < count; i++) values.push_back(std::move(branches[i].result.unwrap()));
+    return PromiseResult<Out>(std::move(values));
+  }
+};
+
+template <> struct JoinPolicy<void> {
+  using Out = void;
+  template <class R> static bool settlesEarly(const R &result) { return result.isErr(); }
+  template <class R> static PromiseResult<Void> early(R &&result) {
+    return PromiseResult<Void>(std::move(result.unwrapErr()));
+  }
+  template <class Branch> static PromiseResult<Void> collect(Branch *, size_t) {
+    return PromiseResult<Void>(Void{});
+  }
+};
+
+template <class T> struct RacePolicy {
+  using Out = T;
+  template <class R> static bool settlesEarly(const R &) { return true; }
+  template <class R> static R early(R &&result) { return std::move(result); }
+  template <class Branch> static PromiseResult<KFC::FixVoid<T>> collect(Branch *, size_t) {
+    KFC_THROW_FATAL(Exception::Kind::Logic, "racePromises requires at least one promise");
+  }
+};
+
+template <class T> struct SettlePolicy {
+  using Out = std::vector<Result<KFC::FixVoid<T>, Exception>>;
+  template <class R> static bool settlesEarly(const R &) { return false; }
+  template <class R> static PromiseResult<Out> early(R &&) { KFC_UNREACHABLE(); }
+  template <class Branch> static PromiseResult<Out> collect(Branch *branches, const size_t count) {
+    Out results;
+    results.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      results.push_back(std::move(static_cast<Result<KFC::FixVoid<T>, Exception> &>(
+          branches[i].result)));
+    }
+    return PromiseResult<Out>(std::move(results));
+  }
+};
+
+template <class T, class Policy>
+Promise<typename Policy::Out> fanIn(std::vector<Promise<T>> &&promises) {
+  return PromiseNode::to<Promise<typename Policy::Out>>(
+      FanInPromiseNode<T, Policy>::create(std::move(promises)));
+}
+} // namespace _
+
+// Return a promise fulfilled with the results of all `promises`, in order, once they are all
+// fulfilled. If any of them fails, the returned promise fails with the same exception right away
+// and the others are cancelled. Joining `Promise<void>`s returns a `Promise<void>`.
+template <class T>
+Promise<typename _::JoinPolicy<T>::Out> joinPromises(std::vector<Promise<T>> &&promises) {
+  return _::fanIn<T, _::JoinPolicy<T>>(std::move(promises));
+}
+
+// Return a promise settled like the first of `promises` to settle, fulfilled or failed. The
+// others are cancelled. `promises` must not be empty.
+template <class T> Promise<T> racePromises(std::vector<Promise<T>> &&promises) {
+  KFC_CHECK(!promises.empty(), "racePromises requires at least one promise");
+  return _::fanIn<T, _::RacePolicy<T>>(std::move(promises));
+}
+
+// Return a promise fulfilled with the outcome of each of `promises`, in order, once they have all
+// settled. Unlike `joinPromises`, a failure doesn't cancel the others.
+template <class T>
+Promise<typename _::SettlePolicy<T>::Out> settlePromises(std::vector<Promise<T>> &&promises) {
+  return _::fanIn<T, _::SettlePolicy<T>>(std::move(promises));
+}
+
+namespace _ {
+// Races a promise against a timer event, see `Promise::timeoutAt`. Both sides are waited on through
+// events held inline, so a timeout costs this node and the timer's.
+template <class T> class TimeoutPromiseNode final : public PromiseNode {
+public:
+  explicit TimeoutPromiseNode(OwnPromiseNode &&node, OwnPromiseNode &&timer)
+      : m_settled(false), m_value(*this, std::move(node)), m_timer(*this, std::move(timer)) {}
+
+  void poll(Event *event) override { m_pollEvent.init(event); }
+  void read(PromiseResultBase &result) noexcept override { result.as<T>() = std::move(m_result); }
+
+private:
+  // `IsTimer` tells the branches apart when T is Void.
+  template <class U, bool IsTimer> class Branch final : public Event {
+  public:
+    explicit Branch(TimeoutPromiseNode &parent, OwnPromiseNode &&node)
+        : m_parent(parent), m_node(std::move(node)) {
+      m_node->poll(this);
+    }
+    void cancel() {
+      m_node = nullptr;
+      disarm();
+    }
+
+    PromiseResult<U> result;
+
+  private:
+    Option<Own<Event>> fire() override {
+      m_node->read(result);
+      m_node = nullptr;
+      m_parent.onBranchReady(*this);
+      return None;
+    }
+
+    TimeoutPromiseNode &m_parent;
+    OwnPromiseNode m_node;
+  };
+
+  void onBranchReady(Branch<T, false> &) {
+    if (m_settled) return;
+    m_timer.cancel();
+    settle(std::move(m_value.result));
+  }
+
+  void onBranchReady(Branch<Void, true> &) {
+    if (m_settled) return;
+    m_value.cancel();
+    if (m_timer.result.isErr()) {
+      settle(PromiseResult<T>(std::move(m_timer.result.unwrapErr())));
+    } else {
+      settle(PromiseResult<T>(KFC_EXCEPTION(Exception::Kind::Timeout, "Promise timed out")));
+    }
+  }
+
+  void settle(PromiseResult<T> &&result) {
+    m_settled = true;
+    m_result = std::move(result);
+    m_pollEvent.arm();
+  }
+
+  PollEvent m_pollEvent;
+  bool m_settled;
+  PromiseResult<T> m_result;
+  Branch<T, false> m_value;
+  Branch<Void, true> m_timer;
+};
+
+class ForkHubBase;
+
+// A promise handed out by a ForkedPromise. It registers with the hub until the hub is ready.
+class ForkBranchBase : public PromiseNode {
+public:
+  explicit ForkBranchBase(ForkHubBase &hub);
+  ~ForkBranchBase() noexcept(false) override;
+  void poll(Event *event) override;
+
+protected:
+  ForkHubBase &getHub() { return m_hub.get(); }
+
+private:
+  void hubReady();
+
+  Ref<ForkHubBase> m_hub;
+  PollEvent m_pollEvent;
+  ListLink<ForkBranchBase> m_link;
+  friend ForkHubBase;
+};
+
+// Owns the upstream node of a forked promise and is the Event waiting for it. The ForkedPromise
+// and every branch hold a reference, the upstream node is dropped, and thus cancelled, along with
+// the last of them.
+class ForkHubBase : public RefCounted<ForkHubBase>, public Event {
+public:
+  explicit ForkHubBase(OwnPromiseNode &&inner, PromiseResultBase &result);
+  ~ForkHubBase() noexcept(false) override;
+
+private:
+  Option<Own<Event>> fire() override;
+
+  OwnPromiseNode m_inner;
+  PromiseResultBase &m_result;
+  List<ForkBranchBase, &ForkBranchBase::m_link> m_branches; // Branches waiting for the result.
+  bool m_ready;
+  friend ForkBranchBase;
+};
+
+template <class T> class ForkHub final : public ForkHubBase {
+public:
+  explicit ForkHub(OwnPromiseNode &&inner) : ForkHubBase(std::move(inner), m_result) {}
+
+private:
+  PromiseResult<T> m_result;
+  template <class> friend class ForkBranch;
+};
+
+template <class T> class ForkBranch final : public ForkBranchBase {
+public:
+  explicit ForkBranch(ForkHub<T> &hub) : ForkBranchBase(hub) {}
+  void read(PromiseResultBase &result) noexcept override {
+    result.as<T>() = PromiseResult<T>(static_cast<ForkHub<T> &>(getHub()).m_result);
+  }
+};
+} // namespace _
+
+// A promise whose result is shared by any number of branches. See `Promise::fork`.
+template <class T> class ForkedPromise {
+public:
+  explicit ForkedPromise(Promise<T> &&promise)
+      : m_hub(adoptRef(*new _::ForkHub<FixVoid<T>>(_::PromiseNode::from(std::move(promise))))) {}
+
+  // Return a new promise for the result. Branches added after the result is ready resolve on the
+  // next turn of the loop.
+  Promise<T> addBranch() {
+    return _::PromiseNode::to<Promise<T>>(new _::ForkBranch<FixVoid<T>>(m_hub.get()));
+  }
+
+private:
+  Ref<_::ForkHub<FixVoid<T>>> m_hub;
+};
+
+template <class T> ForkedPromise<T> Promise<T>::fork() {
+  return ForkedPromise<T>(std::move(*this));
+}
+
+class Canceler;
+
+namespace _ {
+// A promise wrapped by a Canceler. It waits for the wrapped node through its own event, so that
+// cancelling never has to touch an event of the downstream chain that may already be armed.
+class CancelerNode final : public PromiseNode, public Event {
+public:
+  explicit CancelerNode(Canceler &canceler, OwnPromiseNode &&inner);
+  ~CancelerNode() noexcept(false) override;
+  void poll(Event *event) override;
+  void read(PromiseResultBase &result) noexcept override;
+
+private:
+  Option<Own<Event>> fire() override;
+  // Drop the wrapped node and fail with `reason`.
+  void cancel(const Exception &reason);
+
+  Canceler &m_canceler;
+  OwnPromiseNode m_inner; // Null once settled or cancelled.
+  Option<Exception> m_reason;
+  PollEvent m_pollEvent;
+  ListLink<CancelerNode> m_link;
+  friend KFC::Canceler;
+};
+} // namespace _
+
+// Cancels a group of promises at once. A promise passed through `wrap` that hasn't settled yet when
+// `cancel` is called, or when the Canceler is destroyed, fails with a `Canceled` exception. The
+// chain it was waiting on is dropped right away rather than when the wrapped promise is: timers are
+// removed from their Timer, fd waits are unregistered from their FdObserver or EventPort, and
+// cross-thread events are withdrawn from the Executor they were sent to.
+class Canceler {
+public:
+  explicit Canceler() = default;
+  ~Canceler() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(Canceler)
+
+  template <class T> Promise<T> wrap(Promise<T> &&promise) {
+    return _::PromiseNode::to<Promise<T>>(
+        new _::CancelerNode(*this, _::PromiseNode::from(std::move(promise))));
+  }
+
+  // Cancel every wrapped promise that hasn't settled yet. Promises wrapped afterward are not
+  // affected.
+  void cancel(const String &reason);
+  // Whether no wrapped promise is waiting to be cancelled.
+  KFC_NODISCARD bool isEmpty() const { return m_nodes.empty(); }
+
+private:
+  List<_::CancelerNode, &_::CancelerNode::m_link> m_nodes;
+  friend _::CancelerNode;
+};
+
 // An interface for polling for events.
 class EventPort {
 public:
@@ -490,24 +1170,21 @@ public:
   // underlying EventLoop and return false. If no events have arrived, the call to `poll` will block
   // until a call to `wake` from another thread which will cause `poll` return true.
   virtual bool poll() = 0;
+  // Like `poll`, but return right away if no event has arrived. Return true if `wake` was called.
+  virtual bool tryPoll() = 0;
   // `wake` can be called from another thread to wake up the port that is polling for events or
   // a timeout. If called when the port is not polling, the next call to `poll` will return
   // immediately.
   virtual void wake() const = 0;
 };
 
-// Schedule events to a EventLoop from another thread.
-class Executor final : public RefCounted<Executor> {
+// Schedule events to a EventLoop from another thread. The executor may be referred to from any
+// thread and outlives its EventLoop: once the loop is destroyed, events sent to it fail with a
+// `Logic` exception, or are dropped for `executeDetached`, and `execute*` throws.
+class Executor final : public AtomicRefCounted<Executor> {
 public:
   static Ref<Executor> create(EventLoop &loop);
 
-  struct Shared {
-    Option<EventLoop &> m_loop;
-    List<_::XThreadEventBase, &_::XThreadEventBase::m_link> m_pendingEvents;
-    List<_::XThreadEventBase, &_::XThreadEventBase::m_link> m_readyEvents;
-    Shared(EventLoop &loop) : m_loop(loop) {}
-  };
-
   explicit Executor(EventLoop &loop);
   ~Executor() noexcept(false) override;
 
@@ -523,21 +1200,147 @@ public:
     return _::PromiseNode::to<PromiseForResult<Func, void>>(std::move(event));
   }
 
+  // Call each of `funcs` in the executor's EventLoop, as `executeAsync` would, but hand them over
+  // together: the batch takes a single push to the executor's queue and at most one wake of its
+  // EventLoop. The returned promise joins the results, in the order of `funcs`, see `joinPromises`.
+  template <class Func> auto executeBatch(std::vector<Func> funcs) {
+    std::vector<PromiseForResult<Func, void>> promises;
+    promises.reserve(funcs.size());
+    _::XThreadEventBase *oldest = nullptr;
+    _::XThreadEventBase *newest = nullptr;
+    for (Func &func : funcs) {
+      auto event = new _::XThreadEvent<Func>(std::move(func), *this, getEventLoop());
+      // Link the events the way the queue does, newest first.
+      event->m_link = newest;
+      newest = event;
+      if (!oldest) oldest = event;
+      promises.push_back(_::PromiseNode::to<PromiseForResult<Func, void>>(std::move(event)));
+    }
+    if (newest) sendPendingBatch(*newest, *oldest);
+    return joinPromises(std::move(promises));
+  }
+
+  // Call `func` in the executor's EventLoop without waiting for it. Unlike `executeAsync`, the
+  // calling thread doesn't need an EventLoop of its own. The result, exceptions included, is
+  // dropped, and so is the function if the EventLoop exits before running it.
+  template <class Func> void executeDetached(Func &&func) {
+    auto event = new _::XThreadEvent<Func>(std::forward<Func>(func), *this, getEventLoop());
+    sendDetached(*event);
+  }
+
+  // Whether the executor's EventLoop runs on the calling thread.
+  KFC_NODISCARD bool belongsToCurrentThread() const;
+
 private:
   // Called by the underlying EventLoop to check if any cross-thread events have arrived. If so, add
   // them into the event queue.
   bool poll();
   void sendPending(_::XThreadEventBase &event, bool sync = false);
+  // Send asynchronous events linked from `newest` to `oldest` through `m_link`.
+  void sendPendingBatch(_::XThreadEventBase &newest, _::XThreadEventBase &oldest);
   void sendReady(_::XThreadEventBase &event);
+  void sendDetached(_::XThreadEventBase &event);
+  // Push the event to one of the queues of the executor, and wake its EventLoop unless a wake is
+  // already pending. Return false if the EventLoop has exited.
+  bool send(_::XThreadQueue &queue, _::XThreadEventBase &event);
+  bool send(_::XThreadQueue &queue, _::XThreadEventBase &newest, _::XThreadEventBase &oldest);
   EventLoop &getEventLoop();
-  KFC_NODISCARD bool belongsToCurrentThread() const;
-
-  Mutex<Shared> m_shared;
+  // Called by the EventLoop when it's destroyed, with the events it had queued but not fired. Once
+  // it returns no event is sent anymore, and the events queued so far are disconnected.
+  void disconnect(const std::vector<_::XThreadEventBase *> &taken);
+
+  std::atomic<EventLoop *> m_loop;  // Null once the EventLoop has exited.
+  std::atomic<uint32_t> m_sending;  // Threads in `send` that may have seen `m_loop` set.
+  _::XThreadQueue m_pendingEvents;  // Events to execute in this executor's loop.
+  _::XThreadQueue m_readyEvents;    // Events requested by this executor that are done.
+  _::XThreadQueue m_canceledEvents; // Events sent to this executor, then dropped by the requester.
+  // Events waiting for the promise returned by their function, only touched by the loop's thread.
+  List<_::XThreadEventBase, &_::XThreadEventBase::m_waitingLink> m_waitingEvents;
+  // Set by the first event queued after a `poll`, so that a burst of events costs a single wake of
+  // the EventPort.
+  std::atomic<bool> m_wakePending;
+  mutable Mutex<Void> m_syncMutex; // Guards `m_syncDone` of the events waited by `executeSync`.
 
   friend EventLoop;
   friend _::XThreadEventBase;
 };
 
+constexpr size_t kFireHistogramBuckets = 24;
+constexpr int kCreationSiteFrames = 16;
+
+// Counters of an EventLoop, kept by its EventLoopInstrumentation.
+struct EventLoopStats {
+  uint64_t eventsFired;
+  uint64_t depthFirstArms;
+  uint64_t breadthFirstArms;
+  uint64_t lastArms;
+  size_t queueDepth; // Events armed and not fired yet.
+  size_t maxQueueDepth;
+  uint64_t budgetPolls; // Non-blocking polls made because the turn budget ran out.
+  Duration pollTime; // Time spent waiting for events in the EventPort or the Executor.
+  Duration busyTime; // Time spent firing events.
+  // Bucket 0 counts the events whose `fire` took less than 1us, bucket i the ones that took
+  // [2^(i-1), 2^i) us. The last bucket counts anything longer as well.
+  uint64_t fireHistogram[kFireHistogramBuckets];
+};
+
+// An event whose `fire` took at least the threshold set by `EventLoopInstrumentation::onSlowEvent`.
+struct SlowEvent {
+  String type;         // The demangled dynamic type of the event.
+  String creationSite; // Where the event was constructed, empty unless sites are captured.
+  Duration duration;
+};
+
+// Accounting for an EventLoop, attached with `EventLoop::setInstrumentation`. A loop without one
+// does no accounting at all. It must be used in the thread of the loop.
+//
+// Example:
+//
+//   EventLoopInstrumentation instrumentation;
+//   instrumentation.onSlowEvent(10_ms, [](const SlowEvent &e) {
+//     fprintf(stderr, "%s took %lld us\n%s\n", e.type.c_str(), e.duration.toMicroSeconds(),
+//             e.creationSite.c_str());
+//   });
+//   loop.setInstrumentation(instrumentation);
+class EventLoopInstrumentation final {
+public:
+  using SlowEventCallback = std::function<void(const SlowEvent &)>;
+
+  explicit EventLoopInstrumentation();
+  KFC_DISALLOW_COPY_AND_MOVE(EventLoopInstrumentation)
+
+  // Call `callback` after every event whose `fire` takes `threshold` or longer. With
+  // `captureCreationSites`, events constructed from now on record a stack trace so that the report
+  // can tell where they come from. That costs a backtrace per event, it's meant for debugging.
+  void onSlowEvent(Duration threshold, SlowEventCallback callback,
+                   bool captureCreationSites = false);
+  KFC_NODISCARD const EventLoopStats &getStats() const { return m_stats; }
+  // Zero the counters, except the queue depth which reflects the current queue.
+  void resetStats();
+
+private:
+  struct Site {
+    void *frames[kCreationSiteFrames];
+    int size;
+  };
+
+  void armed(uint64_t EventLoopStats::*counter);
+  void disarmed() { m_stats.queueDepth--; }
+  void constructed(const _::Event &event);
+  void destroyed(const _::Event &event);
+  Option<Own<_::Event>> fire(_::Event &event);
+  void polled(Duration duration) { m_stats.pollTime += duration; }
+
+  EventLoopStats m_stats;
+  Duration m_slowThreshold;
+  SlowEventCallback m_slowCallback;
+  bool m_captureSites;
+  std::unordered_map<const _::Event *, Site> m_sites;
+
+  friend class EventLoop;
+  friend class _::Event;
+};
+
 class EventLoop final {
 public:
   // Get the EventLoop for the current thread.
@@ -545,6 +1348,8 @@ public:
 
   explicit EventLoop();
   explicit EventLoop(EventPort &port);
+  ~EventLoop() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(EventLoop)
 
   // Get the executor for this event loop. An executor is created for an EventLoop on first call to
   // `getExecutor`.
@@ -554,41 +1359,217 @@ public:
   // Check if any events have arrived. If so, add them into the event queue. First try the EventPort
   // for in-thread events, then the Executor for cross-thread events.
   void poll();
+  // Account for the loop's activity in `instrumentation` from now on, or stop with None.
+  void setInstrumentation(Option<EventLoopInstrumentation &> instrumentation);
+  // Bound how long queued events can keep the EventPort from being polled. Once `maxEvents` events
+  // have fired, or `maxTime` has passed, since the last poll, `turn` polls the port without
+  // blocking before it fires the next event, so that I/O readiness gets in line behind at most that
+  // much work. Zero lifts a bound, both are lifted by default. `maxTime` is measured with the
+  // precise monotonic clock, a budget below a tick of the coarse one is honored too.
+  void setTurnBudget(uint32_t maxEvents, Duration maxTime = Duration(0));
 
 private:
   void enter() const;
   void leave() const;
+  void poll(bool block);
+  void pollPortOrExecutor(bool block);
+  KFC_NODISCARD bool isTurnBudgetExhausted() const;
+  void resetDepthFirstInsertPoints();
 
   _::Event *m_current;
-  _::Event *m_head;
-  _::Event **m_tail;
-  _::Event **m_depthFirstInsertPoint;
-  _::Event **m_breadthFirstInsertPoint;
+  _::EventQueue m_queues[kEventPriorities]; // Indexed by EventPriority.
+
+  uint32_t m_maxTurnEvents;
+  Duration m_maxTurnTime;
+  uint32_t m_eventsSincePoll;
+  Duration m_lastPollTime; // Only kept while `m_maxTurnTime` is set.
 
   Option<EventPort &> m_port;
   Option<Ref<Executor>> m_executor;
 
   String m_threadName;
+  _::Arena m_arena;
+  Option<EventLoopInstrumentation &> m_instrumentation;
 
   friend class _::Event;
+  friend class _::ArenaAllocated;
   friend class Executor;
   friend class WaitScope;
 };
 
+namespace _ {
+class FiberBase;
+class FiberStack;
+
+// A function run on a stack of a FiberPool.
+class FiberMain {
+public:
+  virtual void run() = 0;
+
+protected:
+  ~FiberMain() = default;
+};
+} // namespace _
+
 class WaitScope {
 public:
   explicit WaitScope(EventLoop &loop);
   ~WaitScope();
   KFC_DISALLOW_COPY_AND_MOVE(WaitScope)
 
+  // Run the events fired while waiting on stacks of `pool` rather than on the stack of the caller
+  // of `wait`. Pass None to go back to the caller's stack.
+  void runEventCallbacksOnStackPool(Option<FiberPool &> pool);
+
 private:
+  // The scope handed to the function of a fiber. Waiting on it suspends the fiber, the EventLoop
+  // is run by whoever waits on the loop's own scope.
+  explicit WaitScope(EventLoop &loop, _::FiberBase &fiber);
+
   friend void _::wait(_::OwnPromiseNode &node, _::PromiseResultBase &result,
                       const WaitScope &scope);
+  friend _::FiberBase;
 
   template <class Func> void runOnStackPool(Func &&func) const;
 
   EventLoop &m_loop;
+  Option<FiberPool &> m_pool;
+  Option<_::FiberBase &> m_fiber;
+};
+
+namespace _ {
+// A fiber started by `FiberPool::startFiber`. It's the Event that runs the fiber, first to start it
+// and then every time a promise it waits on is ready.
+class FiberBase : public PromiseNode, public Event, private FiberMain {
+public:
+  explicit FiberBase(FiberPool &pool);
+  ~FiberBase() noexcept(false) override;
+  // A fiber dropped while suspended is resumed to unwind its stack before it's destroyed.
+  void destroy() override;
+  void poll(Event *event) override;
+  // Called on the fiber's stack: suspend the fiber until `node` is ready, then read it.
+  void wait(OwnPromiseNode &node, PromiseResultBase &result);
+
+protected:
+  // Call the function with `scope` and keep its result, exceptions included.
+  virtual void runFunc(WaitScope &scope) = 0;
+
+private:
+  enum State : uint8_t {
+    Waiting,  // Not started yet.
+    Running,  // Started, suspended in `wait` unless it's the fiber running now.
+    Canceled, // Dropped while suspended, being unwound.
+    Finished, // The function has returned.
+  };
+
+  Option<Own<Event>> fire() override;
+  void run() override;
+  // Start or resume the fiber. Return when it suspends or finishes.
+  void switchIn();
+
+  FiberPool &m_pool;
+  FiberStack *m_stack; // Back to the pool as soon as the fiber finishes.
+  State m_state;
+  PollEvent m_pollEvent;
+};
+
+template <class Func, class T> class Fiber final : public FiberBase {
+public:
+  template <class F>
+  explicit Fiber(FiberPool &pool, F &&func) : FiberBase(pool), m_func(std::forward<F>(func)) {}
+  void read(PromiseResultBase &result) noexcept override { result.as<T>() = std::move(m_result); }
+
+private:
+  void runFunc(WaitScope &scope) override {
+    KFC_IF_SOME(e, runCatchingExceptions([&] {
+                  m_result = PromiseResult<T>(FunctionCaller<T, WaitScope &>::apply(m_func, scope));
+                })) {
+      m_result.assignException(std::move(e));
+    }
+  }
+
+  Func m_func;
+  PromiseResult<T> m_result;
 };
+} // namespace _
+
+constexpr size_t kDefaultFiberStackSize = 64 * 1024;
+constexpr size_t kDefaultFiberFreelist = 64;
+
+// A pool of stacks to run fibers on. The function of a fiber can wait on promises synchronously:
+// the fiber is suspended until the promise is ready while the EventLoop goes on with other events,
+// which lets blocking-style code run on the loop without a thread of its own. A stack is mapped
+// once, with a guard page below it, and reused by the next fibers rather than mapped per fiber.
+//
+// Example:
+//
+//   FiberPool pool;
+//   Promise<int> p = pool.startFiber([&](WaitScope &scope) {
+//     return fetchHeader().wait(scope) + fetchBody().wait(scope);
+//   });
+//
+// A fiber must not wait while handling an exception, the exception bookkeeping of the C++ runtime
+// is per thread rather than per stack.
+class FiberPool final {
+public:
+  explicit FiberPool(size_t stackSize = kDefaultFiberStackSize);
+  ~FiberPool() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(FiberPool)
+
+  // Keep at most `count` unused stacks for reuse, more are unmapped as their fibers finish.
+  void setMaxFreelist(size_t count);
+  // Return the number of unused stacks kept for reuse.
+  KFC_NODISCARD size_t getFreelistSize();
+
+  // Run `func(WaitScope &)` on a fiber, starting on a later turn of the current thread's EventLoop.
+  // The returned promise is fulfilled with what `func` returns. Dropping the promise of a suspended
+  // fiber cancels it: its pending `wait` throws a `Canceled` exception to unwind the stack.
+  template <class Func> Promise<ReturnType<Func, WaitScope &>> startFiber(Func &&func);
+
+  // Run `func` on a stack of the pool and return once it returns. An exception thrown by `func` is
+  // rethrown on the caller's stack. `func` must not wait.
+  template <class Func> void runSynchronously(Func &&func);
+
+private:
+  struct Freelist {
+    std::vector<_::FiberStack *> stacks;
+    size_t max;
+  };
+
+  _::FiberStack &acquireStack();
+  void releaseStack(_::FiberStack &stack);
+  void runOnStack(_::FiberMain &main);
+
+  size_t m_stackSize;
+  Mutex<Freelist> m_freelist;
+  friend _::FiberBase;
+};
+
+template <class Func> Promise<ReturnType<Func, WaitScope &>> FiberPool::startFiber(Func &&func) {
+  using U = ReturnType<Func, WaitScope &>;
+  return _::PromiseNode::to<Promise<U>>(
+      new _::Fiber<std::decay_t<Func>, FixVoid<U>>(*this, std::forward<Func>(func)));
+}
+
+template <class Func> void FiberPool::runSynchronously(Func &&func) {
+  class Main final : public _::FiberMain {
+  public:
+    explicit Main(Func &func) : m_func(func) {}
+    void run() override {
+      try {
+        m_func();
+      } catch (...) {
+        m_exception = std::current_exception();
+      }
+    }
+
+    Func &m_func;
+    std::exception_ptr m_exception;
+  };
+  Main main(func);
+  runOnStack(main);
+  if (main.m_exception) std::rethrow_exception(main.m_exception);
+}
 
 Promise<void> yield();
 
@@ -604,4 +1585,118 @@ template <class Func> PromiseForResult<Func, void> evaluateLater(Func &&func) {
 
 EventLoop &getCurrentThreadEventLoop();
 Ref<Executor> getCurrentThreadExecutor();
+
+#if KFC_HAS_COROUTINE
+namespace _ {
+// The part of a coroutine's promise type that doesn't depend on its result. The promise type lives
+// in the coroutine frame and serves as the PromiseNode of the Promise returned by the coroutine,
+// so a coroutine costs a single allocation no matter how many promises it awaits. It is also the
+// Event armed, depth-first like any other continuation, to resume the coroutine when an awaited
+// promise resolves.
+class CoroutineBase : public PromiseNode, public Event {
+public:
+  explicit CoroutineBase(const std::coroutine_handle<> handle, PromiseResultBase &result)
+      : m_handle(handle), m_result(result) {}
+
+  void destroy() override { m_handle.destroy(); }
+  void poll(Event *event) override { m_pollEvent.init(event); }
+
+  // Coroutines start eagerly, like the functions calling `then` they replace.
+  std::suspend_never initial_suspend() noexcept { return {}; }
+  // Stay suspended so that the result outlives the body, until the promise is dropped.
+  class FinalAwaiter {
+  public:
+    explicit FinalAwaiter(CoroutineBase &coroutine) : m_coroutine(coroutine) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<>) const noexcept { m_coroutine.m_pollEvent.arm(); }
+    void await_resume() const noexcept {}
+
+  private:
+    CoroutineBase &m_coroutine;
+  };
+  FinalAwaiter final_suspend() noexcept { return FinalAwaiter(*this); }
+  void unhandled_exception() {
+    KFC_IF_SOME(e, runCatchingExceptions([] { throw; })) { m_result.assignException(std::move(e)); }
+  }
+
+private:
+  Option<Own<Event>> fire() override {
+    m_handle.resume();
+    return None;
+  }
+
+  std::coroutine_handle<> m_handle;
+  PromiseResultBase &m_result;
+  PollEvent m_pollEvent;
+};
+
+// Returned by `co_await promise`. The awaited node is polled with the coroutine as its event and
+// read once the coroutine is resumed.
+template <class T> class PromiseAwaiter {
+public:
+  explicit PromiseAwaiter(CoroutineBase &coroutine, OwnPromiseNode &&node)
+      : m_coroutine(coroutine), m_node(std::move(node)) {}
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<>) { m_node->poll(&m_coroutine); }
+  T await_resume() {
+    PromiseResult<KFC::FixVoid<T>> result;
+    m_node->read(result);
+    m_node = nullptr;
+    return maybeReturnVoid(std::move(result));
+  }
+
+private:
+  CoroutineBase &m_coroutine;
+  OwnPromiseNode m_node;
+};
+
+template <class T> class CoroutineResult {
+public:
+  void return_value(T value) { m_value = PromiseResult<T>(std::move(value)); }
+
+protected:
+  PromiseResult<T> m_value;
+};
+
+template <> class CoroutineResult<void> {
+public:
+  void return_void() { m_value = PromiseResult<Void>(Void{}); }
+
+protected:
+  PromiseResult<Void> m_value;
+};
+
+// The promise type of coroutines returning Promise<T>.
+template <class T> class Coroutine final : public CoroutineResult<T>, public CoroutineBase {
+public:
+  Coroutine()
+      : CoroutineBase(std::coroutine_handle<Coroutine>::from_promise(*this), this->m_value) {}
+
+  // Only the size is taken, so that coroutine parameters are never mistaken for placement new
+  // arguments.
+  static void *operator new(const size_t size) { return ArenaAllocated::operator new(size); }
+  static void operator delete(void *ptr, const size_t size) noexcept {
+    ArenaAllocated::operator delete(ptr, size);
+  }
+
+  Promise<T> get_return_object() { return PromiseNode::to<Promise<T>>(OwnPromiseNode(this)); }
+  void read(PromiseResultBase &result) noexcept override {
+    result.as<KFC::FixVoid<T>>() = std::move(this->m_value);
+  }
+
+  template <class U> PromiseAwaiter<U> await_transform(Promise<U> &&promise) {
+    return PromiseAwaiter<U>(*this, PromiseNode::from(std::move(promise)));
+  }
+  template <class U> PromiseAwaiter<U> await_transform(Promise<U> &promise) {
+    return PromiseAwaiter<U>(*this, PromiseNode::from(std::move(promise)));
+  }
+};
+} // namespace _
+#endif
 KFC_NAMESPACE_END
+
+#if KFC_HAS_COROUTINE
+template <class T, class... Args> struct std::coroutine_traits<KFC::Promise<T>, Args...> {
+  using promise_type = KFC::_::Coroutine<T>;
+};
+#endif
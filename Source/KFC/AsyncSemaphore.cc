@@ -0,0 +1,64 @@
+#include "KFC/AsyncSemaphore.h"
+
+KFC_NAMESPACE_BEG
+
+AsyncSemaphore::Permit::Permit(Permit &&other) noexcept
+    : m_semaphore(KFC_EXCHANGE(other.m_semaphore, nullptr)) {}
+
+AsyncSemaphore::Permit &AsyncSemaphore::Permit::operator=(Permit &&other) noexcept {
+  if (this != &other) {
+    release();
+    m_semaphore = KFC_EXCHANGE(other.m_semaphore, nullptr);
+  }
+  return *this;
+}
+
+AsyncSemaphore::Permit::~Permit() { release(); }
+
+void AsyncSemaphore::Permit::release() {
+  if (AsyncSemaphore *semaphore = KFC_EXCHANGE(m_semaphore, nullptr)) semaphore->release();
+}
+
+AsyncSemaphore::AsyncSemaphore(const size_t permits) : m_available(permits) {}
+
+AsyncSemaphore::~AsyncSemaphore() noexcept(false) {
+  while (!m_waiters.empty()) {
+    Waiter &waiter = m_waiters.front();
+    m_waiters.remove(waiter);
+    waiter.m_resolver.resolve(
+        KFC_EXCEPTION(Exception::Kind::Canceled, "AsyncSemaphore was destroyed"));
+  }
+}
+
+Promise<AsyncSemaphore::Permit> AsyncSemaphore::acquire() {
+  KFC_IF_SOME(permit, tryAcquire()) { return Promise<Permit>(std::move(permit)); }
+  return _::createAdaptedPromise<Permit, Waiter>(*this);
+}
+
+Option<AsyncSemaphore::Permit> AsyncSemaphore::tryAcquire() {
+  if (m_available == 0 || !m_waiters.empty()) return None;
+  --m_available;
+  return Permit(*this);
+}
+
+void AsyncSemaphore::release() {
+  if (m_waiters.empty()) {
+    ++m_available;
+    return;
+  }
+  // Hand the permit over, so that it can't be taken by a `tryAcquire` in the meantime.
+  Waiter &waiter = m_waiters.front();
+  m_waiters.remove(waiter);
+  waiter.m_resolver.resolve(Permit(*this));
+}
+
+AsyncSemaphore::Waiter::Waiter(_::PromiseResolver<Permit> &resolver, AsyncSemaphore &semaphore)
+    : m_resolver(resolver), m_semaphore(semaphore) {
+  m_semaphore.m_waiters.add(*this);
+}
+
+AsyncSemaphore::Waiter::~Waiter() noexcept(false) {
+  if (m_link.isLinked()) m_semaphore.m_waiters.remove(*this);
+}
+
+KFC_NAMESPACE_END
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/List.h"
+#include "KFC/Option.h"
+#include "KFC/Preclude.h"
+
+KFC_NAMESPACE_BEG
+
+// A counting semaphore for the promises of one EventLoop, e.g. to cap the number of connections
+// open at once. Waiting for a permit suspends the promise rather than the thread. Permits are
+// handed out in the order they were asked for, and a released permit goes straight to the oldest
+// waiter. Not thread-safe.
+class AsyncSemaphore final {
+public:
+  // A permit of the semaphore, given back when the permit is destroyed.
+  class Permit final {
+  public:
+    explicit Permit() : m_semaphore(nullptr) {}
+    Permit(Permit &&other) noexcept;
+    Permit &operator=(Permit &&other) noexcept;
+    ~Permit();
+    KFC_DISALLOW_COPY(Permit)
+
+    KFC_NODISCARD bool isValid() const { return m_semaphore != nullptr; }
+    // Give the permit back before the destruction.
+    void release();
+
+  private:
+    explicit Permit(AsyncSemaphore &semaphore) : m_semaphore(&semaphore) {}
+
+    AsyncSemaphore *m_semaphore;
+
+    friend AsyncSemaphore;
+  };
+
+  explicit AsyncSemaphore(size_t permits);
+  // Pending acquisitions fail with a `Canceled` exception.
+  ~AsyncSemaphore() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(AsyncSemaphore)
+
+  // Get a permit, once one is available.
+  Promise<Permit> acquire();
+  // Get a permit if one is available now. Doesn't jump ahead of the pending acquisitions.
+  Option<Permit> tryAcquire();
+
+  KFC_NODISCARD size_t available() const { return m_available; }
+  KFC_NODISCARD size_t waiting() const { return m_waiters.size(); }
+
+private:
+  class Waiter final {
+  public:
+    explicit Waiter(_::PromiseResolver<Permit> &resolver, AsyncSemaphore &semaphore);
+    ~Waiter() noexcept(false);
+    KFC_DISALLOW_COPY_AND_MOVE(Waiter)
+
+  private:
+    _::PromiseResolver<Permit> &m_resolver;
+    AsyncSemaphore &m_semaphore;
+    ListLink<Waiter> m_link;
+
+    friend AsyncSemaphore;
+  };
+
+  void release();
+
+  size_t m_available;
+  List<Waiter, &Waiter::m_link> m_waiters;
+
+  friend Waiter;
+};
+
+// A mutual exclusion lock for the promises of one EventLoop, for critical sections that span
+// several turns of the loop. Not thread-safe.
+class AsyncMutex final {
+public:
+  // Held while the lock is, unlocks when destroyed.
+  using Guard = AsyncSemaphore::Permit;
+
+  explicit AsyncMutex() : m_semaphore(1) {}
+  KFC_DISALLOW_COPY_AND_MOVE(AsyncMutex)
+
+  Promise<Guard> lock() { return m_semaphore.acquire(); }
+  Option<Guard> tryLock() { return m_semaphore.tryAcquire(); }
+  KFC_NODISCARD bool isLocked() const { return m_semaphore.available() == 0; }
+
+private:
+  AsyncSemaphore m_semaphore;
+};
+
+KFC_NAMESPACE_END
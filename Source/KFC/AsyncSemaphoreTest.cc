@@ -0,0 +1,84 @@
+#include "KFC/AsyncSemaphore.h"
+#include "KFC/Testing.h"
+
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  EventLoop loop;                                                                                  \
+  WaitScope scope(loop)
+
+TEST(AsyncSemaphoreTest, AcquireRelease) {
+  SETUP_TEST_EVENT_LOOP;
+  AsyncSemaphore semaphore(2);
+  AsyncSemaphore::Permit a = semaphore.acquire().wait(scope);
+  AsyncSemaphore::Permit b = semaphore.acquire().wait(scope);
+  EXPECT_EQ(semaphore.available(), 0);
+  EXPECT_TRUE(semaphore.tryAcquire().isNone());
+
+  Promise<AsyncSemaphore::Permit> c = semaphore.acquire();
+  EXPECT_EQ(semaphore.waiting(), 1);
+  a.release();
+  // The permit went to the waiter rather than back to the semaphore.
+  EXPECT_EQ(semaphore.available(), 0);
+  EXPECT_TRUE(c.wait(scope).isValid());
+  // `c`'s permit has been dropped with the value.
+  EXPECT_EQ(semaphore.available(), 1);
+}
+
+TEST(AsyncSemaphoreTest, LimitsConcurrency) {
+  SETUP_TEST_EVENT_LOOP;
+  AsyncSemaphore semaphore(3);
+  int running = 0, maxRunning = 0;
+  std::vector<Promise<void>> tasks;
+  for (int i = 0; i < 10; ++i) {
+    tasks.push_back(semaphore.acquire().then([&](AsyncSemaphore::Permit &&permit) {
+      maxRunning = std::max(maxRunning, ++running);
+      return evaluateLater([&, permit = std::move(permit)] { --running; });
+    }));
+  }
+  joinPromises(std::move(tasks)).wait(scope);
+  EXPECT_EQ(maxRunning, 3);
+  EXPECT_EQ(semaphore.available(), 3);
+}
+
+TEST(AsyncSemaphoreTest, DroppedAcquire) {
+  SETUP_TEST_EVENT_LOOP;
+  AsyncSemaphore semaphore(1);
+  Option<AsyncSemaphore::Permit> permit = semaphore.tryAcquire();
+  KFC_DISCARD(semaphore.acquire());
+  EXPECT_EQ(semaphore.waiting(), 0);
+  permit = None;
+  EXPECT_EQ(semaphore.available(), 1);
+}
+
+TEST(AsyncSemaphoreTest, Destroyed) {
+  SETUP_TEST_EVENT_LOOP;
+  Option<AsyncSemaphore> semaphore;
+  semaphore.emplace(0);
+  Promise<AsyncSemaphore::Permit> p = semaphore.unwrap().acquire();
+  semaphore = None;
+  EXPECT_THROW(p.wait(scope), Exception);
+}
+
+TEST(AsyncSemaphoreTest, Mutex) {
+  SETUP_TEST_EVENT_LOOP;
+  AsyncMutex mutex;
+  std::vector<int> order;
+  Option<Promise<void>> first = mutex.lock().then([&](AsyncMutex::Guard &&guard) {
+    order.push_back(1);
+    return evaluateLater([&, guard = std::move(guard)] { order.push_back(2); });
+  });
+  Promise<void> second = mutex.lock().then([&](AsyncMutex::Guard &&) { order.push_back(3); });
+  EXPECT_TRUE(mutex.isLocked());
+  first.unwrap().wait(scope);
+  // The guard lives in the continuation, which goes away with the promise.
+  first = None;
+  second.wait(scope);
+  EXPECT_EQ(order, std::vector<int>({1, 2, 3}));
+  EXPECT_FALSE(mutex.isLocked());
+  EXPECT_TRUE(mutex.tryLock().isSome());
+}
+
+KFC_NAMESPACE_END
@@ -0,0 +1,112 @@
+#include "KFC/AsyncStream.h"
+#include "KFC/RunCatchingExceptions.h"
+
+#include <algorithm>
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+namespace {
+// Copies through a buffer, reading the next chunk only once the previous one has been written. It
+// is the adapter of the pump's promise and the event waiting for each read and write in turn, so a
+// long pump doesn't build up a chain of promises.
+class AsyncPump final : public _::Event {
+public:
+  explicit AsyncPump(_::PromiseResolver<uint64_t> &resolver, AsyncInputStream &input,
+                     AsyncOutputStream &output, const uint64_t limit)
+      : m_resolver(resolver), m_input(input), m_output(output), m_limit(limit), m_done(0),
+        m_reading(false), m_buffer(kAsyncPumpBufferSize) {
+    // Start from the loop, the promise can't be resolved before the adapter is constructed.
+    armBreadthFirst();
+  }
+  ~AsyncPump() noexcept(false) override { m_wait = nullptr; }
+  KFC_DISALLOW_COPY_AND_MOVE(AsyncPump)
+
+private:
+  Option<Own<Event>> fire() override {
+    if (!m_wait) {
+      step(_::PromiseResult<Void>(Void()));
+    } else if (m_reading) {
+      _::PromiseResult<size_t> result;
+      m_wait->read(result);
+      m_wait = nullptr;
+      step(std::move(result));
+    } else {
+      _::PromiseResult<Void> result;
+      m_wait->read(result);
+      m_wait = nullptr;
+      step(std::move(result));
+    }
+    return None;
+  }
+
+  // Continue with the result of the last read or write.
+  template <class T> void step(_::PromiseResult<T> &&result) {
+    if (result.isErr()) {
+      m_resolver.resolve(std::move(result.unwrapErr()));
+      return;
+    }
+    KFC_IF_SOME(e, runCatchingExceptions([&] { next(result.unwrap()); })) {
+      m_resolver.resolve(std::move(e));
+    }
+  }
+
+  void next(const size_t amount) {
+    // A chunk has been read, write it out. Reading nothing means the end of the input.
+    if (amount == 0) {
+      m_resolver.resolve(uint64_t(m_done));
+      return;
+    }
+    m_done += amount;
+    m_reading = false;
+    wait(m_output.write(m_buffer.data(), amount));
+  }
+
+  void next(Void) {
+    // The last chunk has been written, read the next one.
+    const uint64_t n = std::min<uint64_t>(m_limit - m_done, kAsyncPumpBufferSize);
+    if (n == 0) {
+      m_resolver.resolve(uint64_t(m_done));
+      return;
+    }
+    m_reading = true;
+    wait(m_input.tryRead(m_buffer.data(), 1, n));
+  }
+
+  template <class T> void wait(Promise<T> &&promise) {
+    m_wait = _::PromiseNode::from(std::move(promise));
+    m_wait->poll(this);
+  }
+
+  _::PromiseResolver<uint64_t> &m_resolver;
+  AsyncInputStream &m_input;
+  AsyncOutputStream &m_output;
+  const uint64_t m_limit;
+  uint64_t m_done;
+  bool m_reading;
+  _::OwnPromiseNode m_wait;
+  std::vector<unsigned char> m_buffer;
+};
+} // namespace
+
+Promise<size_t> AsyncInputStream::read(void *buffer, const size_t minBytes,
+                                       const size_t maxBytes) {
+  return tryRead(buffer, minBytes, maxBytes).then([minBytes](const size_t n) {
+    if (n < minBytes) {
+      KFC_THROW_FATAL(Exception::Kind::Logic, "Premature end of stream, read %zu of %zu bytes", n,
+                      minBytes);
+    }
+    return n;
+  });
+}
+
+Promise<uint64_t> AsyncInputStream::pumpTo(AsyncOutputStream &output, const uint64_t amount) {
+  KFC_IF_SOME(p, output.tryPumpFrom(*this, amount)) { return std::move(p); }
+  return _::createAdaptedPromise<uint64_t, AsyncPump>(*this, output, amount);
+}
+
+Option<Promise<uint64_t>> AsyncOutputStream::tryPumpFrom(AsyncInputStream &, uint64_t) {
+  return None;
+}
+
+KFC_NAMESPACE_END
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/Option.h"
+#include "KFC/Preclude.h"
+
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+class AsyncOutputStream;
+
+// The size of the buffer used by pumps that copy. It is also how far a pump reads ahead of the
+// output, so a slow output holds back the input instead of piling data up in memory.
+constexpr size_t kAsyncPumpBufferSize = 64 * 1024;
+
+// A piece of a vectored write.
+struct WritePiece {
+  const void *data;
+  size_t size;
+};
+
+// A stream of bytes read through promises. Buffers must stay valid until the returned promise
+// resolves or is dropped, and only one read may be in flight at a time.
+class AsyncInputStream {
+public:
+  virtual ~AsyncInputStream() noexcept(false) = default;
+
+  // Read at least `minBytes` and at most `maxBytes` into `buffer`, and return the number of bytes
+  // read. Fewer than `minBytes` means that the end of the stream has been reached.
+  virtual Promise<size_t> tryRead(void *buffer, size_t minBytes, size_t maxBytes) = 0;
+  // Like `tryRead`, but reaching the end of the stream before `minBytes` is an error.
+  Promise<size_t> read(void *buffer, size_t minBytes, size_t maxBytes);
+
+  // Copy up to `amount` bytes to `output`, stopping early at the end of the stream, and return the
+  // number of bytes copied. `output` gets a chance to do it more efficiently, see
+  // `AsyncOutputStream::tryPumpFrom`; otherwise the bytes go through a buffer of
+  // `kAsyncPumpBufferSize`, one write at a time.
+  virtual Promise<uint64_t> pumpTo(AsyncOutputStream &output, uint64_t amount = UINT64_MAX);
+};
+
+// A stream of bytes written through promises. Buffers must stay valid until the returned promise
+// resolves or is dropped, and only one write may be in flight at a time. A write resolves once all
+// its bytes have been handed over, which is what applies backpressure to the writer.
+class AsyncOutputStream {
+public:
+  virtual ~AsyncOutputStream() noexcept(false) = default;
+
+  virtual Promise<void> write(const void *buffer, size_t size) = 0;
+  // Write the pieces in order, as a single write where the stream supports it.
+  virtual Promise<void> write(std::vector<WritePiece> pieces) = 0;
+
+  // Called by `AsyncInputStream::pumpTo` to let the output implement the pump, e.g. with a
+  // zero-copy transfer between fds. Return None to use the generic pump.
+  virtual Option<Promise<uint64_t>> tryPumpFrom(AsyncInputStream &input, uint64_t amount);
+};
+
+// A stream that can be both read and written, e.g. a socket.
+class AsyncIoStream : public AsyncInputStream, public AsyncOutputStream {};
+
+KFC_NAMESPACE_END
@@ -1,7 +1,13 @@
 #include "KFC/Async.h"
 #include "KFC/Preclude.h"
+#include "KFC/Sleep.h"
 #include "KFC/Testing.h"
 #include "KFC/Thread.h"
+#include "KFC/Timer.h"
+#include "KFC/WaitGroup.h"
+#include <functional>
+#include <memory>
+#include <vector>
 
 KFC_NAMESPACE_BEG
 
@@ -101,6 +107,90 @@ TEST_F(AsyncTest, ResolverDistroyedWithoutResolvingPromise) {
   EXPECT_THROW(par.promise.wait(scope), Exception);
 }
 
+TEST_F(AsyncTest, ArenaReusesFreedBlocks) {
+  _::Arena arena;
+  void *p = arena.allocate(40);
+  arena.deallocate(p, 40);
+  // Sizes in the same class share blocks.
+  EXPECT_EQ(arena.allocate(33), p);
+  void *q = arena.allocate(24);
+  EXPECT_NE(q, p);
+  arena.deallocate(p, 33);
+  arena.deallocate(q, 24);
+}
+
+TEST_F(AsyncTest, ArenaReusesPromiseNodes) {
+  SETUP_TEST_EVENT_LOOP;
+  const _::PromiseNode *node;
+  {
+    Promise<int> p = evaluateLater([] { return 42; });
+    node = &_::PromiseNode::from(p);
+  }
+  Promise<int> p = evaluateLater([] { return 42; });
+  EXPECT_EQ(&_::PromiseNode::from(p), node);
+  EXPECT_EQ(p.wait(scope), 42);
+}
+
+TEST_F(AsyncTest, ReadyThenRunsEagerly) {
+  SETUP_TEST_EVENT_LOOP;
+  EventLoopInstrumentation instrumentation;
+  loop.setInstrumentation(instrumentation);
+  bool called = false;
+  Promise<int> p = Promise<int>(20).then([&](int x) {
+    called = true;
+    return x + 1;
+  });
+  EXPECT_TRUE(called);
+  EXPECT_EQ(p.then([](int x) { return x * 2; }).wait(scope), 42);
+  EXPECT_EQ(instrumentation.getStats().eventsFired, 0);
+  loop.setInstrumentation(None);
+}
+
+TEST_F(AsyncTest, ReadyThenVoid) {
+  SETUP_TEST_EVENT_LOOP;
+  int n = 0;
+  Promise<void>(Void()).then([&] { ++n; }).then([&] { ++n; }).wait(scope);
+  EXPECT_EQ(n, 2);
+}
+
+TEST_F(AsyncTest, ReadyThenException) {
+  SETUP_TEST_EVENT_LOOP;
+  Promise<int> p = Promise<int>(1).then(
+      [](int) -> int { KFC_THROW_FATAL(Exception::Kind::Logic, "failed"); });
+  bool called = false;
+  p = p.then([&](int x) {
+    called = true;
+    return x;
+  });
+  EXPECT_THROW(p.wait(scope), Exception);
+  EXPECT_FALSE(called);
+}
+
+TEST_F(AsyncTest, ReadyThenReturnsPromise) {
+  SETUP_TEST_EVENT_LOOP;
+  Promise<int> p =
+      Promise<int>(20).then([](int x) { return evaluateLater([x] { return x + 22; }); });
+  EXPECT_EQ(p.wait(scope), 42);
+}
+
+TEST_F(AsyncTest, ReadyLargeValue) {
+  SETUP_TEST_EVENT_LOOP;
+  // Too large to be held inline, it goes through a node instead.
+  Promise<std::string> p(std::string(100, 'x'));
+  EXPECT_EQ(p.then([](std::string &&s) { return s.size(); }).wait(scope), 100);
+}
+
+TEST_F(AsyncTest, ReadyForkAndJoin) {
+  SETUP_TEST_EVENT_LOOP;
+  ForkedPromise<int> forked = Promise<int>(21).fork();
+  std::vector<Promise<int>> promises;
+  promises.push_back(forked.addBranch());
+  promises.push_back(forked.addBranch());
+  promises.push_back(Promise<int>(0));
+  const std::vector<int> values = joinPromises(std::move(promises)).wait(scope);
+  EXPECT_EQ(values, std::vector<int>({21, 21, 0}));
+}
+
 TEST_F(AsyncTest, InThreadExecuteAsync) {
   SETUP_TEST_EVENT_LOOP;
   Ref<Executor> executor = getCurrentThreadExecutor();
@@ -144,7 +234,7 @@ TEST_F(AsyncTest, CrossThreadExecuteAsync) {
   });
 
   auto guard = executor.lock();
-  cv.wait(guard);
+  while (guard->isNone()) cv.wait(guard);
   Promise<void> p = guard->unwrap()->executeAsync([&] { resolver->resolve(42); });
   p.wait(scope);
 }
@@ -165,7 +255,7 @@ TEST_F(AsyncTest, CrossThreadExecuteAsyncException) {
   });
 
   auto guard = executor.lock();
-  cv.wait(guard);
+  while (guard->isNone()) cv.wait(guard);
   Promise<void> p = guard->unwrap()->executeAsync(
       [&] { resolver->resolve(KFC_EXCEPTION(KFC::Exception::Kind::Logic)); });
   p.wait(scope);
@@ -187,7 +277,7 @@ TEST_F(AsyncTest, CrossThreadExecuteSync) {
   });
 
   auto guard = executor.lock();
-  cv.wait(guard);
+  while (guard->isNone()) cv.wait(guard);
   const int n = guard->unwrap()->executeSync([&] {
     resolver->resolve(114514);
     return 42;
@@ -195,4 +285,595 @@ TEST_F(AsyncTest, CrossThreadExecuteSync) {
   EXPECT_EQ(n, 42);
 }
 
+TEST_F(AsyncTest, CrossThreadExecuteLoopDestroyed) {
+  SETUP_TEST_EVENT_LOOP;
+  Condvar cv;
+  Mutex<int> stage(0);
+  const auto waitStage = [&](const int n) {
+    auto guard = stage.lock();
+    while (*guard < n) cv.wait(guard);
+  };
+  const auto setStage = [&](const int n) {
+    *stage.lock() = n;
+    cv.notifyAll();
+  };
+  Option<Ref<Executor>> executor;
+  const auto detached = std::make_shared<int>(0);
+  std::vector<Promise<int>> promises;
+  {
+    // Released once the target's loop is gone, joined after the target's thread.
+    Option<OwnThread> sync;
+    Thread t([&] {
+      EventLoop targetLoop;
+      WaitScope targetScope(targetLoop);
+      executor = targetLoop.getExecutor();
+      setStage(1);
+      // Take the first events without firing them, the others are left in the executor's queue.
+      waitStage(2);
+      targetLoop.poll();
+      setStage(3);
+      waitStage(4);
+    });
+    waitStage(1);
+    Executor &target = *executor.unwrap();
+    sync = Thread::spawn([&] { EXPECT_THROW(target.executeSync([] {}), Exception); });
+    for (const int next : {2, 4}) {
+      target.executeDetached([detached] {});
+      promises.push_back(target.executeAsync([] { return 42; }));
+      KFC_SLEEP_US(10 * 1000);
+      setStage(next);
+      if (next == 2) waitStage(3);
+    }
+  }
+
+  for (Promise<int> &p : promises) EXPECT_THROW(p.wait(scope), Exception);
+  EXPECT_EQ(detached.use_count(), 1);
+  // The executor outlives its loop, and refuses events from now on.
+  Ref<Executor> target = executor.unwrap();
+  EXPECT_THROW(target->executeAsync([] {}), Exception);
+  EXPECT_THROW(target->executeSync([] {}), Exception);
+  EXPECT_THROW(target->executeDetached([] {}), Exception);
+}
+
+TEST_F(AsyncTest, CrossThreadExecuteLoopDestroyedWhileWaiting) {
+  SETUP_TEST_EVENT_LOOP;
+  Condvar cv;
+  Mutex<Option<Ref<Executor>>> executor;
+  Own<_::PromiseResolver<void>> started; // Resolved by the function, in the target's thread.
+  Own<_::PromiseResolver<int>> pending;  // Of the promise returned by the function, never resolved.
+  Option<Promise<int>> promise;
+  {
+    Thread t([&] {
+      SETUP_TEST_EVENT_LOOP;
+      auto par = createPromiseAndResolver<void>();
+      started = std::move(par.resolver);
+      *executor.lock() = getCurrentThreadExecutor();
+      cv.notifyOne();
+      // The loop is destroyed while the event waits for the promise returned by the function.
+      par.promise.wait(scope);
+      started = nullptr;
+    });
+    auto guard = executor.lock();
+    while (guard->isNone()) cv.wait(guard);
+    promise = guard->unwrap()->executeAsync([&] {
+      auto par = createPromiseAndResolver<int>();
+      pending = std::move(par.resolver);
+      started->resolve();
+      return std::move(par.promise);
+    });
+  }
+  EXPECT_THROW(promise.unwrap().wait(scope), Exception);
+  // The promise went down with the loop.
+  EXPECT_FALSE(pending->isWaiting());
+}
+
+TEST_F(AsyncTest, JoinPromises) {
+  SETUP_TEST_EVENT_LOOP;
+  std::vector<Promise<int>> promises;
+  promises.push_back(evaluateLater([] { return 1; }));
+  promises.push_back(evaluateLater([] { return 2; }).then([](const int x) { return x * 10; }));
+  promises.push_back(evaluateLater([] { return 3; }));
+  EXPECT_EQ(joinPromises(std::move(promises)).wait(scope), (std::vector<int>{1, 20, 3}));
+  EXPECT_TRUE(joinPromises(std::vector<Promise<int>>()).wait(scope).empty());
+}
+
+TEST_F(AsyncTest, JoinPromisesVoid) {
+  SETUP_TEST_EVENT_LOOP;
+  int count = 0;
+  std::vector<Promise<void>> promises;
+  for (int i = 0; i < 3; i++) promises.push_back(evaluateLater([&] { count++; }));
+  joinPromises(std::move(promises)).wait(scope);
+  EXPECT_EQ(count, 3);
+}
+
+TEST_F(AsyncTest, JoinPromisesFailsFast) {
+  SETUP_TEST_EVENT_LOOP;
+  auto par = createPromiseAndResolver<int>();
+  std::vector<Promise<int>> promises;
+  promises.push_back(std::move(par.promise));
+  promises.push_back(evaluateLater([]() -> int { throw std::runtime_error("test"); }));
+  Promise<std::vector<int>> joined = joinPromises(std::move(promises));
+  EXPECT_THROW(joined.wait(scope), Exception);
+  // The pending promise has been dropped along with its branch.
+  EXPECT_FALSE(par.resolver->isWaiting());
+}
+
+TEST_F(AsyncTest, RacePromises) {
+  SETUP_TEST_EVENT_LOOP;
+  auto slow = createPromiseAndResolver<int>();
+  std::vector<Promise<int>> promises;
+  promises.push_back(std::move(slow.promise));
+  promises.push_back(evaluateLater([] { return 42; }));
+  EXPECT_EQ(racePromises(std::move(promises)).wait(scope), 42);
+  EXPECT_FALSE(slow.resolver->isWaiting());
+}
+
+TEST_F(AsyncTest, SettlePromises) {
+  SETUP_TEST_EVENT_LOOP;
+  std::vector<Promise<int>> promises;
+  promises.push_back(evaluateLater([] { return 1; }));
+  promises.push_back(evaluateLater([]() -> int { throw std::runtime_error("test"); }));
+  auto results = settlePromises(std::move(promises)).wait(scope);
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].unwrap(), 1);
+  EXPECT_TRUE(results[1].isErr());
+}
+
+TEST_F(AsyncTest, Fork) {
+  SETUP_TEST_EVENT_LOOP;
+  int runs = 0;
+  ForkedPromise<int> forked = evaluateLater([&] {
+                                runs++;
+                                return 42;
+                              }).fork();
+  Promise<int> b1 = forked.addBranch();
+  Promise<int> b2 = forked.addBranch().then([](const int x) { return x + 1; });
+  EXPECT_EQ(b1.wait(scope), 42);
+  EXPECT_EQ(b2.wait(scope), 43);
+  // A branch added after the result is ready gets it too.
+  EXPECT_EQ(forked.addBranch().wait(scope), 42);
+  EXPECT_EQ(runs, 1);
+}
+
+TEST_F(AsyncTest, ForkException) {
+  SETUP_TEST_EVENT_LOOP;
+  ForkedPromise<void> forked =
+      evaluateLater([] { throw std::runtime_error("test"); }).fork();
+  Promise<void> b1 = forked.addBranch();
+  Promise<void> b2 = forked.addBranch();
+  EXPECT_THROW(b1.wait(scope), Exception);
+  EXPECT_THROW(b2.wait(scope), Exception);
+}
+
+TEST_F(AsyncTest, ForkDropBranch) {
+  SETUP_TEST_EVENT_LOOP;
+  auto par = createPromiseAndResolver<int>();
+  ForkedPromise<int> forked = par.promise.fork();
+  { Promise<int> dropped = forked.addBranch(); }
+  Promise<int> branch = forked.addBranch();
+  par.resolver->resolve(42);
+  EXPECT_EQ(branch.wait(scope), 42);
+}
+
+TEST_F(AsyncTest, CancelerCancelsChain) {
+  SETUP_TEST_EVENT_LOOP;
+  Canceler canceler;
+  auto par = createPromiseAndResolver<int>();
+  bool called = false;
+  Promise<int> p = canceler.wrap(par.promise.then([&](const int x) {
+    called = true;
+    return x;
+  }));
+  canceler.cancel("shutting down");
+  EXPECT_TRUE(canceler.isEmpty());
+  // The chain is dropped right away, not along with `p`.
+  EXPECT_FALSE(par.resolver->isWaiting());
+  try {
+    p.wait(scope);
+    FAIL() << "expected a Canceled exception";
+  } catch (const Exception &e) {
+    EXPECT_EQ(e.getKind(), Exception::Kind::Canceled);
+    EXPECT_EQ(e.getMessage(), "shutting down");
+  }
+  EXPECT_FALSE(called);
+}
+
+TEST_F(AsyncTest, CancelerKeepsSettledResult) {
+  SETUP_TEST_EVENT_LOOP;
+  Canceler canceler;
+  auto par = createPromiseAndResolver<int>();
+  Promise<int> p = canceler.wrap(std::move(par.promise));
+  par.resolver->resolve(42);
+  evaluateLater([] {}).wait(scope);
+  EXPECT_TRUE(canceler.isEmpty());
+  canceler.cancel("too late");
+  EXPECT_EQ(p.wait(scope), 42);
+}
+
+TEST_F(AsyncTest, CancelerRemovesTimer) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time::now());
+  Canceler canceler;
+  Promise<void> p = canceler.wrap(timer.afterDelay(1_s));
+  EXPECT_TRUE(timer.nextEvent().isSome());
+  canceler.cancel("stop");
+  EXPECT_TRUE(timer.nextEvent().isNone());
+  EXPECT_THROW(p.wait(scope), Exception);
+}
+
+TEST_F(AsyncTest, InThreadExecuteAsyncDropped) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Executor> executor = getCurrentThreadExecutor();
+  bool called = false;
+  { Promise<void> dropped = executor->executeAsync([&] { called = true; }); }
+  executor->executeAsync([] {}).wait(scope);
+  executor->executeAsync([] {}).wait(scope);
+  EXPECT_FALSE(called);
+}
+
+TEST_F(AsyncTest, CrossThreadExecuteAsyncCanceled) {
+  SETUP_TEST_EVENT_LOOP;
+  // Set in the target thread when the promise returned by the function is dropped.
+  struct Guard {
+    Mutex<bool> &dropped;
+    Condvar &cv;
+    ~Guard() {
+      *dropped.lock() = true;
+      cv.notifyOne();
+    }
+  };
+  Condvar cv;
+  Mutex<Option<Ref<Executor>>> executor;
+  Mutex<bool> started(false), dropped(false);
+  Own<_::PromiseResolver<void>> stop, never;
+
+  Thread t([&] {
+    SETUP_TEST_EVENT_LOOP;
+    auto par = createPromiseAndResolver<void>();
+    stop = std::move(par.resolver);
+    *executor.lock() = getCurrentThreadExecutor();
+    cv.notifyOne();
+    par.promise.wait(scope);
+  });
+
+  Ref<Executor> target = [&] {
+    auto guard = executor.lock();
+    while (guard->isNone()) cv.wait(guard);
+    return guard->unwrap();
+  }();
+  Canceler canceler;
+  Promise<void> p = canceler.wrap(target->executeAsync([&] {
+    auto par = createPromiseAndResolver<void>();
+    never = std::move(par.resolver);
+    *started.lock() = true;
+    cv.notifyOne();
+    return par.promise.then([g = std::make_shared<Guard>(Guard{dropped, cv})] {});
+  }));
+  {
+    auto guard = started.lock();
+    while (!*guard) cv.wait(guard);
+  }
+  canceler.cancel("no longer needed");
+  {
+    auto guard = dropped.lock();
+    while (!*guard) cv.wait(guard);
+  }
+  EXPECT_THROW(p.wait(scope), Exception);
+  target->executeAsync([&] { stop->resolve(); }).wait(scope);
+}
+
+TEST_F(AsyncTest, Fiber) {
+  SETUP_TEST_EVENT_LOOP;
+  FiberPool pool;
+  auto par = createPromiseAndResolver<int>();
+  Promise<int> fiber = pool.startFiber([&](WaitScope &fiberScope) {
+    return par.promise.wait(fiberScope) + evaluateLater([] { return 1; }).wait(fiberScope);
+  });
+  evaluateLater([&] { par.resolver->resolve(41); }).wait(scope);
+  EXPECT_EQ(fiber.wait(scope), 42);
+}
+
+TEST_F(AsyncTest, FiberException) {
+  SETUP_TEST_EVENT_LOOP;
+  FiberPool pool;
+  Promise<void> fiber = pool.startFiber([](WaitScope &fiberScope) {
+    yield().wait(fiberScope);
+    KFC_THROW_FATAL(Exception::Kind::Logic, "failed in a fiber");
+  });
+  EXPECT_THROW(fiber.wait(scope), Exception);
+}
+
+TEST_F(AsyncTest, FiberReusesStack) {
+  SETUP_TEST_EVENT_LOOP;
+  FiberPool pool;
+  pool.startFiber([](WaitScope &fiberScope) { yield().wait(fiberScope); }).wait(scope);
+  EXPECT_EQ(pool.getFreelistSize(), 1);
+  Promise<void> fiber = pool.startFiber([](WaitScope &fiberScope) { yield().wait(fiberScope); });
+  EXPECT_EQ(pool.getFreelistSize(), 0);
+  fiber.wait(scope);
+  EXPECT_EQ(pool.getFreelistSize(), 1);
+}
+
+TEST_F(AsyncTest, FiberCancel) {
+  SETUP_TEST_EVENT_LOOP;
+  struct Guard {
+    bool &destroyed;
+    ~Guard() { destroyed = true; }
+  };
+  FiberPool pool;
+  auto par = createPromiseAndResolver<void>();
+  bool started = false, destroyed = false;
+  {
+    Promise<void> fiber = pool.startFiber([&](WaitScope &fiberScope) {
+      Guard guard{destroyed};
+      started = true;
+      par.promise.wait(fiberScope);
+    });
+    yield().wait(scope);
+    EXPECT_TRUE(started);
+  }
+  // Dropping the promise unwound the fiber's stack.
+  EXPECT_TRUE(destroyed);
+  EXPECT_FALSE(par.resolver->isWaiting());
+  EXPECT_EQ(pool.getFreelistSize(), 1);
+}
+
+TEST_F(AsyncTest, RunEventCallbacksOnStackPool) {
+  SETUP_TEST_EVENT_LOOP;
+  FiberPool pool;
+  scope.runEventCallbacksOnStackPool(pool);
+  EXPECT_EQ(evaluateLater([] { return 42; }).wait(scope), 42);
+  EXPECT_THROW(evaluateLater([] { KFC_THROW_FATAL(Exception::Kind::Logic, "failed"); }).wait(scope),
+               Exception);
+  scope.runEventCallbacksOnStackPool(None);
+  EXPECT_EQ(pool.getFreelistSize(), 1);
+}
+
+TEST_F(AsyncTest, Instrumentation) {
+  SETUP_TEST_EVENT_LOOP;
+  EventLoopInstrumentation instrumentation;
+  loop.setInstrumentation(instrumentation);
+  EXPECT_EQ(evaluateLater([] { return evaluateLater([] { return 42; }); }).wait(scope), 42);
+  const EventLoopStats &stats = instrumentation.getStats();
+  EXPECT_GT(stats.eventsFired, 0);
+  EXPECT_EQ(stats.depthFirstArms + stats.breadthFirstArms + stats.lastArms, stats.eventsFired);
+  EXPECT_EQ(stats.queueDepth, 0);
+  EXPECT_GE(stats.maxQueueDepth, 1);
+  uint64_t histogramTotal = 0;
+  for (const uint64_t n : stats.fireHistogram) histogramTotal += n;
+  EXPECT_EQ(histogramTotal, stats.eventsFired);
+  loop.setInstrumentation(None);
+}
+
+TEST_F(AsyncTest, InstrumentationSlowEvent) {
+  SETUP_TEST_EVENT_LOOP;
+  EventLoopInstrumentation instrumentation;
+  std::vector<SlowEvent> slowEvents;
+  instrumentation.onSlowEvent(
+      5_ms, [&](const SlowEvent &e) { slowEvents.push_back(e); }, true);
+  loop.setInstrumentation(instrumentation);
+  // The continuation runs when the chain reads it, in the `fire` of the ChainPromiseNode.
+  evaluateLater([] {
+    KFC_SLEEP_US(10 * 1000);
+    return yield();
+  }).wait(scope);
+  loop.setInstrumentation(None);
+  ASSERT_EQ(slowEvents.size(), 1);
+  EXPECT_NE(slowEvents[0].type.find("ChainPromiseNode"), String::npos);
+  EXPECT_GE(slowEvents[0].duration, 10_ms);
+  EXPECT_FALSE(slowEvents[0].creationSite.empty());
+}
+
+TEST_F(AsyncTest, TurnBudgetEvents) {
+  SETUP_TEST_EVENT_LOOP;
+  EventLoopInstrumentation instrumentation;
+  loop.setInstrumentation(instrumentation);
+  loop.setTurnBudget(10);
+  std::vector<Promise<int>> promises;
+  for (int i = 0; i < 100; i++) promises.push_back(evaluateLater([i] { return i; }));
+  EXPECT_EQ(joinPromises(std::move(promises)).wait(scope).size(), 100);
+  EXPECT_GE(instrumentation.getStats().budgetPolls, 9);
+  loop.setInstrumentation(None);
+}
+
+// A chain of `n` events that take 2ms each.
+static Promise<void> sleepChain(const int n) {
+  if (n == 0) return yield();
+  return evaluateLater([n] {
+    KFC_SLEEP_US(2 * 1000);
+    return sleepChain(n - 1);
+  });
+}
+
+TEST_F(AsyncTest, TurnBudgetTime) {
+  SETUP_TEST_EVENT_LOOP;
+  EventLoopInstrumentation instrumentation;
+  loop.setInstrumentation(instrumentation);
+  loop.setTurnBudget(0, 1_ms);
+  sleepChain(10).wait(scope);
+  EXPECT_GE(instrumentation.getStats().budgetPolls, 3);
+  loop.setInstrumentation(None);
+}
+
+TEST_F(AsyncTest, Priority) {
+  SETUP_TEST_EVENT_LOOP;
+  std::vector<int> order;
+  std::vector<Promise<void>> promises;
+  // Queued in the reverse order of their priorities.
+  promises.push_back(evaluateLater([&] { order.push_back(2); }).withPriority(EventPriority::Low));
+  promises.push_back(evaluateLater([&] { order.push_back(1); }));
+  promises.push_back(evaluateLater([&] { order.push_back(0); }).withPriority(EventPriority::High));
+  joinPromises(std::move(promises)).wait(scope);
+  EXPECT_EQ(order, std::vector<int>({0, 1, 2}));
+}
+
+TEST_F(AsyncTest, PriorityException) {
+  SETUP_TEST_EVENT_LOOP;
+  Promise<int> p = evaluateLater([]() -> int {
+                     KFC_THROW_FATAL(Exception::Kind::Logic, "failed");
+                   }).withPriority(EventPriority::Low);
+  EXPECT_THROW(p.wait(scope), Exception);
+}
+
+// An EventPort without in-thread events that counts how many times it has been woken.
+class CountingEventPort final : public EventPort {
+public:
+  explicit CountingEventPort() : m_state(State{false, 0}) {}
+  bool poll() override {
+    auto guard = m_state.lock();
+    while (!guard->woken) m_condvar.wait(guard);
+    guard->woken = false;
+    return true;
+  }
+  bool tryPoll() override { return KFC_EXCHANGE(m_state.lock()->woken, false); }
+  void wake() const override {
+    auto guard = m_state.lock();
+    guard->woken = true;
+    guard->wakes++;
+    m_condvar.notifyOne();
+  }
+  int wakes() const { return m_state.lock()->wakes; }
+
+private:
+  struct State {
+    bool woken;
+    int wakes;
+  };
+  mutable Mutex<State> m_state;
+  mutable Condvar m_condvar;
+};
+
+TEST_F(AsyncTest, CrossThreadExecuteAsyncCoalescesWakes) {
+  constexpr int kEvents = 100;
+  CountingEventPort port;
+  EventLoop loop(port);
+  WaitScope scope(loop);
+  Ref<Executor> executor = getCurrentThreadExecutor();
+  auto par = createPromiseAndResolver<void>();
+  int count = 0;
+  WaitGroup sent(1);
+
+  Thread t([&] {
+    SETUP_TEST_EVENT_LOOP;
+    std::vector<Promise<void>> promises;
+    for (int i = 0; i < kEvents; i++) {
+      promises.push_back(executor->executeAsync([&] {
+        if (++count == kEvents) par.resolver->resolve();
+      }));
+    }
+    sent.done();
+    for (auto &p : promises) p.wait(scope);
+  });
+
+  // Let the events pile up before the loop gets to drain them.
+  sent.wait();
+  par.promise.wait(scope);
+  EXPECT_EQ(count, kEvents);
+  EXPECT_EQ(port.wakes(), 1);
+}
+
+TEST_F(AsyncTest, CrossThreadExecuteBatch) {
+  constexpr int kEvents = 100;
+  CountingEventPort port;
+  EventLoop loop(port);
+  WaitScope scope(loop);
+  Ref<Executor> executor = getCurrentThreadExecutor();
+  auto par = createPromiseAndResolver<void>();
+  int count = 0;
+  WaitGroup sent(1);
+
+  Thread t([&] {
+    SETUP_TEST_EVENT_LOOP;
+    std::vector<std::function<int()>> funcs;
+    for (int i = 0; i < kEvents; i++) {
+      funcs.emplace_back([&, i] {
+        if (++count == kEvents) par.resolver->resolve();
+        return i;
+      });
+    }
+    Promise<std::vector<int>> results = executor->executeBatch(std::move(funcs));
+    sent.done();
+    const std::vector<int> values = results.wait(scope);
+    ASSERT_EQ(values.size(), kEvents);
+    for (int i = 0; i < kEvents; i++) EXPECT_EQ(values[i], i);
+  });
+
+  sent.wait();
+  par.promise.wait(scope);
+  EXPECT_EQ(port.wakes(), 1);
+}
+
+TEST_F(AsyncTest, ExecuteBatchVoid) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Executor> executor = getCurrentThreadExecutor();
+  int count = 0;
+  std::vector<std::function<void()>> funcs(3, [&] { ++count; });
+  executor->executeBatch(std::move(funcs)).wait(scope);
+  EXPECT_EQ(count, 3);
+  executor->executeBatch(std::vector<std::function<void()>>()).wait(scope);
+}
+
+#if KFC_HAS_COROUTINE
+TEST_F(AsyncTest, Coroutine) {
+  SETUP_TEST_EVENT_LOOP;
+  auto coroutine = []() -> Promise<int> {
+    Promise<int> p1 = evaluateLater([] { return 42; });
+    Promise<int> p2 = evaluateLater([] { return 24; });
+    const int x = co_await p1;
+    const int y = co_await p2;
+    co_return x + y;
+  };
+  EXPECT_EQ(coroutine().wait(scope), 66);
+}
+
+TEST_F(AsyncTest, CoroutineVoid) {
+  SETUP_TEST_EVENT_LOOP;
+  int value = 0;
+  auto coroutine = [&]() -> Promise<void> {
+    Promise<int> p = evaluateLater([] { return 42; });
+    value = co_await p;
+  };
+  coroutine().wait(scope);
+  EXPECT_EQ(value, 42);
+}
+
+TEST_F(AsyncTest, CoroutineAwaitsCoroutine) {
+  SETUP_TEST_EVENT_LOOP;
+  auto inner = [](const int x) -> Promise<int> {
+    co_await yield();
+    co_return x;
+  };
+  auto outer = [&]() -> Promise<int> { co_return co_await inner(1) + co_await inner(2); };
+  EXPECT_EQ(outer().wait(scope), 3);
+}
+
+TEST_F(AsyncTest, CoroutineException) {
+  SETUP_TEST_EVENT_LOOP;
+  auto coroutine = []() -> Promise<int> {
+    Promise<void> p = evaluateLater([] { throw std::runtime_error("test"); });
+    co_await p;
+    co_return 42;
+  };
+  EXPECT_THROW(coroutine().wait(scope), Exception);
+}
+
+TEST_F(AsyncTest, CoroutineCancel) {
+  SETUP_TEST_EVENT_LOOP;
+  auto par = createPromiseAndResolver<int>();
+  bool resumed = false;
+  auto coroutine = [&]() -> Promise<void> {
+    co_await par.promise;
+    resumed = true;
+  };
+  {
+    Promise<void> p = coroutine();
+    yield().wait(scope);
+  }
+  // The coroutine was destroyed while suspended, resolving what it awaited resumes nothing.
+  par.resolver->resolve(42);
+  yield().wait(scope);
+  EXPECT_FALSE(resumed);
+}
+#endif
+
 KFC_NAMESPACE_END
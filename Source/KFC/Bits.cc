@@ -27,4 +27,44 @@ int countTrailingZeros(unsigned int x) {
 #endif
 }
 
+int countTrailingZeros64(uint64_t x) {
+  if (x == 0) {
+    return 64;
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_ctzll(x);
+#elif defined(_MSC_VER)
+  DWORD n;
+  return _BitScanForward64(&n, x) ? n : 64;
+#else
+  int n = 0;
+  while ((x & 1) == 0) {
+    n++;
+    x >>= 1;
+  }
+  return n;
+#endif
+}
+
+int countLeadingZeros64(uint64_t x) {
+  if (x == 0) {
+    return 64;
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_clzll(x);
+#elif defined(_MSC_VER)
+  DWORD n;
+  return _BitScanReverse64(&n, x) ? 63 - n : 64;
+#else
+  int n = 0;
+  while ((x & (1ULL << 63)) == 0) {
+    n++;
+    x <<= 1;
+  }
+  return n;
+#endif
+}
+
 KFC_NAMESPACE_END
\ No newline at end of file
@@ -24,5 +24,15 @@ inline uint64_t swap(const uint64_t x) {
 //   CountTrailingZeros(0b00010000) // 4
 //
 int countTrailingZeros(unsigned int x);
+// Same as above on 64 bits, 64 for 0.
+int countTrailingZeros64(uint64_t x);
+// Returns the number of zeros above the most significant bit of x, 64 for 0.
+//
+// Example:
+//
+//   countLeadingZeros64(1)                     // 63
+//   countLeadingZeros64(0x8000000000000000ULL) // 0
+//
+int countLeadingZeros64(uint64_t x);
 
 KFC_NAMESPACE_END
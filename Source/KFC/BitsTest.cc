@@ -13,4 +13,19 @@ TEST(BitsTest, countTrailingZeros) {
   EXPECT_EQ(countTrailingZeros(UINT32_MAX), 0);
 }
 
+TEST(BitsTest, countTrailingZeros64) {
+  EXPECT_EQ(countTrailingZeros64(0), 64);
+  EXPECT_EQ(countTrailingZeros64(1), 0);
+  EXPECT_EQ(countTrailingZeros64(4), 2);
+  EXPECT_EQ(countTrailingZeros64(1ULL << 40), 40);
+  EXPECT_EQ(countTrailingZeros64(UINT64_MAX), 0);
+}
+
+TEST(BitsTest, countLeadingZeros64) {
+  EXPECT_EQ(countLeadingZeros64(0), 64);
+  EXPECT_EQ(countLeadingZeros64(1), 63);
+  EXPECT_EQ(countLeadingZeros64(1ULL << 40), 23);
+  EXPECT_EQ(countLeadingZeros64(UINT64_MAX), 0);
+}
+
 KFC_NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/List.h"
+#include "KFC/Preclude.h"
+#include "KFC/Ref.h"
+#include "KFC/RefCounted.h"
+
+#include <deque>
+
+KFC_NAMESPACE_BEG
+
+// An unbounded queue of values with many senders and a single receiver, the EventLoop the channel
+// was created in. Values can be sent from any thread: sends from other threads are handed to the
+// receiving loop through its Executor, so neither side ever blocks, and the sending thread doesn't
+// need an EventLoop. Values sent by one thread are received in the order they were sent.
+//
+// The receiving thread should hold its reference until the senders are done, so that the channel
+// is destroyed in the receiving EventLoop.
+template <class T> class Channel final : public AtomicRefCounted<Channel<T>> {
+public:
+  // Create a channel received by the EventLoop of the current thread.
+  static Ref<Channel> create() { return adoptRef(*new Channel(getCurrentThreadExecutor())); }
+
+  // Send a value. Sending to a closed channel throws in the receiving thread; from other threads
+  // the value is dropped, since the channel may be closed by the time it arrives.
+  void send(T value) {
+    if (m_executor->belongsToCurrentThread()) {
+      KFC_CHECK(!m_closed, "Send to a closed channel");
+      push(std::move(value));
+      return;
+    }
+    m_executor->executeDetached(
+        [self = Ref<Channel>(*this), value = std::move(value)]() mutable {
+          if (!self->m_closed) self->push(std::move(value));
+        });
+  }
+
+  // Close the channel. Values sent before still get received, after which receives fail with a
+  // `Canceled` exception. Can be called from any thread.
+  void close() {
+    if (m_executor->belongsToCurrentThread()) {
+      closeNow();
+      return;
+    }
+    m_executor->executeDetached([self = Ref<Channel>(*this)]() mutable { self->closeNow(); });
+  }
+
+  // Receive the next value. Receives are served in the order they were made. Only the receiving
+  // thread may receive.
+  Promise<T> receive() {
+    checkReceiver();
+    if (!m_values.empty()) return Promise<T>(pop());
+    if (m_closed) return Promise<T>(_::PromiseResult<T>(closedException()));
+    return _::createAdaptedPromise<T, Receiver>(*this);
+  }
+
+  // Receive a value if one is ready, without waiting.
+  Option<T> tryReceive() {
+    checkReceiver();
+    if (m_values.empty()) return None;
+    return pop();
+  }
+
+  // The number of values waiting to be received, not counting those on their way from other
+  // threads.
+  KFC_NODISCARD size_t size() const { return m_values.size(); }
+  KFC_NODISCARD bool isClosed() const { return m_closed; }
+
+private:
+  explicit Channel(Ref<Executor> executor) : m_executor(std::move(executor)), m_closed(false) {}
+
+  class Receiver final {
+  public:
+    explicit Receiver(_::PromiseResolver<T> &resolver, Channel &channel)
+        : m_resolver(resolver), m_channel(channel) {
+      m_channel->m_receivers.add(*this);
+    }
+    ~Receiver() noexcept(false) {
+      if (m_link.isLinked()) m_channel->m_receivers.remove(*this);
+    }
+    KFC_DISALLOW_COPY_AND_MOVE(Receiver)
+
+  private:
+    _::PromiseResolver<T> &m_resolver;
+    Ref<Channel> m_channel; // Keeps the channel alive while the receive is pending.
+    ListLink<Receiver> m_link;
+
+    friend Channel;
+  };
+
+  void checkReceiver() const {
+    KFC_CHECK(m_executor.get().belongsToCurrentThread(),
+              "Receive from a channel in another thread");
+  }
+
+  void push(T &&value) {
+    if (m_receivers.empty()) {
+      m_values.push_back(std::move(value));
+      return;
+    }
+    Receiver &receiver = m_receivers.front();
+    m_receivers.remove(receiver);
+    receiver.m_resolver.resolve(std::move(value));
+  }
+
+  T pop() {
+    T value = std::move(m_values.front());
+    m_values.pop_front();
+    return value;
+  }
+
+  void closeNow() {
+    m_closed = true;
+    // Values are only buffered while nobody is waiting, so the waiting receivers get nothing more.
+    while (!m_receivers.empty()) {
+      Receiver &receiver = m_receivers.front();
+      m_receivers.remove(receiver);
+      receiver.m_resolver.resolve(closedException());
+    }
+  }
+
+  static Exception closedException() {
+    return KFC_EXCEPTION(Exception::Kind::Canceled, "Channel was closed");
+  }
+
+  Ref<Executor> m_executor; // The executor of the receiving EventLoop.
+  std::deque<T> m_values;
+  List<Receiver, &Receiver::m_link> m_receivers;
+  bool m_closed;
+
+  friend Receiver;
+};
+
+KFC_NAMESPACE_END
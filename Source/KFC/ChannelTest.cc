@@ -0,0 +1,90 @@
+#include "KFC/Channel.h"
+#include "KFC/Testing.h"
+#include "KFC/Thread.h"
+
+KFC_NAMESPACE_BEG
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  EventLoop loop;                                                                                  \
+  WaitScope scope(loop)
+
+TEST(ChannelTest, SendReceive) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<int>> channel = Channel<int>::create();
+  channel->send(1);
+  channel->send(2);
+  EXPECT_EQ(channel->size(), 2);
+  EXPECT_EQ(channel->receive().wait(scope), 1);
+  EXPECT_EQ(channel->tryReceive().unwrap(), 2);
+  EXPECT_TRUE(channel->tryReceive().isNone());
+}
+
+TEST(ChannelTest, ReceiveBeforeSend) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<int>> channel = Channel<int>::create();
+  Promise<int> p1 = channel->receive();
+  Promise<int> p2 = channel->receive();
+  channel->send(1);
+  channel->send(2);
+  EXPECT_EQ(p2.wait(scope), 2);
+  EXPECT_EQ(p1.wait(scope), 1);
+}
+
+TEST(ChannelTest, DroppedReceive) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<int>> channel = Channel<int>::create();
+  KFC_DISCARD(channel->receive());
+  channel->send(1);
+  EXPECT_EQ(channel->receive().wait(scope), 1);
+}
+
+TEST(ChannelTest, Close) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<int>> channel = Channel<int>::create();
+  Promise<int> pending = channel->receive();
+  channel->close();
+  EXPECT_THROW(pending.wait(scope), Exception);
+
+  Ref<Channel<int>> drained = Channel<int>::create();
+  drained->send(1);
+  drained->close();
+  EXPECT_EQ(drained->receive().wait(scope), 1);
+  EXPECT_THROW(drained->receive().wait(scope), Exception);
+  EXPECT_THROW(drained->send(2), Exception);
+}
+
+TEST(ChannelTest, CrossThread) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<std::string>> channel = Channel<std::string>::create();
+  constexpr int kThreads = 4;
+  constexpr int kValues = 1000;
+  std::vector<OwnThread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    // The senders have no EventLoop.
+    threads.push_back(Thread::spawn([&, t] {
+      for (int i = 0; i < kValues; ++i) channel->send(std::to_string(t * kValues + i));
+    }));
+  }
+  std::vector<int> last(kThreads, -1);
+  for (int n = 0; n < kThreads * kValues; ++n) {
+    const int value = std::stoi(channel->receive().wait(scope));
+    // Values from one thread arrive in order.
+    EXPECT_GT(value % kValues, last[value / kValues]);
+    last[value / kValues] = value % kValues;
+  }
+  threads.clear();
+  EXPECT_EQ(channel->size(), 0);
+}
+
+TEST(ChannelTest, CrossThreadClose) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Channel<int>> channel = Channel<int>::create();
+  Thread t([&] {
+    channel->send(1);
+    channel->close();
+  });
+  EXPECT_EQ(channel->receive().wait(scope), 1);
+  EXPECT_THROW(channel->receive().wait(scope), Exception);
+}
+
+KFC_NAMESPACE_END
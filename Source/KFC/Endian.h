@@ -2,6 +2,10 @@
 
 #include "KFC/Bits.h"
 
+#if __cplusplus >= 202002L
+#include <bit>
+#endif
+
 namespace KFC {
 #if __cplusplus >= 202002L
 #define KFC_BIG_ENDIAN (std::endian::native == std::endian::big)
@@ -12,6 +16,10 @@ namespace KFC {
 #endif
 
 constexpr bool IsBigEndian() {
-  return static_cast<uint32_t>(0x01020304) >> 24 == 1;
+#if defined(__BYTE_ORDER__)
+  return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+#else
+  return false;  // MSVC only targets little-endian machines.
+#endif
 }
 }  // namespace KFC
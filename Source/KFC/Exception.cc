@@ -15,6 +15,7 @@ static const char *exceptionKindNames[] = {
     [Exception::Kind::Timeout] = "TimeoutError",
     [Exception::Kind::Logic] = "LogicError",
     [Exception::Kind::Std] = "StdError",
+    [Exception::Kind::Canceled] = "CanceledError",
 };
 
 static KFC_THREAD_LOCAL Exception::Callback *threadLocalExceptionCallback = nullptr;
@@ -41,6 +42,7 @@ const char *Exception::what() const noexcept {
 }
 
 String Exception::getMessage() const { return m_message; }
+Exception::Kind Exception::getKind() const { return m_kind; }
 
 #ifdef _WIN32
 
@@ -48,6 +48,7 @@ public:
     Timeout,
     Logic,
     Std,
+    Canceled,
   };
 
   class Callback {
@@ -73,6 +74,9 @@ public:
   // The message will be "abc 123".
   KFC_NODISCARD String getMessage() const;
 
+  // Returns the kind the exception was constructed with.
+  KFC_NODISCARD Kind getKind() const;
+
 private:
   Kind m_kind;
   int m_line;
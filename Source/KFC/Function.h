@@ -1,5 +1,10 @@
 #pragma once
 
+#include "KFC/CopyMove.h"
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
 #include <utility>
 
 namespace KFC {
@@ -74,4 +79,95 @@ template <> struct FunctionCaller<Void> {
   }
 };
 
+template <class Signature> class Function;
+
+// A move-only callable, like std::function without the copy: it can hold lambdas that capture
+// move-only state, and callables of up to `kInlineSize` bytes that are nothrow movable are stored
+// inline, without allocation. Larger ones are boxed on the heap.
+template <class Out, class... In> class Function<Out(In...)> final {
+public:
+  static constexpr size_t kInlineSize = 6 * sizeof(void *);
+
+  Function() noexcept : m_ops(nullptr) {}
+  Function(std::nullptr_t) noexcept : m_ops(nullptr) {}
+  template <class Func, class = typename std::enable_if<
+                            !std::is_same<typename std::decay<Func>::type, Function>::value>::type>
+  Function(Func &&func) : m_ops(nullptr) {
+    using F = typename std::decay<Func>::type;
+    if constexpr (isInline<F>()) {
+      new (m_storage) F(std::forward<Func>(func));
+      m_ops = &Inline<F>::kOps;
+    } else {
+      new (m_storage) F *(new F(std::forward<Func>(func)));
+      m_ops = &Boxed<F>::kOps;
+    }
+  }
+  Function(Function &&other) noexcept : m_ops(other.m_ops) {
+    if (m_ops) m_ops->move(m_storage, other.m_storage);
+    other.m_ops = nullptr;
+  }
+  KFC_DISALLOW_COPY(Function)
+  ~Function() { reset(); }
+
+  Function &operator=(Function &&other) noexcept {
+    if (this != &other) {
+      reset();
+      m_ops = other.m_ops;
+      if (m_ops) m_ops->move(m_storage, other.m_storage);
+      other.m_ops = nullptr;
+    }
+    return *this;
+  }
+  Function &operator=(std::nullptr_t) noexcept {
+    reset();
+    return *this;
+  }
+
+  explicit operator bool() const { return m_ops != nullptr; }
+
+  Out operator()(In... in) const { return m_ops->invoke(m_storage, std::forward<In>(in)...); }
+
+private:
+  struct Ops {
+    Out (*invoke)(void *storage, In &&...in);
+    // Move the callable of `from` to `to`, leaving `from` destroyed.
+    void (*move)(void *to, void *from) noexcept;
+    void (*destroy)(void *storage) noexcept;
+  };
+
+  template <class F> static constexpr bool isInline() {
+    return sizeof(F) <= kInlineSize && alignof(F) <= alignof(std::max_align_t) &&
+           std::is_nothrow_move_constructible<F>::value;
+  }
+
+  template <class F> struct Inline {
+    static Out invoke(void *storage, In &&...in) {
+      return (*static_cast<F *>(storage))(std::forward<In>(in)...);
+    }
+    static void move(void *to, void *from) noexcept {
+      new (to) F(std::move(*static_cast<F *>(from)));
+      static_cast<F *>(from)->~F();
+    }
+    static void destroy(void *storage) noexcept { static_cast<F *>(storage)->~F(); }
+    static constexpr Ops kOps = {&invoke, &move, &destroy};
+  };
+
+  template <class F> struct Boxed {
+    static Out invoke(void *storage, In &&...in) {
+      return (**static_cast<F **>(storage))(std::forward<In>(in)...);
+    }
+    static void move(void *to, void *from) noexcept { new (to) F *(*static_cast<F **>(from)); }
+    static void destroy(void *storage) noexcept { delete *static_cast<F **>(storage); }
+    static constexpr Ops kOps = {&invoke, &move, &destroy};
+  };
+
+  void reset() noexcept {
+    if (m_ops) m_ops->destroy(m_storage);
+    m_ops = nullptr;
+  }
+
+  alignas(std::max_align_t) mutable unsigned char m_storage[kInlineSize];
+  const Ops *m_ops;
+};
+
 } // namespace KFC
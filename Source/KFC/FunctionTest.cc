@@ -0,0 +1,58 @@
+#include "KFC/Function.h"
+#include "KFC/Own.h"
+#include "KFC/Testing.h"
+
+#include <array>
+
+KFC_NAMESPACE_BEG
+
+TEST(FunctionTest, Call) {
+  Function<int(int, int)> add = [](const int a, const int b) { return a + b; };
+  EXPECT_TRUE(add);
+  EXPECT_EQ(add(1, 2), 3);
+
+  Function<void()> empty;
+  EXPECT_FALSE(empty);
+  empty = nullptr;
+  EXPECT_FALSE(empty);
+}
+
+TEST(FunctionTest, MoveOnlyCapture) {
+  Own<int, DeleteStaticDisposer<int>> value = new int(42);
+  Function<int()> f = [value = std::move(value)]() mutable { return *value; };
+  Function<int()> g = std::move(f);
+  EXPECT_FALSE(f);
+  EXPECT_EQ(g(), 42);
+}
+
+TEST(FunctionTest, Destroy) {
+  // Inline and boxed callables are destroyed exactly once, wherever they've been moved.
+  struct Counted {
+    explicit Counted(int &n) : n(&n) {}
+    Counted(Counted &&other) noexcept : n(KFC_EXCHANGE(other.n, nullptr)) {}
+    ~Counted() {
+      if (n) ++*n;
+    }
+    void operator()() const {}
+    int *n;
+  };
+  struct Large : Counted {
+    using Counted::Counted;
+    std::array<char, 256> padding{};
+  };
+
+  int inlineDestroyed = 0, boxedDestroyed = 0;
+  {
+    Function<void()> f = Counted(inlineDestroyed);
+    Function<void()> g = Large(boxedDestroyed);
+    Function<void()> h = std::move(f);
+    h = std::move(g);
+    EXPECT_EQ(inlineDestroyed, 1);
+    EXPECT_EQ(boxedDestroyed, 0);
+    h();
+  }
+  EXPECT_EQ(inlineDestroyed, 1);
+  EXPECT_EQ(boxedDestroyed, 1);
+}
+
+KFC_NAMESPACE_END
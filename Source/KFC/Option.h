@@ -78,6 +78,11 @@ public:
     return m_value;
   }
 
+  const T &unwrap() const {
+    KFC_CHECK(m_hasValue, "called unwrap on None");
+    return m_value;
+  }
+
   T &unwrapOr(const T &other) { return m_hasValue ? m_value : other; }
 
   Option<T> take() {
@@ -135,7 +140,7 @@ public:
   KFC_NODISCARD constexpr bool isSome() const { return m_ptr != nullptr; }
   KFC_NODISCARD constexpr bool isNone() const { return m_ptr == nullptr; }
 
-  T &unwrap() {
+  T &unwrap() const {
     KFC_CHECK(m_ptr, "called unwrap on None");
     return *m_ptr;
   }
@@ -95,6 +95,16 @@
 #endif
 #endif
 
+// C++20 coroutines, used by `Promise` when the compiler and the standard library support them.
+// GCC 12 and older crash compiling coroutines whose return type has a `noexcept(false)`
+// destructor, which `Promise` has through `Own`.
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L &&                            \
+    __has_include(<coroutine>) && !(defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13)
+#define KFC_HAS_COROUTINE 1
+#else
+#define KFC_HAS_COROUTINE 0
+#endif
+
 #if defined(__GNUC__) || defined(__clang__)
 #define KFC_LIKELY(x) __builtin_expect(!!(x), 1)
 #define KFC_UNLIKELY(x) __builtin_expect(!!(x), 0)
@@ -0,0 +1,210 @@
+#include "KFC/SimEventPort.h"
+
+#include <algorithm>
+#include <cstring>
+
+KFC_NAMESPACE_BEG
+
+void VirtualClock::advanceTo(const Time &time) {
+  if (m_now < time) m_now = time;
+}
+
+// Bytes flowing from one socket of a pair to the other.
+struct SimSocket::Flow {
+  struct Segment {
+    Time arrival;
+    std::string data;
+  };
+
+  std::deque<Segment> segments; // Sent but not read yet, by time of arrival.
+  size_t offset = 0;            // Bytes of the first segment that have been read.
+  Time linkFreeAt;              // When the link is done with the bytes written so far.
+  Time lastArrival;
+  Option<Time> endAt;           // When the reader gets to the end of the stream.
+  Option<Waiter &> waiter;      // A reader waiting for bytes to be sent.
+  bool readerGone = false;
+};
+
+class SimSocket::Connection final : public RefCounted<Connection> {
+public:
+  explicit Connection(const SimLinkOptions &options) : options(options) {}
+
+  const SimLinkOptions options;
+  Flow flows[2];
+};
+
+// A read waiting for the peer to write, resolved by the next write or by the end of the stream.
+class SimSocket::Waiter final {
+public:
+  explicit Waiter(_::PromiseResolver<void> &resolver, Option<Waiter &> &slot)
+      : m_resolver(resolver), m_slot(&slot) {
+    slot = *this;
+  }
+  ~Waiter() noexcept(false) {
+    if (m_slot) *m_slot = None;
+  }
+  KFC_DISALLOW_COPY_AND_MOVE(Waiter)
+
+  static void settle(Option<Waiter &> &slot) {
+    KFC_IF_SOME(w, slot) {
+      w.m_slot = nullptr;
+      slot = None;
+      w.m_resolver.resolve();
+    }
+  }
+
+private:
+  _::PromiseResolver<void> &m_resolver;
+  Option<Waiter &> *m_slot; // Null once settled.
+};
+
+SimEventPort::SimEventPort(const uint64_t seed, const Time &start)
+    : m_clock(start), m_previousSource(Time::setThreadSource(&m_clock)), m_timer(start),
+      m_random(seed), m_woken(false) {}
+
+SimEventPort::~SimEventPort() noexcept(false) { Time::setThreadSource(m_previousSource); }
+
+bool SimEventPort::poll() {
+  for (;;) {
+    if (tryPoll()) return true;
+    KFC_IF_SOME_CONST(t, m_timer.nextEvent()) {
+      // Nothing can happen in the loop before the next timer, jump to it.
+      m_clock.advanceTo(t);
+      fireDueTimers();
+      return false;
+    }
+    // Nothing is scheduled, only another thread can make progress.
+    auto guard = m_woken.lock();
+    while (!*guard) m_condvar.wait(guard);
+  }
+}
+
+bool SimEventPort::tryPoll() {
+  fireDueTimers();
+  return takeWake();
+}
+
+void SimEventPort::wake() const {
+  auto guard = m_woken.lock();
+  *guard = true;
+  m_condvar.notifyOne();
+}
+
+bool SimEventPort::takeWake() const { return KFC_EXCHANGE(*m_woken.lock(), false); }
+
+void SimEventPort::fireDueTimers() { KFC_DISCARD(m_timer.advanceTo(m_clock.now())); }
+
+double SimEventPort::random() {
+  // Use the top 53 bits rather than a std distribution, whose output differs between libraries.
+  return static_cast<double>(m_random() >> 11) * 0x1.0p-53;
+}
+
+std::pair<OwnSimSocket, OwnSimSocket> SimEventPort::newSocketPair(const SimLinkOptions &options) {
+  Ref<SimSocket::Connection> connection = adoptRef(*new SimSocket::Connection(options));
+  SimSocket::Flow &ab = connection->flows[0];
+  SimSocket::Flow &ba = connection->flows[1];
+  OwnSimSocket a = new SimSocket(*this, connection, ba, ab);
+  OwnSimSocket b = new SimSocket(*this, connection, ab, ba);
+  return {std::move(a), std::move(b)};
+}
+
+SimSocket::SimSocket(SimEventPort &port, Ref<Connection> connection, Flow &in, Flow &out)
+    : m_port(port), m_connection(std::move(connection)), m_in(in), m_out(out) {}
+
+SimSocket::~SimSocket() noexcept(false) {
+  shutdownWrite();
+  m_in.readerGone = true;
+  m_in.segments.clear();
+}
+
+void SimSocket::shutdownWrite() {
+  if (m_out.endAt.isSome()) return;
+  const Time now = m_port.getClock().now();
+  m_out.endAt = std::max(std::max(now, m_out.linkFreeAt) + m_connection->options.latency,
+                         m_out.lastArrival);
+  Waiter::settle(m_out.waiter);
+}
+
+Promise<size_t> SimSocket::tryRead(void *buffer, const size_t minBytes, const size_t maxBytes) {
+  return tryReadInternal(static_cast<unsigned char *>(buffer), minBytes, maxBytes, 0);
+}
+
+Promise<size_t> SimSocket::tryReadInternal(unsigned char *buffer, size_t minBytes,
+                                           size_t maxBytes, size_t alreadyRead) {
+  const Time now = m_port.getClock().now();
+  while (maxBytes > 0 && !m_in.segments.empty() && !(now < m_in.segments.front().arrival)) {
+    const std::string &data = m_in.segments.front().data;
+    const size_t n = std::min(maxBytes, data.size() - m_in.offset);
+    memcpy(buffer, data.data() + m_in.offset, n);
+    buffer += n;
+    alreadyRead += n;
+    minBytes -= std::min(minBytes, n);
+    maxBytes -= n;
+    m_in.offset += n;
+    if (m_in.offset == data.size()) {
+      m_in.segments.pop_front();
+      m_in.offset = 0;
+    }
+  }
+  if (minBytes == 0) return Promise<size_t>(alreadyRead);
+
+  auto retry = [this, buffer, minBytes, maxBytes, alreadyRead] {
+    return tryReadInternal(buffer, minBytes, maxBytes, alreadyRead);
+  };
+  if (!m_in.segments.empty()) {
+    return m_port.getTimer().atTime(m_in.segments.front().arrival).then(std::move(retry));
+  }
+  KFC_IF_SOME_CONST(t, m_in.endAt) {
+    if (now < t) return m_port.getTimer().atTime(t).then(std::move(retry));
+    return Promise<size_t>(alreadyRead);
+  }
+  return _::createAdaptedPromise<void, Waiter>(m_in.waiter).then(std::move(retry));
+}
+
+Promise<void> SimSocket::write(const void *buffer, const size_t size) {
+  return write({WritePiece{buffer, size}});
+}
+
+Promise<void> SimSocket::write(std::vector<WritePiece> pieces) {
+  if (m_out.endAt.isSome()) {
+    return Promise<void>(_::PromiseResult<void>(
+        KFC_EXCEPTION(Exception::Kind::Logic, "Write to a shut down SimSocket")));
+  }
+  const Time now = m_port.getClock().now();
+  Time sent = now;
+  for (const WritePiece &piece : pieces) {
+    sent = send(static_cast<const unsigned char *>(piece.data), piece.size);
+  }
+  Waiter::settle(m_out.waiter);
+  if (now < sent) return m_port.getTimer().atTime(sent);
+  return Promise<void>(Void());
+}
+
+Time SimSocket::send(const unsigned char *data, const size_t size) {
+  const SimLinkOptions &options = m_connection->options;
+  const Time now = m_port.getClock().now();
+  for (size_t offset = 0; offset < size; offset += options.segmentSize) {
+    const size_t n = std::min(options.segmentSize, size - offset);
+    const Time start = std::max(now, m_out.linkFreeAt);
+    m_out.linkFreeAt = start;
+    if (options.bandwidth) {
+      m_out.linkFreeAt = start + Duration(static_cast<int64_t>(
+                                     (n * 1000000000ULL + options.bandwidth - 1) /
+                                     options.bandwidth));
+    }
+    Time arrival = m_out.linkFreeAt + options.latency;
+    while (options.lossRate > 0 && m_port.random() < options.lossRate) {
+      arrival = arrival + options.retransmitTimeout;
+    }
+    // Bytes are delivered in order, behind a retransmitted segment if need be.
+    arrival = std::max(arrival, m_out.lastArrival);
+    m_out.lastArrival = arrival;
+    if (!m_out.readerGone) {
+      const char *bytes = reinterpret_cast<const char *>(data) + offset;
+      m_out.segments.push_back({arrival, std::string(bytes, n)});
+    }
+  }
+  return std::max(now, m_out.linkFreeAt);
+}
+
+KFC_NAMESPACE_END
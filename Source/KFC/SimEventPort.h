@@ -0,0 +1,123 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/AsyncStream.h"
+#include "KFC/Condvar.h"
+#include "KFC/Mutex.h"
+#include "KFC/Own.h"
+#include "KFC/Preclude.h"
+#include "KFC/Ref.h"
+#include "KFC/RefCounted.h"
+#include "KFC/Time.h"
+#include "KFC/Timer.h"
+
+#include <deque>
+#include <random>
+#include <string>
+
+KFC_NAMESPACE_BEG
+
+// A clock that only moves when told to.
+class VirtualClock final : public TimeSource {
+public:
+  explicit VirtualClock(const Time &start) : m_now(start) {}
+  Time now() override { return m_now; }
+  // Move the clock forward to `time`, it never goes back.
+  void advanceTo(const Time &time);
+  void advance(Duration delay) { advanceTo(m_now + delay); }
+
+private:
+  Time m_now;
+};
+
+// The characteristics of a simulated connection, the same in both directions.
+struct SimLinkOptions {
+  // Bytes per second, 0 for an unlimited bandwidth.
+  uint64_t bandwidth = 0;
+  // One-way delay of a segment.
+  Duration latency = Duration(0);
+  // Probability that a segment is lost. A lost segment is retransmitted after
+  // `retransmitTimeout`, and the bytes behind it wait for it, as they would on a TCP connection.
+  double lossRate = 0;
+  Duration retransmitTimeout = 200_ms;
+  // Writes are cut into segments of this size, which is the granularity of the above.
+  size_t segmentSize = 1460;
+};
+
+class SimSocket;
+using OwnSimSocket = Own<SimSocket, DeleteStaticDisposer<SimSocket>>;
+
+// A deterministic EventPort running on virtual time, to test and benchmark code that waits on
+// timers and sockets without real delays: when the loop runs out of work, `poll` jumps the clock to
+// the next timer instead of sleeping. Hours of simulated time take as long as the events they fire,
+// and a run only depends on the seed.
+//
+// While the port exists, `Time::now()` returns the virtual time in the thread that created it, so
+// the port must be created and destroyed in the thread of its EventLoop. Cross-thread `wake`s are
+// supported, but they make a run depend on the other threads.
+class SimEventPort final : public EventPort {
+public:
+  explicit SimEventPort(uint64_t seed = 0, const Time &start = Time(0));
+  ~SimEventPort() noexcept(false) override;
+  KFC_DISALLOW_COPY_AND_MOVE(SimEventPort)
+
+  bool poll() override;
+  bool tryPoll() override;
+  void wake() const override;
+  Timer &getTimer() { return m_timer; }
+  VirtualClock &getClock() { return m_clock; }
+
+  // Create a pair of connected sockets.
+  std::pair<OwnSimSocket, OwnSimSocket> newSocketPair(const SimLinkOptions &options = {});
+  // Draw a number in [0, 1) from the port's seeded generator.
+  double random();
+
+private:
+  // Fire the timers that are due, without moving the clock.
+  void fireDueTimers();
+  bool takeWake() const;
+
+  VirtualClock m_clock;
+  TimeSource *m_previousSource;
+  Timer m_timer;
+  std::mt19937_64 m_random;
+  mutable Mutex<bool> m_woken;
+  mutable Condvar m_condvar;
+};
+
+// One end of a simulated connection, created by `SimEventPort::newSocketPair`. Written bytes are
+// delivered to the other end after the latency, at the bandwidth of the link, and the write
+// resolves once they've been put on the link. Destroying a socket ends the stream of its peer.
+class SimSocket final : public AsyncIoStream {
+public:
+  ~SimSocket() noexcept(false) override;
+  KFC_DISALLOW_COPY_AND_MOVE(SimSocket)
+
+  // End the stream read by the peer, after the bytes already written.
+  void shutdownWrite();
+
+  Promise<size_t> tryRead(void *buffer, size_t minBytes, size_t maxBytes) override;
+  using AsyncOutputStream::write;
+  Promise<void> write(const void *buffer, size_t size) override;
+  Promise<void> write(std::vector<WritePiece> pieces) override;
+
+private:
+  struct Flow;
+  class Connection;
+  class Waiter;
+
+  explicit SimSocket(SimEventPort &port, Ref<Connection> connection, Flow &in, Flow &out);
+  Promise<size_t> tryReadInternal(unsigned char *buffer, size_t minBytes, size_t maxBytes,
+                                  size_t alreadyRead);
+  // Put `size` bytes on the link and return when the last of them will have left.
+  Time send(const unsigned char *data, size_t size);
+
+  SimEventPort &m_port;
+  Ref<Connection> m_connection;
+  Flow &m_in;
+  Flow &m_out;
+
+  friend SimEventPort;
+};
+
+KFC_NAMESPACE_END
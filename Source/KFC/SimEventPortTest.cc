@@ -0,0 +1,155 @@
+#include "KFC/SimEventPort.h"
+#include "KFC/Testing.h"
+#include "KFC/Thread.h"
+
+#include <string>
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  SimEventPort port;                                                                               \
+  EventLoop loop(port);                                                                            \
+  WaitScope scope(loop)
+
+static std::string makeData(const size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>('a' + i % 26);
+  return data;
+}
+
+// Send `size` bytes over a link and return when the last one was received, relative to the start.
+static Duration transfer(SimEventPort &port, WaitScope &scope, const SimLinkOptions &options,
+                         const size_t size) {
+  auto sockets = port.newSocketPair(options);
+  const std::string data = makeData(size);
+  const Time start = Time::now();
+  Promise<void> written = sockets.first->write(data.data(), data.size());
+  std::string received(size, '\0');
+  EXPECT_EQ(sockets.second->read(&received[0], size, size).wait(scope), size);
+  const Duration elapsed = Time::since(start);
+  written.wait(scope);
+  EXPECT_EQ(received, data);
+  return elapsed;
+}
+
+TEST(SimEventPortTest, VirtualTime) {
+  const Time realStart = Time::now();
+  {
+    SETUP_TEST_EVENT_LOOP;
+    const Time start = Time::now();
+    EXPECT_EQ(start, Time(0));
+    port.getTimer().afterDelay(Duration::fromHour(2)).wait(scope);
+    EXPECT_EQ(Time::since(start), Duration::fromHour(2));
+  }
+  // The real clock is back, and two hours haven't passed.
+  EXPECT_LT(Time::since(realStart), Duration::fromMinute(1));
+}
+
+TEST(SimEventPortTest, ManyTimers) {
+  SETUP_TEST_EVENT_LOOP;
+  constexpr int kTasks = 10000;
+  std::vector<Promise<void>> tasks;
+  int done = 0;
+  for (int i = 0; i < kTasks; ++i) {
+    const Duration delay = Duration::fromSecond(static_cast<int64_t>(port.random() * 3600));
+    tasks.push_back(port.getTimer().afterDelay(delay).then([&, delay] {
+      return port.getTimer().afterDelay(delay).then([&] { ++done; });
+    }));
+  }
+  const Time start = Time::now();
+  joinPromises(std::move(tasks)).wait(scope);
+  EXPECT_EQ(done, kTasks);
+  EXPECT_LE(Time::since(start), Duration::fromHour(2));
+  EXPECT_GE(Time::since(start), Duration::fromMinute(110));
+}
+
+TEST(SimEventPortTest, LatencyAndBandwidth) {
+  SETUP_TEST_EVENT_LOOP;
+  SimLinkOptions options;
+  options.bandwidth = 1000 * 1000;
+  options.latency = 50_ms;
+  // 100 kB at 1 MB/s, plus the latency.
+  const Duration elapsed = transfer(port, scope, options, 100 * 1000);
+  EXPECT_GE(elapsed, 150_ms);
+  EXPECT_LT(elapsed, 151_ms);
+}
+
+TEST(SimEventPortTest, WriteWaitsForTheLink) {
+  SETUP_TEST_EVENT_LOOP;
+  SimLinkOptions options;
+  options.bandwidth = 1000;
+  options.segmentSize = 100;
+  auto sockets = port.newSocketPair(options);
+  const Time start = Time::now();
+  sockets.first->write(std::string(1000, 'x').data(), 1000).wait(scope);
+  EXPECT_EQ(Time::since(start), Duration::fromSecond(1));
+}
+
+TEST(SimEventPortTest, LossIsDeterministic) {
+  SimLinkOptions options;
+  options.bandwidth = 10 * 1000 * 1000;
+  options.latency = 10_ms;
+  options.lossRate = 0.01;
+  Duration elapsed[2];
+  for (Duration &e : elapsed) {
+    SimEventPort port(42);
+    EventLoop loop(port);
+    WaitScope scope(loop);
+    e = transfer(port, scope, options, 1000 * 1000);
+  }
+  EXPECT_EQ(elapsed[0], elapsed[1]);
+  // 100 ms at 10 MB/s and 10 ms of latency, at least one segment waited for a retransmission.
+  EXPECT_GT(elapsed[0], 210_ms);
+}
+
+TEST(SimEventPortTest, EndOfStream) {
+  SETUP_TEST_EVENT_LOOP;
+  SimLinkOptions options;
+  options.latency = 10_ms;
+  auto sockets = port.newSocketPair(options);
+  sockets.first->write("abc", 3).wait(scope);
+  sockets.first->shutdownWrite();
+  EXPECT_THROW(sockets.first->write("d", 1).wait(scope), Exception);
+  char buf[8];
+  EXPECT_EQ(sockets.second->tryRead(buf, 8, 8).wait(scope), 3);
+  EXPECT_EQ(sockets.second->tryRead(buf, 1, 8).wait(scope), 0);
+
+  // Destroying a socket ends the stream of its peer too.
+  Promise<size_t> read = sockets.first->tryRead(buf, 1, 8);
+  sockets.second = nullptr;
+  EXPECT_EQ(read.wait(scope), 0);
+}
+
+TEST(SimEventPortTest, Pump) {
+  SETUP_TEST_EVENT_LOOP;
+  SimLinkOptions options;
+  options.latency = 5_ms;
+  auto in = port.newSocketPair(options);
+  auto out = port.newSocketPair(options);
+  const std::string data = makeData(200 * 1000);
+  Promise<uint64_t> pumped = in.second->pumpTo(*out.first);
+  Promise<void> written = in.first->write(data.data(), data.size()).then([&] {
+    in.first->shutdownWrite();
+  });
+  std::string received(data.size(), '\0');
+  EXPECT_EQ(out.second->read(&received[0], data.size(), data.size()).wait(scope), data.size());
+  written.wait(scope);
+  EXPECT_EQ(pumped.wait(scope), data.size());
+  EXPECT_EQ(received, data);
+}
+
+TEST(SimEventPortTest, CrossThreadWake) {
+  SETUP_TEST_EVENT_LOOP;
+  Ref<Executor> executor = getCurrentThreadExecutor();
+  auto par = createPromiseAndResolver<int>();
+  Thread t([&] {
+    SimEventPort otherPort;
+    EventLoop otherLoop(otherPort);
+    WaitScope otherScope(otherLoop);
+    executor->executeAsync([&] { par.resolver->resolve(42); }).wait(otherScope);
+  });
+  EXPECT_EQ(par.promise.wait(scope), 42);
+}
+
+KFC_NAMESPACE_END
@@ -26,6 +26,15 @@ String stringifyStackTrace(void **frames, int size) {
   return joinStringArray(lines, "\n");
 }
 
+String demangleTypeName(const char *name) {
+  int status;
+  char *demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (status != 0) return name;
+  String result(demangled);
+  free(demangled);
+  return result;
+}
+
 String demangleStackTraceLine(const StringView &line) {
   const size_t start = line.find("_Z");
   const size_t end = line.rfind(" +");
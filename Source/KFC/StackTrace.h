@@ -16,5 +16,7 @@ KFC_NOINLINE int getStackTrace(void **frames, size_t size, int skipFrames = 0);
 String stringifyStackTrace(void **frames, int size);
 String getStackTraceAsString(int skipFrames = 0);
 String demangleStackTraceLine(const StringView &line);
+// Demangle a type name as returned by `std::type_info::name`.
+String demangleTypeName(const char *name);
 
 KFC_NAMESPACE_END
@@ -73,44 +73,11 @@ size_t StringView::rfind(const StringView &str) const {
   if (str.m_size == 0) return m_size;
   if (m_size < str.m_size) return String::npos;
 
-  // Preprocess the pattern to compute the longest prefix suffix (LPS) array
-  std::vector<size_t> lps(str.m_size, 0);
-  size_t len = 0;
-  for (size_t i = 1; i < str.m_size;) {
-    if (str.m_ptr[i] == str.m_ptr[len]) {
-      lps[i++] = ++len;
-    } else {
-      if (len != 0) {
-        len = lps[len - 1];
-      } else {
-        lps[i++] = 0;
-      }
-    }
+  // Compare backward from the last position the pattern fits at.
+  for (size_t i = m_size - str.m_size + 1; i > 0; --i) {
+    if (::memcmp(m_ptr + i - 1, str.m_ptr, str.m_size) == 0) return i - 1;
   }
-
-  // Perform the reverse KMP search
-  size_t i = m_size;     // index for the main string
-  size_t j = str.m_size; // index for the pattern string
-  size_t last_match_pos = String::npos;
-
-  while (i > 0) {
-    if (m_ptr[i - 1] == str.m_ptr[j - 1]) {
-      i--;
-      j--;
-      if (j == 0) {
-        last_match_pos = i;
-        j = str.m_size; // Reset to find earlier matches
-      }
-    } else {
-      if (j != str.m_size) {
-        j = lps[j];
-      } else {
-        i--;
-      }
-    }
-  }
-
-  return last_match_pos;
+  return String::npos;
 }
 
 /*
@@ -3,6 +3,7 @@
 #include "KFC/Memory.h"
 #include "KFC/Preclude.h"
 #include <cstddef>
+#include <cstring>
 #include <string>
 
 KFC_NAMESPACE_BEG
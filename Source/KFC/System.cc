@@ -1,11 +1,20 @@
 #include "KFC/System.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <pthread.h>
 #include <unistd.h>
 #endif
 
+#ifdef __linux__
+#include <sched.h>
+#endif
+
 namespace KFC {
 int getProcessorCoreCount() {
 #ifdef _WIN32
@@ -17,4 +26,90 @@ int getProcessorCoreCount() {
 #endif
 }
 
+std::vector<int> getAllowedCpus() {
+  std::vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+    }
+  }
+#endif
+  if (cpus.empty()) {
+    for (int cpu = 0; cpu < getProcessorCoreCount(); ++cpu) cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+int getCurrentCpu() {
+#ifdef __linux__
+  return sched_getcpu();
+#else
+  return -1;
+#endif
+}
+
+void bindCurrentThread(const std::vector<int> &cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+  }
+  // The thread still works unbound if it fails.
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpus;
+#endif
+}
+
+std::vector<NumaNode> getNumaNodes() {
+  const std::vector<int> allowed = getAllowedCpus();
+  std::vector<NumaNode> nodes;
+#ifdef __linux__
+  std::string online;
+  std::ifstream onlineFile("/sys/devices/system/node/online");
+  if (std::getline(onlineFile, online)) {
+    for (const int id : parseCpuList(online)) {
+      std::string list;
+      std::ifstream cpuFile("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+      if (!std::getline(cpuFile, list)) continue;
+      NumaNode node{id, {}};
+      for (const int cpu : parseCpuList(list)) {
+        if (std::binary_search(allowed.begin(), allowed.end(), cpu)) node.cpus.push_back(cpu);
+      }
+      // Memory-only nodes and nodes of CPUs out of reach don't run anything.
+      if (!node.cpus.empty()) nodes.push_back(std::move(node));
+    }
+  }
+#endif
+  if (nodes.empty()) nodes.push_back({0, allowed});
+  return nodes;
+}
+
+std::vector<int> parseCpuList(const std::string &list) {
+  std::vector<int> cpus;
+  size_t pos = 0;
+  while (pos < list.size()) {
+    size_t end = list.find(',', pos);
+    if (end == std::string::npos) end = list.size();
+    const std::string range = list.substr(pos, end - pos);
+    pos = end + 1;
+
+    int first, last;
+    char dash;
+    if (sscanf(range.c_str(), "%d%c%d", &first, &dash, &last) == 3 && dash == '-') {
+      if (first < 0 || last < first) continue;
+      for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+    } else if (sscanf(range.c_str(), "%d", &first) == 1 && first >= 0) {
+      cpus.push_back(first);
+    }
+  }
+  std::sort(cpus.begin(), cpus.end());
+  cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+  return cpus;
+}
+
 } // namespace KFC
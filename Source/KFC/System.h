@@ -1,5 +1,30 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 namespace KFC {
 int getProcessorCoreCount();
-}
+
+// The CPUs the process may run on, in ascending order.
+std::vector<int> getAllowedCpus();
+
+// The CPU the current thread is running on, -1 if unknown.
+int getCurrentCpu();
+
+// Bind the current thread to `cpus`. Best effort, a cgroup or seccomp policy may forbid it, and
+// other platforms have no hard affinity.
+void bindCurrentThread(const std::vector<int> &cpus);
+
+struct NumaNode {
+  int id;
+  std::vector<int> cpus; // Those the process may run on, in ascending order.
+};
+
+// The NUMA nodes that have CPUs the process may run on, read from /sys/devices/system/node. Without
+// NUMA information, a single node 0 with all the allowed CPUs.
+std::vector<NumaNode> getNumaNodes();
+
+// Parse a kernel CPU list such as "0-3,8,10-11", ignoring malformed ranges.
+std::vector<int> parseCpuList(const std::string &list);
+} // namespace KFC
@@ -0,0 +1,29 @@
+#include "KFC/Preclude.h"
+#include "KFC/System.h"
+#include "KFC/Testing.h"
+
+#include <algorithm>
+
+KFC_NAMESPACE_BEG
+
+TEST(SystemTest, ParseCpuList) {
+  EXPECT_EQ(parseCpuList("0"), std::vector<int>({0}));
+  EXPECT_EQ(parseCpuList("0-3,8,10-11\n"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+  EXPECT_EQ(parseCpuList("4,0-1,1"), std::vector<int>({0, 1, 4}));
+  EXPECT_EQ(parseCpuList(""), std::vector<int>());
+  EXPECT_EQ(parseCpuList("3-1,x,2"), std::vector<int>({2}));
+}
+
+TEST(SystemTest, NumaNodes) {
+  // Every allowed CPU is in exactly one node.
+  const std::vector<int> allowed = getAllowedCpus();
+  std::vector<int> cpus;
+  for (const NumaNode &node : getNumaNodes()) {
+    EXPECT_FALSE(node.cpus.empty());
+    cpus.insert(cpus.end(), node.cpus.begin(), node.cpus.end());
+  }
+  std::sort(cpus.begin(), cpus.end());
+  EXPECT_EQ(cpus, allowed);
+}
+
+KFC_NAMESPACE_END
@@ -7,18 +7,26 @@
 KFC_NAMESPACE_BEG
 
 Thread::Thread(Func &&func, std::string name)
-    : m_detached(false), m_func(std::move(func)), m_name(std::move(name)) {
+    : m_detached(false), m_context(new Context{std::move(func), std::move(name), None, {2}}) {
 #ifdef _WIN32
-  m_handle = CreateThread(nullptr, 0, ThreadProc, this, CREATE_SUSPENDED, nullptr);
+  m_handle = CreateThread(nullptr, 0, ThreadProc, m_context, CREATE_SUSPENDED, nullptr);
   KFC_CHECK(m_handle, "CreateThread, error code %d", GetLastError());
   ResumeThread(m_handle);
 #else
-  KFC_CHECK_SYSCALL(pthread_create(&m_tid, nullptr, &run, this));
+  const int error = pthread_create(&m_tid, nullptr, &run, m_context);
+  if (error != 0) delete m_context;
+  KFC_CHECK_SYSCALL(error);
 #endif
 }
 
 Thread::~Thread() noexcept(false) {
-  if (!m_detached) join();
+  Option<Exception> exception;
+  if (!m_detached) {
+    join();
+    exception = std::move(m_context->exception);
+  }
+  release(m_context);
+  KFC_IF_SOME(e, exception) { throw std::move(e); }
 }
 
 void Thread::join() {
@@ -30,7 +38,6 @@ void Thread::join() {
 #else
   KFC_CHECK_SYSCALL(pthread_join(m_tid, nullptr));
 #endif
-  KFC_IF_SOME(e, m_exception) { throw std::move(e); }
 }
 
 void Thread::detach() {
@@ -42,12 +49,17 @@ void Thread::detach() {
 }
 
 void *Thread::run(void *arg) {
-  auto *t = static_cast<Thread *>(arg);
-  setCurrentThreadName(t->m_name);
-  t->m_exception = runCatchingExceptions([&] { t->m_func(); });
+  auto *context = static_cast<Context *>(arg);
+  setCurrentThreadName(context->name);
+  context->exception = runCatchingExceptions([&] { context->func(); });
+  release(context);
   return nullptr;
 }
 
+void Thread::release(Context *context) {
+  if (context->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete context;
+}
+
 Thread::Id Thread::current() {
 #ifdef _WIN32
   return Id(GetCurrentThread());
@@ -66,8 +78,9 @@ void setCurrentThreadName(const std::string &name) {
     KFC_CHECK_SYSCALL(pthread_setname_np(name.c_str()));
 #elif defined(__linux__)
     char buf[16];
-    std::memcpy(buf, name.c_str(), std::min(name.size(), sizeof(buf) - 1));
-    buf[sizeof(buf) - 1] = '\0';
+    const size_t size = std::min(name.size(), sizeof(buf) - 1);
+    std::memcpy(buf, name.c_str(), size);
+    buf[size] = '\0';
     KFC_CHECK_SYSCALL(pthread_setname_np(pthread_self(), buf));
 #else
 #error "Unsupported platform for thread name setting"
@@ -1,11 +1,17 @@
 #pragma once
 
 #include "KFC/CopyMove.h"
+#include "KFC/Function.h"
 #include "KFC/Option.h"
 #include "KFC/Own.h"
 #include "KFC/Preclude.h"
+#include <atomic>
 #include <functional>
 
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
 KFC_NAMESPACE_BEG
 class Thread;
 class ThreadDisposer final : public DeleteStaticDisposer<Thread> {};
@@ -14,7 +20,7 @@ using OwnThread = Own<Thread, ThreadDisposer>;
 class KFC_NODISCARD Thread final {
 public:
   KFC_DISALLOW_COPY(Thread)
-  using Func = std::function<void()>;
+  using Func = Function<void()>;
 
   class Id {
 #ifdef _WIN32
@@ -50,7 +56,17 @@ public:
   void detach();
 
 private:
+  // What the thread runs with. Shared by the Thread and its thread, the last of the two to let go
+  // deletes it, so that a detached thread outlives its Thread.
+  struct Context {
+    Func func;
+    String name;
+    Option<Exception> exception;
+    std::atomic<int> refs;
+  };
+
   static void *run(void *arg);
+  static void release(Context *context);
   void join();
 
 #ifdef _WIN32
@@ -61,9 +77,7 @@ private:
 #endif
 
   bool m_detached;
-  Func m_func;
-  Option<Exception> m_exception;
-  String m_name;
+  Context *m_context;
 
 #ifdef _WIN32
   HANDLE m_handle;
@@ -1,24 +1,98 @@
 #include "KFC/ThreadPool.h"
-#include "KFC/Bits.h"
 #include "KFC/Memory.h"
+#include "KFC/RunCatchingExceptions.h"
 #include "KFC/System.h"
 
+#include <thread>
+
 KFC_NAMESPACE_BEG
 
+thread_local ThreadPool::Worker *ThreadPool::threadLocalWorker = nullptr;
+
+namespace {
+struct TaskCache {
+  static constexpr int kMaxSize = 256;
+
+  struct Node {
+    Node *next;
+  };
+
+  ~TaskCache() {
+    while (Node *node = head) {
+      head = node->next;
+      ::operator delete(node);
+    }
+    // Tasks freed after this, by other thread-local destructors, go back to the heap.
+    size = kMaxSize;
+  }
+
+  Node *head = nullptr;
+  int size = 0;
+};
+
+thread_local TaskCache threadLocalTaskCache;
+
+ThreadPoolOptions makeOptions(const int maxNumThreads, const int minNumThreads, const int maxAge,
+                              const int maxSleepSeconds) {
+  ThreadPoolOptions options;
+  options.maxNumThreads = maxNumThreads;
+  options.minNumThreads = minNumThreads;
+  options.maxAge = maxAge;
+  options.maxSleepSeconds = maxSleepSeconds;
+  return options;
+}
+} // namespace
+
+void *ThreadPool::Task::operator new(const size_t size) {
+  TaskCache &cache = threadLocalTaskCache;
+  if (TaskCache::Node *node = cache.head) {
+    cache.head = node->next;
+    cache.size--;
+    return node;
+  }
+  return ::operator new(size);
+}
+
+void ThreadPool::Task::operator delete(void *ptr) {
+  TaskCache &cache = threadLocalTaskCache;
+  if (cache.size >= TaskCache::kMaxSize) {
+    ::operator delete(ptr);
+    return;
+  }
+  cache.head = new (ptr) TaskCache::Node{cache.head};
+  cache.size++;
+}
+
 ThreadPool::ThreadPool(const int maxNumThreads, const int minNumThreads, const int maxAge,
                        const int maxSleepSeconds)
-    : m_guarded(genSafeWorkerThreadMaxNum(maxNumThreads), genSafeWorkerThreadMinNum(minNumThreads),
-                genSafeWorkerThreadMaxAge(maxAge),
-                genSafeWorkerThreadMaxSleepSeconds(maxSleepSeconds)) {}
+    : ThreadPool(makeOptions(maxNumThreads, minNumThreads, maxAge, maxSleepSeconds)) {}
 
-ThreadPool::~ThreadPool() noexcept(false) { shutdown(); }
+ThreadPool::ThreadPool(const ThreadPoolOptions &options)
+    : m_cpus(options.cpus.empty() ? getAllowedCpus() : options.cpus),
+      m_numSlots(
+          std::max(genSafeWorkerThreadMaxNum(kWorkerThreadMaxNumAuto), options.maxNumThreads)),
+      m_bindWorkers(!options.cpus.empty()), m_pinWorkers(options.pinWorkers),
+      m_injected(nullptr), m_injectedPrior(nullptr), m_numThreads(0), m_numIdleThreads(0),
+      m_maxNumThreads(genSafeWorkerThreadMaxNum(options.maxNumThreads)), m_shutdown(false),
+      m_guarded(m_numSlots, genSafeWorkerThreadMinNum(options.minNumThreads),
+                genSafeWorkerThreadMaxAge(options.maxAge),
+                genSafeWorkerThreadMaxSleepSeconds(options.maxSleepSeconds)) {
+  // Slots for as many workers as the pool may ever have, so that thieves never see them change.
+  for (int seq = 0; seq < m_numSlots; seq++) m_workers.emplace_back(new Worker(*this, seq));
+}
+
+ThreadPool::~ThreadPool() noexcept(false) {
+  shutdown();
+  drainLeftTasks();
+}
 
 void ThreadPool::setWorkerThreadMinNum(const int num) {
   m_guarded.lock()->minNumThreads = genSafeWorkerThreadMinNum(num);
 }
 
 void ThreadPool::setWorkerThreadMaxNum(const int num) {
-  m_guarded.lock()->maxNumThreads = genSafeWorkerThreadMaxNum(num);
+  auto guarded = m_guarded.lock();
+  m_maxNumThreads.store(genSafeWorkerThreadMaxNum(num), std::memory_order_relaxed);
 }
 
 void ThreadPool::setWorkerThreadMaxAge(const int age) {
@@ -29,57 +103,103 @@ void ThreadPool::setWorkerThreadMaxSleepSeconds(const int seconds) {
   m_guarded.lock()->maxSleepSeconds = genSafeWorkerThreadMaxSleepSeconds(seconds);
 }
 
-void ThreadPool::submitTask(Task &&task) {
-  auto guarded = m_guarded.lock();
-  enqueueTaskLocked(std::move(task), guarded);
-  if (guarded->numIdleThreads <= 0) {
-    if (guarded->numThreads < guarded->maxNumThreads) {
-      int seq = genWorkerThreadSeqLocked(guarded);
-      const std::string name = genWorkerThreadName(seq);
-      guarded->threads.insert({seq, Thread::spawn([this, seq] { runWorker(seq); }, name)});
-      guarded->numThreads++;
-    }
+void ThreadPool::submitTask(Task *task) {
+  Worker *worker = threadLocalWorker;
+  const bool fromWorker = worker && &worker->pool == this;
+  if (!fromWorker && m_shutdown.load(std::memory_order_acquire)) {
+    // No worker is left to run it.
+    OwnTask(task)->shutdown();
+    return;
+  }
+
+  // A worker keeps its own tasks, but prior ones must be seen by all workers first.
+  if (fromWorker && !task->m_prior) {
+    worker->deque.push(task);
   } else {
+    pushInjected(task->m_prior ? m_injectedPrior : m_injected, task);
+  }
+  wakeOrSpawnWorker();
+}
+
+void ThreadPool::wakeOrSpawnWorker() {
+  // Pairs with the fence of a parking worker: either it sees the task, or this sees it idle.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_numIdleThreads.load(std::memory_order_relaxed) == 0 &&
+      m_numThreads.load(std::memory_order_relaxed) >=
+          m_maxNumThreads.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  auto guarded = m_guarded.lock();
+  // The idle count only changes with the mutex held, so the workers it counts beyond the wakeups
+  // are parked for sure.
+  if (m_numIdleThreads.load(std::memory_order_relaxed) > guarded->numWakeups) {
+    guarded->numWakeups++;
     m_condvar.notifyOne();
+    return;
+  }
+  if (m_shutdown.load(std::memory_order_relaxed) ||
+      m_numThreads.load(std::memory_order_relaxed) >=
+          m_maxNumThreads.load(std::memory_order_relaxed)) {
+    return;
   }
+  int seq = genWorkerThreadSeqLocked(guarded);
+  const std::string name = genWorkerThreadName(seq);
+  guarded->threads.insert({seq, Thread::spawn([this, seq] { runWorker(seq); }, name)});
+  m_numThreads.fetch_add(1, std::memory_order_relaxed);
 }
 
 void ThreadPool::runWorker(const int seq) {
+  Worker &worker = *m_workers[seq];
+  threadLocalWorker = &worker;
+  if (m_pinWorkers) {
+    bindCurrentThread({m_cpus[seq % m_cpus.size()]});
+  } else if (m_bindWorkers) {
+    bindCurrentThread(m_cpus);
+  }
   int age = 0;
-  auto guarded = m_guarded.lock();
+  bool retired = false;
 
   while (true) {
-    while (!isTaskQueueEmptyLocked(guarded)) {
-      Task task = dequeueTaskLocked(guarded);
-      KFC_GIVE_UP_GUARD(guarded);
-      task.run();
-      guarded = m_guarded.lock();
-    }
-
-    if (guarded->shutdown) {
-      while (!isTaskQueueEmptyLocked(guarded)) {
-        auto task = dequeueTaskLocked(guarded);
-        KFC_GIVE_UP_GUARD(guarded);
-        task.shutdown();
-        guarded = m_guarded.lock();
+    if (Task *task = findTask(worker)) {
+      if (m_shutdown.load(std::memory_order_relaxed)) {
+        OwnTask(task)->shutdown();
+      } else {
+        OwnTask(task)->run();
       }
-      break;
+      continue;
     }
 
-    if (age > guarded->maxAge && guarded->numThreads > guarded->minNumThreads) {
+    auto guarded = m_guarded.lock();
+    if (m_shutdown.load(std::memory_order_relaxed)) break;
+
+    if (age > guarded->maxAge && m_numThreads.load(std::memory_order_relaxed) >
+                                     guarded->minNumThreads && !hasTask()) {
       // Here it is the only chance we can take the ownership of the last exiting thread so that it
       // can be `join`ed when `runWorker` returns, before it is too late...
       Option<OwnThread> lastExitingThread = std::move(guarded->lastExitingThread);
       guarded->lastExitingThread = std::move(guarded->threads[seq]);
       guarded->threads.erase(seq);
-      guarded->numThreads--;
-      guarded->freeWorkerSeqSet |= 1U << seq;
+      m_numThreads.fetch_sub(1, std::memory_order_relaxed);
+      guarded->freeWorkerSeqs.push_back(seq);
+      retired = true;
       break;
     }
 
-    guarded->numIdleThreads++;
-    const bool woken = m_condvar.wait(guarded, Duration::fromSecond(guarded->maxSleepSeconds));
-    guarded->numIdleThreads--;
+    // Pairs with the fence of `wakeOrSpawnWorker`.
+    m_numIdleThreads.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool woken = true;
+    if (!hasTask()) {
+      woken = m_condvar.wait(guarded, Duration::fromSecond(guarded->maxSleepSeconds));
+    }
+    // Take a wakeup whether or not it was meant for us: either way one fewer parked worker is left
+    // to notify.
+    if (guarded->numWakeups > 0) {
+      guarded->numWakeups--;
+      woken = true;
+    }
+    m_numIdleThreads.fetch_sub(1, std::memory_order_relaxed);
 
     if (woken) {
       age = 0;
@@ -87,45 +207,213 @@ void ThreadPool::runWorker(const int seq) {
       age++;
     }
   }
+
+  if (!retired) {
+    // Shutting down, run the mandatory tasks left, those of the other workers included.
+    while (Task *task = findTask(worker)) OwnTask(task)->shutdown();
+  }
+  threadLocalWorker = nullptr;
 }
 
 void ThreadPool::shutdown() {
-  auto guarded = m_guarded.lock();
-  if (guarded->shutdown) return;
+  {
+    auto guarded = m_guarded.lock();
+    if (m_shutdown.load(std::memory_order_relaxed)) return;
+
+    m_shutdown.store(true, std::memory_order_release);
+    m_condvar.notifyAll();
 
-  guarded->shutdown = true;
-  m_condvar.notifyAll();
+    // Take the ownership of all threads
+    auto lastExitingThread = std::move(guarded->lastExitingThread);
+    auto threads = std::move(guarded->threads);
 
-  // Take the ownership of all threads
-  auto lastExitingThread = std::move(guarded->lastExitingThread);
-  auto threads = std::move(guarded->threads);
+    // We must unlock before joining all threads
+    KFC_GIVE_UP_GUARD(guarded);
+  }
 
-  // We must unlock before joining all threads
-  KFC_GIVE_UP_GUARD(guarded);
+  // Tasks submitted while the workers were exiting.
+  drainLeftTasks();
 }
 
-void ThreadPool::enqueueTaskLocked(Task &&task, MutexGuard<Guarded> &guarded) {
-  if (task.m_prior) {
-    guarded->queue.push_front(task);
-  } else {
-    guarded->queue.push_back(task);
+struct ThreadPool::Join {
+  explicit Join(const Function<void(size_t, size_t)> &body, const size_t grain)
+      : body(body), grain(grain), pending(1), failed(false), finished(false) {}
+
+  const Function<void(size_t, size_t)> &body;
+  const size_t grain;
+  std::atomic<size_t> pending; // Ranges submitted or running.
+  std::atomic<bool> failed;
+  Mutex<Option<Exception>> exception;
+  Mutex<bool> finished;
+  Condvar condvar;
+};
+
+void ThreadPool::forkJoin(const size_t begin, const size_t end, size_t grain,
+                          const Function<void(size_t, size_t)> &body) {
+  if (begin >= end) return;
+  if (grain == 0) grain = genDefaultGrain(end - begin);
+  Join join(body, grain);
+  runRange(join, begin, end);
+
+  Worker *worker = threadLocalWorker;
+  if (worker && &worker->pool == this) {
+    // Blocking would take a worker away from the chunks, run them, or anything else, instead.
+    while (join.pending.load(std::memory_order_acquire) > 0) {
+      if (Task *task = findTask(*worker)) {
+        OwnTask(task)->run();
+      } else {
+        std::this_thread::yield();
+      }
+    }
   }
+  {
+    auto finished = join.finished.lock();
+    while (!*finished) join.condvar.wait(finished);
+  }
+
+  auto exception = join.exception.lock();
+  KFC_IF_SOME(e, *exception) { throw std::move(e); }
 }
 
-ThreadPool::Task ThreadPool::dequeueTaskLocked(MutexGuard<Guarded> &guarded) {
-  Task task = std::move(guarded->queue.front());
-  guarded->queue.pop_front();
-  return task;
+void ThreadPool::runRange(Join &join, const size_t begin, size_t end) {
+  while (end - begin > join.grain) {
+    const size_t middle = begin + (end - begin) / 2;
+    join.pending.fetch_add(1, std::memory_order_relaxed);
+    // Mandatory, a join waits for all of its ranges.
+    submit([this, &join, middle, end] { runRange(join, middle, end); });
+    end = middle;
+  }
+
+  if (!join.failed.load(std::memory_order_relaxed)) {
+    KFC_IF_SOME(e, runCatchingExceptions([&] { join.body(begin, end); })) {
+      auto exception = join.exception.lock();
+      if (exception->isNone()) exception->emplace(std::move(e));
+      join.failed.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  if (join.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    // The waiter can only destroy the join once it has taken the lock back.
+    auto finished = join.finished.lock();
+    *finished = true;
+    join.condvar.notifyAll();
+  }
 }
 
-int ThreadPool::genWorkerThreadSeqLocked(MutexGuard<Guarded> &guarded) {
-  const int seq = countTrailingZeros(guarded->freeWorkerSeqSet);
-  guarded->freeWorkerSeqSet &= ~(1U << seq);
-  return seq;
+size_t ThreadPool::genDefaultGrain(const size_t size) const {
+  const size_t numChunks = 8 * static_cast<size_t>(m_maxNumThreads.load(std::memory_order_relaxed));
+  return std::max<size_t>(size / numChunks, 1);
+}
+
+ThreadPool::Task *ThreadPool::findTask(Worker &worker) {
+  if (Task *task = takeInjected(m_injectedPrior, false, worker)) return task;
+  KFC_IF_SOME(task, worker.deque.take()) { return task; }
+  if (Task *task = takeInjected(m_injected, true, worker)) return task;
+  return stealTask(worker);
+}
+
+ThreadPool::Task *ThreadPool::takeInjected(std::atomic<Task *> &queue, const bool fifo,
+                                           Worker &worker) {
+  if (!queue.load(std::memory_order_relaxed)) return nullptr;
+  Task *first = queue.exchange(nullptr, std::memory_order_acquire);
+  if (!first) return nullptr;
+  if (fifo) first = reverseTasks(first);
+
+  // The deque pops the last pushed first, push the rest backwards.
+  Task *task = reverseTasks(KFC_EXCHANGE(first->m_next, nullptr));
+  if (!task) return first;
+  while (task) {
+    worker.deque.push(task);
+    task = KFC_EXCHANGE(task->m_next, nullptr);
+  }
+  // The batch was submitted for all the workers, not only for this one.
+  wakeOrSpawnWorker();
+  return first;
+}
+
+ThreadPool::Task *ThreadPool::stealTask(Worker &worker) {
+  // xorshift64, picking a random first victim spreads the thieves over the workers.
+  worker.random ^= worker.random << 13;
+  worker.random ^= worker.random >> 7;
+  worker.random ^= worker.random << 17;
+
+  const size_t numWorkers = m_workers.size();
+  const size_t first = worker.random % numWorkers;
+  bool contended = true;
+  while (contended) {
+    contended = false;
+    for (size_t i = 0; i < numWorkers; i++) {
+      Worker &victim = *m_workers[(first + i) % numWorkers];
+      if (&victim == &worker) continue;
+      Task *task;
+      switch (victim.deque.steal(task)) {
+      case WorkStealingDeque<Task *>::StealResult::Success:
+        // Pass the work on, so that a batch spreads over as many workers as it needs.
+        if (!victim.deque.empty()) wakeOrSpawnWorker();
+        return task;
+      case WorkStealingDeque<Task *>::StealResult::Abort:
+        contended = true;
+        break;
+      case WorkStealingDeque<Task *>::StealResult::Empty:
+        break;
+      }
+    }
+  }
+  return nullptr;
+}
+
+bool ThreadPool::hasTask() {
+  if (m_injectedPrior.load(std::memory_order_relaxed) ||
+      m_injected.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  for (auto &worker : m_workers) {
+    if (!worker->deque.empty()) return true;
+  }
+  return false;
 }
 
-bool ThreadPool::isTaskQueueEmptyLocked(MutexGuard<Guarded> &guarded) {
-  return guarded->queue.empty();
+void ThreadPool::drainLeftTasks() {
+  for (std::atomic<Task *> *queue : {&m_injectedPrior, &m_injected}) {
+    Task *task = queue->exchange(nullptr, std::memory_order_acquire);
+    if (queue == &m_injected) task = reverseTasks(task);
+    while (task) {
+      OwnTask owned(task);
+      task = task->m_next;
+      owned->shutdown();
+    }
+  }
+  for (auto &worker : m_workers) {
+    Task *task;
+    while (worker->deque.steal(task) != WorkStealingDeque<Task *>::StealResult::Empty) {
+      // No thief is left, so every steal succeeds.
+      OwnTask(task)->shutdown();
+    }
+  }
+}
+
+void ThreadPool::pushInjected(std::atomic<Task *> &queue, Task *task) {
+  task->m_next = queue.load(std::memory_order_relaxed);
+  while (!queue.compare_exchange_weak(task->m_next, task, std::memory_order_release,
+                                      std::memory_order_relaxed)) {
+  }
+}
+
+ThreadPool::Task *ThreadPool::reverseTasks(Task *list) {
+  Task *reversed = nullptr;
+  while (list) {
+    Task *next = list->m_next;
+    list->m_next = reversed;
+    reversed = list;
+    list = next;
+  }
+  return reversed;
+}
+
+int ThreadPool::genWorkerThreadSeqLocked(MutexGuard<Guarded> &guarded) {
+  const int seq = guarded->freeWorkerSeqs.back();
+  guarded->freeWorkerSeqs.pop_back();
+  return seq;
 }
 
 std::string ThreadPool::genWorkerThreadName(const int seq) {
@@ -135,10 +423,11 @@ std::string ThreadPool::genWorkerThreadName(const int seq) {
   return buf;
 }
 
-int ThreadPool::genSafeWorkerThreadMaxNum(const int num) {
-  const int numCPUs = getProcessorCoreCount();
-  const int numMax = numCPUs > 0 ? std::min(numCPUs, kWorkerThreadMaxNum) : kWorkerThreadMaxNum;
-  return num > 0 ? std::min(num, numMax) : numMax;
+int ThreadPool::genSafeWorkerThreadMaxNum(const int num) const {
+  // Only the automatic number follows the CPUs. An explicit one is capped by the slots, which the
+  // constructor makes for its own.
+  if (num <= 0) return std::max(static_cast<int>(m_cpus.size()), 1);
+  return std::min(num, m_numSlots);
 }
 
 int ThreadPool::genSafeWorkerThreadMinNum(const int num) {
@@ -153,4 +442,31 @@ int ThreadPool::genSafeWorkerThreadMaxSleepSeconds(const int seconds) {
   return seconds > 0 ? seconds : kWorkerThreadMaxSleepSeconds;
 }
 
+NumaThreadPool::NumaThreadPool(const ThreadPoolOptions &options)
+    : m_nodes(getNumaNodes()), m_nextPool(0) {
+  for (const NumaNode &node : m_nodes) {
+    ThreadPoolOptions nodeOptions = options;
+    nodeOptions.cpus = node.cpus;
+    m_pools.emplace_back(new ThreadPool(nodeOptions));
+    for (const int cpu : node.cpus) {
+      if (cpu >= static_cast<int>(m_nodeOfCpu.size())) m_nodeOfCpu.resize(cpu + 1, -1);
+      m_nodeOfCpu[cpu] = static_cast<int>(m_pools.size() - 1);
+    }
+  }
+}
+
+NumaThreadPool::~NumaThreadPool() noexcept(false) { shutdown(); }
+
+void NumaThreadPool::shutdown() {
+  for (auto &pool : m_pools) pool->shutdown();
+}
+
+ThreadPool &NumaThreadPool::getLocalPool() {
+  const int cpu = getCurrentCpu();
+  if (cpu >= 0 && cpu < static_cast<int>(m_nodeOfCpu.size()) && m_nodeOfCpu[cpu] >= 0) {
+    return *m_pools[m_nodeOfCpu[cpu]];
+  }
+  return *m_pools[m_nextPool.fetch_add(1, std::memory_order_relaxed) % m_pools.size()];
+}
+
 KFC_NAMESPACE_END
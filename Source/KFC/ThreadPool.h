@@ -1,30 +1,54 @@
 #pragma once
 
+#include "KFC/Async.h"
 #include "KFC/Condvar.h"
 #include "KFC/CopyMove.h"
+#include "KFC/Function.h"
 #include "KFC/Option.h"
+#include "KFC/Own.h"
 #include "KFC/Preclude.h"
+#include "KFC/System.h"
 #include "KFC/Thread.h"
+#include "KFC/WorkStealingDeque.h"
 
-#include <functional>
-#include <queue>
+#include <algorithm>
+#include <atomic>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
 
 KFC_NAMESPACE_BEG
 
 constexpr int kWorkerThreadMaxNumAuto = -1;
-constexpr int kWorkerThreadMaxNum = 5;
 constexpr int kWorkerThreadMinNum = 1;
 constexpr int kWorkerThreadMaxAge = 5;
 constexpr int kWorkerThreadMaxSleepSeconds = 60;
 
+struct ThreadPoolOptions {
+  // One worker per CPU of the pool by default. An explicit number is honored even beyond the CPU
+  // count, e.g. for tasks that block, and bounds `setWorkerThreadMaxNum` from then on.
+  int maxNumThreads = kWorkerThreadMaxNumAuto;
+  int minNumThreads = kWorkerThreadMinNum;
+  int maxAge = kWorkerThreadMaxAge;
+  int maxSleepSeconds = kWorkerThreadMaxSleepSeconds;
+  // The CPUs the workers run on, e.g. those of a NUMA node. By default all the CPUs the process may
+  // run on, and the workers are not bound.
+  std::vector<int> cpus;
+  // Bind each worker to a single CPU: worker `seq` to the `seq`-th of `cpus`, or of all the CPUs.
+  bool pinWorkers = false;
+};
+
+// Each worker has a work-stealing deque of its own: tasks submitted from a worker go to its deque,
+// which it pops in LIFO order, and idle workers steal the oldest tasks of the others, starting at a
+// random one. Tasks submitted from other threads go to a lock-free injection queue that workers
+// grab whole. The pool's mutex is only taken to spawn, park and retire workers, and to wake a
+// parked one when there is one.
 class ThreadPool {
 public:
   KFC_DISALLOW_COPY(ThreadPool)
   explicit ThreadPool(int maxNumThreads = kWorkerThreadMaxNumAuto,
                       int minNumThreads = kWorkerThreadMinNum, int maxAge = kWorkerThreadMaxAge,
                       int maxSleepSeconds = kWorkerThreadMaxSleepSeconds);
+  explicit ThreadPool(const ThreadPoolOptions &options);
   ~ThreadPool() noexcept(false);
 
   // Spawn a task that will be executed by a worker thread. `mandatory` means that the task
@@ -32,7 +56,103 @@ public:
   // will be executed before other tasks.
   template <class Func>
   void submit(Func &&f, const bool mandatory = true, const bool prior = false) {
-    submitTask(Task(std::forward<Func>(f), mandatory, prior));
+    submitTask(new Task(std::forward<Func>(f), mandatory, prior));
+  }
+
+  // Call `func` in a worker and return a promise for its result, exceptions included. The promise
+  // is fulfilled in the EventLoop of the calling thread, through its Executor, and neither side
+  // blocks. Dropping the promise doesn't stop `func`, only its result is dropped.
+  template <class Func> Promise<ReturnType<Func, void>> run(Func &&func, const bool prior = false) {
+    using T = ReturnType<Func, void>;
+    static_assert(std::is_same<typename _::ReducePromise<T>::Type, T>::value,
+                  "A worker has no EventLoop to wait on a Promise");
+    auto pair = createPromiseAndResolver<T>();
+    // The resolver is only moved off the loop's thread, its state is only touched in it while the
+    // loop lives. The task is mandatory, so that the resolver always comes back, or is dropped
+    // once its promise is gone. The executor stays in the task: the event may sit in the
+    // executor's queue, and must not keep the executor alive.
+    submit(
+        [func = std::forward<Func>(func), resolver = std::move(pair.resolver),
+         executor = getCurrentThreadExecutor()]() mutable {
+          _::PromiseResult<T> result;
+          KFC_IF_SOME(e, runCatchingExceptions([&] {
+                        result = _::PromiseResult<T>(FunctionCaller<T>::apply(func));
+                      })) {
+            result = _::PromiseResult<T>(std::move(e));
+          }
+          // Throws if the loop has exited, and the loop drops the event if it exits before running
+          // it: the result has nowhere to go then.
+          KFC_DISCARD(runCatchingExceptions([&] {
+            executor->executeDetached(
+                [resolver = std::move(resolver), result = std::move(result)]() mutable {
+                  resolver->resolve(std::move(result));
+                });
+          }));
+        },
+        true, prior);
+    return std::move(pair.promise);
+  }
+
+  // Call `func(i)` for each `i` in [begin, end) on the workers and return once all the calls are
+  // done, rethrowing the first exception thrown, after which the chunks not started yet are
+  // skipped. The range is cut in halves down to chunks of `grain` indices, by default about eight
+  // per worker: the halves go to the deque of the worker that cut them and idle workers steal them,
+  // so uneven chunks even out. The caller runs a chunk itself, and a caller that is a worker of the
+  // pool runs other tasks while it waits rather than blocking one of the workers.
+  template <class Func>
+  void parallelFor(const size_t begin, const size_t end, Func &&func, const size_t grain = 0) {
+    const Function<void(size_t, size_t)> body = [&func](const size_t first, const size_t last) {
+      for (size_t i = first; i < last; i++) func(i);
+    };
+    forkJoin(begin, end, grain, body);
+  }
+
+  // Reduce `map(i)` over [begin, end) with `reduce`, which must be associative, starting from
+  // `identity`; see `parallelFor`. The results are combined in the order of the indices, so
+  // `reduce` needn't be commutative and the result is that of the sequential loop.
+  template <class T, class Map, class Reduce>
+  T parallelReduce(const size_t begin, const size_t end, T identity, Map &&map, Reduce &&reduce,
+                   size_t grain = 0) {
+    if (begin >= end) return identity;
+    if (grain == 0) grain = genDefaultGrain(end - begin);
+    const size_t numChunks = (end - begin + grain - 1) / grain;
+    std::vector<Option<T>> partials(numChunks);
+    parallelFor(
+        0, numChunks,
+        [&](const size_t chunk) {
+          const size_t first = begin + chunk * grain;
+          const size_t last = std::min(first + grain, end);
+          T partial = identity;
+          for (size_t i = first; i < last; i++) partial = reduce(std::move(partial), map(i));
+          partials[chunk].emplace(std::move(partial));
+        },
+        1);
+    T result = std::move(identity);
+    for (Option<T> &partial : partials) {
+      result = reduce(std::move(result), std::move(partial.unwrap()));
+    }
+    return result;
+  }
+
+  // Hash the `size` bytes at `data` in chunks of `chunkSize` bytes, the last one possibly shorter,
+  // with `hash(const unsigned char *chunk, size_t size)`, and return the digests in the order of
+  // the chunks. For the verification of the pieces of a download, and any other digest that is
+  // computed per block.
+  template <class Hash>
+  auto parallelHashChunks(const void *data, const size_t size, const size_t chunkSize,
+                          Hash &&hash)
+      -> std::vector<decltype(hash(static_cast<const unsigned char *>(data), size))> {
+    KFC_CHECK(chunkSize > 0, "Chunks must not be empty");
+    const auto *bytes = static_cast<const unsigned char *>(data);
+    std::vector<decltype(hash(bytes, size))> digests((size + chunkSize - 1) / chunkSize);
+    parallelFor(
+        0, digests.size(),
+        [&](const size_t chunk) {
+          const size_t offset = chunk * chunkSize;
+          digests[chunk] = hash(bytes + offset, std::min(chunkSize, size - offset));
+        },
+        1);
+    return digests;
   }
 
   void shutdown();
@@ -43,12 +163,17 @@ public:
   void setWorkerThreadMaxSleepSeconds(int seconds);
 
 private:
-  class Task {
+  class Task final {
+  public:
+    // Freed tasks are cached by the thread that frees them, so a worker submitting tasks reuses
+    // those it has run.
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
+
   private:
-    using Func = std::function<void()>;
-    explicit Task() : m_func(nullptr), m_mandatory(true), m_prior(false) {}
+    using Func = Function<void()>;
     explicit Task(Func &&f, const bool mandatory = true, const bool prior = false)
-        : m_func(std::move(f)), m_mandatory(mandatory), m_prior(prior) {}
+        : m_func(std::move(f)), m_mandatory(mandatory), m_prior(prior), m_next(nullptr) {}
 
     void run() const { m_func(); }
     void shutdown() const {
@@ -58,49 +183,127 @@ private:
     Func m_func;
     bool m_mandatory;
     bool m_prior;
+    Task *m_next; // Link in an injection queue.
 
     friend class ThreadPool;
   };
+  using OwnTask = Own<Task, DeleteStaticDisposer<Task>>;
+
+  struct Worker {
+    explicit Worker(ThreadPool &pool, const int seq)
+        : pool(pool), random(0x9e3779b97f4a7c15ULL * (seq + 1)) {}
+
+    ThreadPool &pool;
+    WorkStealingDeque<Task *> deque; // Pushed and taken by the thread of this seq only.
+    uint64_t random;                 // State of the victim picker.
+  };
 
   struct Guarded {
-    std::deque<Task> queue;
     std::unordered_map<int, OwnThread> threads;
     Option<OwnThread> lastExitingThread;
 
-    int numThreads;
-    int numIdleThreads;
-    uint32_t freeWorkerSeqSet;
-    bool shutdown;
+    std::vector<int> freeWorkerSeqs; // The lowest last.
 
     int minNumThreads;
-    int maxNumThreads;
     int maxAge;
     int maxSleepSeconds;
+    // Parked workers notified but not back at work yet. They are as good as busy: a submit while
+    // they are on their way must wake another worker, or spawn one.
+    int numWakeups;
 
-    Guarded(const int maxNumThreads, const int minNumThreads, const int maxAge,
+    Guarded(const int numSeqs, const int minNumThreads, const int maxAge,
             const int maxSleepSeconds)
-        : numThreads(0), numIdleThreads(0), freeWorkerSeqSet((1U << maxNumThreads) - 1),
-          shutdown(false), minNumThreads(minNumThreads), maxNumThreads(maxNumThreads),
-          maxAge(maxAge), maxSleepSeconds(maxSleepSeconds) {}
+        : minNumThreads(minNumThreads), maxAge(maxAge), maxSleepSeconds(maxSleepSeconds),
+          numWakeups(0) {
+      for (int seq = numSeqs - 1; seq >= 0; seq--) freeWorkerSeqs.push_back(seq);
+    }
   };
 
   void runWorker(int seq);
-  void submitTask(Task &&task);
+  void submitTask(Task *task);
 
   /* Some helper methods */
 
-  static void enqueueTaskLocked(Task &&task, MutexGuard<Guarded> &guarded);
-  static Task dequeueTaskLocked(MutexGuard<Guarded> &guarded);
-  static bool isTaskQueueEmptyLocked(MutexGuard<Guarded> &guarded);
+  // Find a task for `worker`: a prior injected one, then one of its own, then an injected one, then
+  // one of another worker. Return nullptr if there is none.
+  Task *findTask(Worker &worker);
+  // Take the whole of an injection queue, keep its first task and push the rest to the deque of
+  // `worker`, waking another worker to steal them.
+  // `fifo` runs the tasks in the order they were submitted, otherwise the latest first.
+  Task *takeInjected(std::atomic<Task *> &queue, bool fifo, Worker &worker);
+  // Steal a task from another worker, waking one more worker if the victim has more left.
+  Task *stealTask(Worker &worker);
+  KFC_NODISCARD bool hasTask();
+  // Free the tasks left after the workers are gone, running the mandatory ones.
+  void drainLeftTasks();
+  void wakeOrSpawnWorker();
+  // Call `body` on chunks of at most `grain` indices that cover [begin, end), see `parallelFor`.
+  void forkJoin(size_t begin, size_t end, size_t grain, const Function<void(size_t, size_t)> &body);
+  struct Join;
+  // Cut [begin, end) in halves down to the grain of `join`, submitting the upper ones, then call
+  // the body on what is left.
+  void runRange(Join &join, size_t begin, size_t end);
+  KFC_NODISCARD size_t genDefaultGrain(size_t size) const;
+  static void pushInjected(std::atomic<Task *> &queue, Task *task);
+  static Task *reverseTasks(Task *list);
   static int genWorkerThreadSeqLocked(MutexGuard<Guarded> &guarded);
   static std::string genWorkerThreadName(int seq);
   static int genSafeWorkerThreadMinNum(int num);
-  static int genSafeWorkerThreadMaxNum(int num);
+  KFC_NODISCARD int genSafeWorkerThreadMaxNum(int num) const;
   static int genSafeWorkerThreadMaxAge(int age);
   static int genSafeWorkerThreadMaxSleepSeconds(int seconds);
 
+  static thread_local Worker *threadLocalWorker;
+
+  const std::vector<int> m_cpus;
+  const int m_numSlots; // The most workers the pool may ever have.
+  const bool m_bindWorkers;
+  const bool m_pinWorkers;
+  // LIFO stacks of the tasks submitted from outside the workers.
+  std::atomic<Task *> m_injected;
+  std::atomic<Task *> m_injectedPrior;
+  std::vector<Own<Worker, DeleteStaticDisposer<Worker>>> m_workers; // A slot per seq.
+  std::atomic<int> m_numThreads;     // Changed with the mutex held.
+  std::atomic<int> m_numIdleThreads; // Changed with the mutex held.
+  std::atomic<int> m_maxNumThreads;
+  std::atomic<bool> m_shutdown;
   Condvar m_condvar;
   Mutex<Guarded> m_guarded;
 };
 
+// A ThreadPool per NUMA node, with its workers bound to the CPUs of the node, so that tasks run
+// next to the memory of the thread that submitted them. A task submitted from a CPU of a node goes
+// to the pool of the node, one submitted from elsewhere to the pools in turn. Workers only steal
+// from the workers of their own node.
+class NumaThreadPool {
+public:
+  KFC_DISALLOW_COPY(NumaThreadPool)
+  // `options.maxNumThreads` and `minNumThreads` are per node, `options.cpus` is ignored.
+  explicit NumaThreadPool(const ThreadPoolOptions &options = {});
+  ~NumaThreadPool() noexcept(false);
+
+  template <class Func>
+  void submit(Func &&f, const bool mandatory = true, const bool prior = false) {
+    getLocalPool().submit(std::forward<Func>(f), mandatory, prior);
+  }
+
+  template <class Func> Promise<ReturnType<Func, void>> run(Func &&func, const bool prior = false) {
+    return getLocalPool().run(std::forward<Func>(func), prior);
+  }
+
+  void shutdown();
+
+  KFC_NODISCARD size_t getNodeCount() const { return m_nodes.size(); }
+  KFC_NODISCARD const NumaNode &getNode(const size_t index) const { return m_nodes[index]; }
+  ThreadPool &getPool(const size_t index) { return *m_pools[index]; }
+  // The pool of the node the current thread runs on.
+  ThreadPool &getLocalPool();
+
+private:
+  std::vector<NumaNode> m_nodes;
+  std::vector<Own<ThreadPool, DeleteStaticDisposer<ThreadPool>>> m_pools;
+  std::vector<int> m_nodeOfCpu; // Index of the pool of each CPU, -1 if none.
+  std::atomic<size_t> m_nextPool;
+};
+
 KFC_NAMESPACE_END
@@ -1,5 +1,11 @@
+#include "KFC/Sleep.h"
 #include "KFC/Testing.h"
 #include "KFC/ThreadPool.h"
+#include "KFC/WaitGroup.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
 
 KFC_NAMESPACE_BEG
 
@@ -63,4 +69,288 @@ TEST(ThreadPoolTest, AdderN) {
   EXPECT_EQ(n.load(), N);
 }
 
+TEST(ThreadPoolTest, NestedSubmit) {
+  // Tasks submitted by workers go to their own deques and are stolen by the others.
+  constexpr int N = 64;
+  std::atomic<int> n(0);
+  {
+    ThreadPool pool(4);
+    for (int i = 0; i < N; i++) {
+      pool.submit([&] {
+        for (int j = 0; j < N; j++) pool.submit([&] { n.fetch_add(1); });
+      });
+    }
+  }
+  EXPECT_EQ(n.load(), N * N);
+}
+
+TEST(ThreadPoolTest, Prior) {
+  std::mutex mutex;
+  std::vector<int> order;
+  std::atomic<bool> blocked(true);
+  {
+    ThreadPool pool(1);
+    pool.submit([&] {
+      while (blocked.load()) {
+      }
+    });
+    for (int i = 0; i < 3; i++) {
+      pool.submit([&, i] {
+        std::lock_guard<std::mutex> lock(mutex);
+        order.push_back(i);
+      });
+    }
+    pool.submit(
+        [&] {
+          std::lock_guard<std::mutex> lock(mutex);
+          order.push_back(-1);
+        },
+        true, true);
+    blocked.store(false);
+  }
+  EXPECT_EQ(order, std::vector<int>({-1, 0, 1, 2}));
+}
+
+TEST(ThreadPoolTest, Shutdown) {
+  // Only the mandatory tasks run once the pool is shutting down.
+  std::atomic<int> mandatory(0), optional(0);
+  std::atomic<bool> blocked(true);
+  ThreadPool pool(1);
+  pool.submit([&] {
+    while (blocked.load()) {
+    }
+  });
+  for (int i = 0; i < 10; i++) {
+    pool.submit([&] { mandatory.fetch_add(1); });
+    pool.submit([&] { optional.fetch_add(1); }, false);
+  }
+  OwnThread unblocker = Thread::spawn([&] {
+    KFC_SLEEP_US(50000);
+    blocked.store(false);
+  });
+  pool.shutdown();
+  unblocker = nullptr;
+  EXPECT_EQ(mandatory.load(), 10);
+  EXPECT_EQ(optional.load(), 0);
+
+  pool.submit([&] { mandatory.fetch_add(1); });
+  pool.submit([&] { optional.fetch_add(1); }, false);
+  EXPECT_EQ(mandatory.load(), 11);
+  EXPECT_EQ(optional.load(), 0);
+}
+
+TEST(ThreadPoolTest, PinWorkers) {
+  const std::vector<int> cpus = getAllowedCpus();
+  std::atomic<int> cpu(-2);
+  {
+    ThreadPoolOptions options;
+    options.maxNumThreads = 1;
+    options.cpus = {cpus.back()};
+    options.pinWorkers = true;
+    ThreadPool pool(options);
+    pool.submit([&] { cpu.store(getCurrentCpu()); });
+  }
+  EXPECT_EQ(cpu.load(), cpus.back());
+}
+
+TEST(ThreadPoolTest, ExplicitMaxNumThreads) {
+  // More workers than CPUs, all running at once: none of the tasks returns before they all started.
+  const int n = static_cast<int>(getAllowedCpus().size()) + 2;
+  std::atomic<int> started(0);
+  std::atomic<int> together(0);
+  {
+    ThreadPool pool(n);
+    for (int i = 0; i < n; i++) {
+      pool.submit([&] {
+        started.fetch_add(1);
+        for (int ms = 0; ms < 5000 && started.load() < n; ms++) KFC_SLEEP_US(1000);
+        if (started.load() == n) together.fetch_add(1);
+      });
+    }
+  }
+  EXPECT_EQ(together.load(), n);
+}
+
+TEST(ThreadPoolTest, SpreadsOverWorkers) {
+  constexpr int N = 4;
+  ThreadPool pool(N);
+  // A single worker, parked.
+  WaitGroup first;
+  first.add(1);
+  pool.submit([&] { first.done(); });
+  first.wait();
+  KFC_SLEEP_US(20 * 1000);
+
+  // The notified worker doesn't count as idle while it is on its way, so the others are spawned,
+  // and the batch it takes reaches them.
+  std::atomic<int> running(0);
+  std::atomic<int> peak(0);
+  WaitGroup wg;
+  wg.add(N);
+  for (int i = 0; i < N; i++) {
+    pool.submit([&] {
+      const int n = running.fetch_add(1) + 1;
+      int seen = peak.load();
+      while (n > seen && !peak.compare_exchange_weak(seen, n)) {
+      }
+      KFC_SLEEP_US(100 * 1000);
+      running.fetch_sub(1);
+      wg.done();
+    });
+  }
+  wg.wait();
+  EXPECT_EQ(peak.load(), N);
+}
+
+TEST(ThreadPoolTest, NumaThreadPool) {
+  constexpr int N = 42;
+  std::atomic<int> n(0);
+  {
+    NumaThreadPool pool;
+    EXPECT_GE(pool.getNodeCount(), 1u);
+    for (int i = 0; i < N; i++) {
+      pool.submit([&] { n.fetch_add(1); });
+    }
+  }
+  EXPECT_EQ(n.load(), N);
+}
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  EventLoop loop;                                                                                  \
+  WaitScope scope(loop)
+
+TEST(ThreadPoolTest, Run) {
+  SETUP_TEST_EVENT_LOOP;
+  ThreadPool pool(2);
+  const Thread::Id caller = Thread::current();
+  Promise<bool> promise =
+      pool.run([caller] { return Thread::current() == caller; }).then([&](const bool same) {
+        // Continuations run back in the caller's loop.
+        EXPECT_TRUE(Thread::current() == caller);
+        return same;
+      });
+  EXPECT_FALSE(promise.wait(scope));
+
+  bool ran = false;
+  pool.run([&] { ran = true; }).wait(scope);
+  EXPECT_TRUE(ran);
+}
+
+TEST(ThreadPoolTest, RunException) {
+  SETUP_TEST_EVENT_LOOP;
+  ThreadPool pool(1);
+  Promise<int> promise = pool.run([]() -> int {
+    KFC_THROW_FATAL(Exception::Kind::Logic, "failed in a worker");
+  });
+  EXPECT_THROW(promise.wait(scope), Exception);
+}
+
+TEST(ThreadPoolTest, RunDropped) {
+  SETUP_TEST_EVENT_LOOP;
+  std::atomic<int> n(0);
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 10; i++) {
+      KFC_DISCARD(pool.run([&] { return n.fetch_add(1); }));
+    }
+  }
+  EXPECT_EQ(n.load(), 10);
+  yield().wait(scope);
+}
+
+TEST(ThreadPoolTest, RunLoopDestroyed) {
+  ThreadPool pool(1);
+  std::atomic<bool> release(false);
+  std::atomic<bool> done(false);
+  {
+    // The loop is gone by the time the worker sends the result.
+    SETUP_TEST_EVENT_LOOP;
+    KFC_DISCARD(pool.run([&] {
+      while (!release.load()) KFC_SLEEP_US(1000);
+      return std::string(100, 'x');
+    }));
+  }
+  release.store(true);
+  {
+    // The loop is gone before it runs the event of the result, which it had queued.
+    SETUP_TEST_EVENT_LOOP;
+    KFC_DISCARD(pool.run([] { return std::string(100, 'y'); }));
+    // The worker runs the tasks in order, the result is sent before this one runs.
+    pool.submit([&] { done.store(true); });
+    while (!done.load()) KFC_SLEEP_US(1000);
+  }
+  SETUP_TEST_EVENT_LOOP;
+  EXPECT_EQ(pool.run([] { return 42; }).wait(scope), 42);
+}
+
+TEST(ThreadPoolTest, ParallelFor) {
+  constexpr size_t N = 100000;
+  std::vector<std::atomic<int>> seen(N);
+  ThreadPool pool(4);
+  pool.parallelFor(0, N, [&](const size_t i) { seen[i].fetch_add(1); });
+  for (size_t i = 0; i < N; i++) EXPECT_EQ(seen[i].load(), 1);
+  pool.parallelFor(5, 5, [&](size_t) { FAIL(); });
+}
+
+TEST(ThreadPoolTest, ParallelForInWorker) {
+  // A worker waiting for its own parallelFor runs the chunks instead of blocking.
+  std::atomic<int> n(0);
+  WaitGroup done(1);
+  ThreadPool pool(1);
+  pool.submit([&] {
+    pool.parallelFor(0, 1000, [&](size_t) { n.fetch_add(1); }, 10);
+    done.done();
+  });
+  done.wait();
+  EXPECT_EQ(n.load(), 1000);
+}
+
+TEST(ThreadPoolTest, ParallelForException) {
+  ThreadPool pool(2);
+  EXPECT_THROW(pool.parallelFor(0, 100,
+                                [](const size_t i) {
+                                  if (i == 42) {
+                                    KFC_THROW_FATAL(Exception::Kind::Logic, "failed at %zu", i);
+                                  }
+                                },
+                                1),
+               Exception);
+}
+
+TEST(ThreadPoolTest, ParallelReduce) {
+  ThreadPool pool(4);
+  const uint64_t sum = pool.parallelReduce(
+      1, 100001, uint64_t(0), [](const size_t i) { return uint64_t(i); },
+      [](const uint64_t a, const uint64_t b) { return a + b; });
+  EXPECT_EQ(sum, 5000050000ULL);
+
+  // Concatenation is associative but not commutative.
+  const std::string digits = pool.parallelReduce(
+      0, 100, std::string(), [](const size_t i) { return std::to_string(i % 10); },
+      [](std::string a, const std::string &b) { return a + b; }, 7);
+  std::string expected;
+  for (int i = 0; i < 100; i++) expected += std::to_string(i % 10);
+  EXPECT_EQ(digits, expected);
+}
+
+TEST(ThreadPoolTest, ParallelHashChunks) {
+  // FNV-1a.
+  auto hash = [](const unsigned char *data, const size_t size) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) h = (h ^ data[i]) * 1099511628211ULL;
+    return h;
+  };
+  std::vector<unsigned char> data(1000003);
+  for (size_t i = 0; i < data.size(); i++) data[i] = static_cast<unsigned char>(i * 31 + 7);
+
+  ThreadPool pool(4);
+  const std::vector<uint64_t> digests =
+      pool.parallelHashChunks(data.data(), data.size(), 4096, hash);
+  ASSERT_EQ(digests.size(), (data.size() + 4095) / 4096);
+  for (size_t i = 0; i < digests.size(); i++) {
+    const size_t offset = i * 4096;
+    EXPECT_EQ(digests[i], hash(data.data() + offset, std::min<size_t>(4096, data.size() - offset)));
+  }
+}
+
 KFC_NAMESPACE_END
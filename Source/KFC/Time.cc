@@ -51,12 +51,28 @@ Time::Time(const int64_t sec, const int64_t nsec) : m_utc(false) {
 Time Time::fromUnix(const int64_t sec, const int64_t nsec) { return Time(sec, nsec); }
 Time Time::after(const Duration elapse) { return now() + elapse; }
 Time Time::before(const Duration elapse) { return now() - elapse; }
+static thread_local TimeSource *threadLocalTimeSource = nullptr;
+
 Time Time::now() {
+  if (threadLocalTimeSource) return threadLocalTimeSource->now();
   Time t;
-  readNow(t);
+  readNow(t, Clock::Id::Monotonic);
   return t;
 }
 
+Time Time::preciseNow() {
+  if (threadLocalTimeSource) return threadLocalTimeSource->now();
+  Time t;
+  readNow(t, Clock::Id::PreciseMonotonic);
+  return t;
+}
+
+TimeSource *Time::setThreadSource(TimeSource *source) {
+  TimeSource *previous = threadLocalTimeSource;
+  threadLocalTimeSource = source;
+  return previous;
+}
+
 Duration Time::since(const Time t) { return now() - t; }
 Duration Time::until(const Time t) { return t - now(); }
 
@@ -125,14 +141,14 @@ bool Time::operator==(const Time &other) const {
 bool Time::operator>(const Time &other) const {
   if ((m_wall & other.m_wall & kHasMono) != 0) return m_ext > other.m_ext;
   const int64_t t_sec = sec();
-  const int64_t u_sec = other.nsec();
+  const int64_t u_sec = other.sec();
   return t_sec > u_sec || (t_sec == u_sec && nsec() > other.nsec());
 }
 
 bool Time::operator<(const Time &other) const {
   if ((m_wall & other.m_wall & kHasMono) != 0) return m_ext < other.m_ext;
   const int64_t t_sec = sec();
-  const int64_t u_sec = other.nsec();
+  const int64_t u_sec = other.sec();
   return t_sec < u_sec || (t_sec == u_sec && nsec() < other.nsec());
 }
 
@@ -283,9 +299,9 @@ size_t Time::formatRFC3339(const struct tm *tm, char *buf, size_t, const bool na
   return p - buf;
 }
 
-void Time::readNow(Time &t) {
+void Time::readNow(Time &t, const Clock::Id monoId) {
   const Clock::TimePoint tp_wall = Clock::real();
-  const Clock::TimePoint tp_mono = Clock::monotonic();
+  const Clock::TimePoint tp_mono = Clock::now(monoId);
   const int64_t mono = tp_mono.sec * 1000000000 + tp_mono.nsec;
   if (static_cast<uint64_t>(tp_wall.sec) >> 33) {
     // Seconds field overflowed the 33 bits available when storing a monotonic
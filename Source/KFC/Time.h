@@ -115,6 +115,16 @@ struct DateTime {
   char *zone_name;
 };
 
+class Time;
+
+// Where `Time::now` reads the time from in a thread, see `Time::setThreadSource`. It lets code run
+// against a simulated clock.
+class TimeSource {
+public:
+  virtual ~TimeSource() = default;
+  virtual Time now() = 0;
+};
+
 // The design of `Time` follows the Go's standard `time` library.
 // See https://github.com/golang/go/blob/master/src/time/time.go
 // because it can hold both the wall-time and the monotonic time.
@@ -132,6 +142,12 @@ public:
   static Time after(Duration elapse);
   static Time before(Duration elapse);
   static Time now();
+  // Like `now`, but reads the precise monotonic clock instead of the coarse one, which lags it by
+  // up to a jiffy. Both share an origin, so their times compare and subtract.
+  static Time preciseNow();
+  // Make `now` read the time from `source` in the calling thread, or from the system clocks again
+  // if it's null. Return the previous source.
+  static TimeSource *setThreadSource(TimeSource *source);
   static Duration since(Time t);
   static Duration until(Time t);
 
@@ -161,7 +177,7 @@ private:
   void stripMono();
   void TM(struct tm *tm) const;
   size_t formatRFC3339(const struct tm *tm, char *buf, size_t, bool nano) const;
-  static void readNow(Time &t);
+  static void readNow(Time &t, Clock::Id monoId);
 
   uint64_t m_wall;
   int64_t m_ext;
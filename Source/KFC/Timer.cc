@@ -1,51 +1,220 @@
 #include "KFC/Timer.h"
+#include "KFC/Bits.h"
+
+#include <algorithm>
 
 KFC_NAMESPACE_BEG
 
-Timer::Timer(const Time &time) : m_time(time) {}
+Timer::Timer(const Time &time)
+    : m_origin(time), m_time(time), m_tick(0), m_nextSeq(0), m_backgroundSlack(100_ms),
+      m_occupied(), m_earliest(nullptr), m_earliestKnown(true) {}
 
-Promise<void> Timer::atTime(Time time) {
-  return _::createAdaptedPromise<void, PromiseAdaptor>(*this, time);
+Promise<void> Timer::atTime(Time time, const Slack slack) {
+  if (slack == Slack::Background) time = alignBackground(time);
+  return _::createAdaptedPromise<void, PromiseAdaptor>(*this, time, slack == Slack::Precise);
 }
 
-Promise<void> Timer::afterDelay(const Duration delay) {
-  return _::createAdaptedPromise<void, PromiseAdaptor>(*this, m_time + delay);
+Promise<void> Timer::afterDelay(const Duration delay, const Slack slack) {
+  return atTime(m_time + delay, slack);
 }
 
 Option<Duration> Timer::advanceTo(const Time &time) {
   m_time = std::max(m_time, time);
+  const uint64_t target = tickOf(m_time);
   for (;;) {
-    auto it = m_events.begin();
-    if (it == m_events.end()) break;
-    Duration delay = (*it)->m_time - m_time;
-    if (delay > 0) {
-      return delay;
+    int level, slot;
+    if (!findFirst(level, slot)) {
+      // Only the overflow is left, bring it into the wheel once its block has come.
+      if (m_overflow.empty()) {
+        m_tick = std::max(m_tick, target);
+        break;
+      }
+      uint64_t first = UINT64_MAX;
+      for (PromiseAdaptor &event : m_overflow) first = std::min(first, event.m_tick);
+      const uint64_t tick = std::min(first, target);
+      const int shift = kLevels * kSlotBits;
+      const bool newBlock = (tick >> shift) != (m_tick >> shift);
+      m_tick = std::max(m_tick, tick);
+      if (newBlock) relink(m_overflow);
+      if (first > target) break;
+      continue;
+    }
+
+    // Nothing is due before the start of the slot, so the current tick can jump there.
+    const int shift = level * kSlotBits;
+    const uint64_t start = (m_tick >> (shift + kSlotBits) << (shift + kSlotBits)) |
+                           (static_cast<uint64_t>(slot) << shift);
+    if (start > target) {
+      m_tick = target;
+      break;
     }
-    (*it)->resolve();
+    m_tick = start;
+    if (level > 0) {
+      relink(m_slots[level][slot]);
+      continue;
+    }
+    expire(m_slots[0][slot], start < target);
+    if (start == target) break;
   }
+
+  KFC_IF_SOME_CONST(t, nextEvent()) { return t - m_time; }
   return None;
 }
 
-Timer::PromiseAdaptor::PromiseAdaptor(_::PromiseResolver<void> &resolver, Timer &timer, Time time)
-    : m_resolver(resolver), m_timer(timer), m_time(time) {
-  m_pos = m_timer.m_events.insert(this);
+Option<Time> Timer::nextEvent() const {
+  if (!m_earliestKnown) {
+    // The earliest event is in the first occupied slot, or in the overflow if the wheel is empty.
+    int level, slot;
+    const Slot &events = findFirst(level, slot) ? m_slots[level][slot] : m_overflow;
+    m_earliest = nullptr;
+    for (PromiseAdaptor &event : const_cast<Slot &>(events)) {
+      if (!m_earliest || PromiseAdaptor::before(event, *m_earliest)) m_earliest = &event;
+    }
+    m_earliestKnown = true;
+  }
+  if (!m_earliest) return None;
+  return m_earliest->m_time;
 }
 
-Timer::PromiseAdaptor::~PromiseAdaptor() noexcept(false) {
-  if (m_pos != m_timer.m_events.end()) {
-    m_timer.m_events.erase(m_pos);
+bool Timer::isNextEventPrecise() const {
+  KFC_DISCARD(nextEvent());
+  return m_earliest && m_earliest->m_precise;
+}
+
+Time Timer::alignBackground(const Time &time) const {
+  const int64_t slack = std::min((time - m_time).toNanoSeconds() / 8,
+                                 m_backgroundSlack.toNanoSeconds()) / kTickNs;
+  const int64_t ns = (time - m_origin).toNanoSeconds();
+  if (slack <= 0 || ns <= 0) return time;
+  // Aligning on powers of two makes the coarser boundaries a subset of the finer ones, so events
+  // of different delays still share wakeups.
+  const uint64_t align = 1ULL << (63 - countLeadingZeros64(static_cast<uint64_t>(slack)));
+  const uint64_t ticks = (static_cast<uint64_t>(ns) + kTickNs - 1) / kTickNs;
+  const uint64_t aligned = (ticks + align - 1) / align * align;
+  return m_origin + Duration(static_cast<int64_t>(aligned) * kTickNs);
+}
+
+uint64_t Timer::tickOf(const Time &time) const {
+  const int64_t ns = (time - m_origin).toNanoSeconds();
+  return ns > 0 ? static_cast<uint64_t>(ns / kTickNs) : 0;
+}
+
+void Timer::link(PromiseAdaptor &event) {
+  // The level is that of the highest group of bits where the tick differs from the current one:
+  // the event is in the current block of the level above, in a later slot of its level.
+  const uint64_t tick = std::max(event.m_tick, m_tick);
+  const uint64_t diff = tick ^ m_tick;
+  const int level = diff ? (63 - countLeadingZeros64(diff)) / kSlotBits : 0;
+  if (level >= kLevels) {
+    event.m_level = kOverflow;
+    m_overflow.add(event);
+    return;
+  }
+  event.m_level = level;
+  event.m_slot = static_cast<int>((tick >> (level * kSlotBits)) & (kSlots - 1));
+  m_slots[level][event.m_slot].add(event);
+  m_occupied[level] |= 1ULL << event.m_slot;
+}
+
+void Timer::unlink(PromiseAdaptor &event) {
+  Slot &slot = slotOf(event);
+  slot.remove(event);
+  if (event.m_level != kOverflow && slot.empty()) {
+    m_occupied[event.m_level] &= ~(1ULL << event.m_slot);
+  }
+  event.m_level = -1;
+}
+
+Timer::Slot &Timer::slotOf(const PromiseAdaptor &event) {
+  if (event.m_level == kOverflow) return m_overflow;
+  return m_slots[event.m_level][event.m_slot];
+}
+
+bool Timer::findFirst(int &level, int &slot) const {
+  for (level = 0; level < kLevels; ++level) {
+    // Slots before the current one are empty, their events are in the levels below.
+    const int current = static_cast<int>((m_tick >> (level * kSlotBits)) & (kSlots - 1));
+    const uint64_t occupied = m_occupied[level] & (~0ULL << current);
+    if (occupied) {
+      slot = countTrailingZeros64(occupied);
+      return true;
+    }
+  }
+  return false;
+}
+
+void Timer::relink(Slot &slot) {
+  m_expired.clear();
+  for (PromiseAdaptor &event : slot) m_expired.push_back(&event);
+  for (PromiseAdaptor *event : m_expired) {
+    unlink(*event);
+    link(*event);
+  }
+  m_expired.clear();
+}
+
+void Timer::expire(Slot &slot, const bool all) {
+  m_expired.clear();
+  for (PromiseAdaptor &event : slot) {
+    if (all || !(m_time < event.m_time)) m_expired.push_back(&event);
+  }
+  std::sort(m_expired.begin(), m_expired.end(),
+            [](const PromiseAdaptor *lhs, const PromiseAdaptor *rhs) {
+              return PromiseAdaptor::before(*lhs, *rhs);
+            });
+  for (PromiseAdaptor *event : m_expired) {
+    unlink(*event);
+    if (m_earliest == event) m_earliestKnown = false;
+    event->m_resolver.resolve();
+  }
+  m_expired.clear();
+}
+
+Timer::PromiseAdaptor::PromiseAdaptor(_::PromiseResolver<void> &resolver, Timer &timer, Time time,
+                                      const bool precise)
+    : m_resolver(resolver), m_timer(timer), m_time(time), m_tick(timer.tickOf(time)),
+      m_seq(timer.m_nextSeq++), m_level(-1), m_slot(0), m_precise(precise) {
+  m_timer.link(*this);
+  if (m_timer.m_earliestKnown && (!m_timer.m_earliest || before(*this, *m_timer.m_earliest))) {
+    m_timer.m_earliest = this;
   }
 }
 
-void Timer::PromiseAdaptor::resolve() {
-  m_resolver.resolve();
-  m_timer.m_events.erase(m_pos);
-  m_pos = m_timer.m_events.end();
+Timer::PromiseAdaptor::~PromiseAdaptor() noexcept(false) {
+  if (m_level < 0) return;
+  m_timer.unlink(*this);
+  if (m_timer.m_earliest == this) m_timer.m_earliestKnown = false;
+}
+
+static thread_local DeadlineScope *threadLocalDeadlineScope = nullptr;
+
+DeadlineScope::DeadlineScope(Timer &timer, const Duration budget)
+    : DeadlineScope(timer, timer.now() + budget) {}
+
+DeadlineScope::DeadlineScope(Timer &timer, const Time &deadline)
+    : m_timer(timer), m_deadline(deadline), m_outer(threadLocalDeadlineScope) {
+  if (m_outer) m_deadline = std::min(m_deadline, m_outer->m_deadline);
+  threadLocalDeadlineScope = this;
+}
+
+DeadlineScope::~DeadlineScope() noexcept(false) {
+  KFC_CHECK(threadLocalDeadlineScope == this, "DeadlineScopes must be destroyed in reverse order");
+  threadLocalDeadlineScope = m_outer;
+}
+
+Option<DeadlineScope &> DeadlineScope::current() {
+  if (!threadLocalDeadlineScope) return None;
+  return *threadLocalDeadlineScope;
+}
+
+Duration DeadlineScope::remaining() const {
+  return std::max(m_deadline - m_timer.now(), Duration(0));
 }
 
-bool Timer::PromiseAdaptorComparer::operator()(const PromiseAdaptor *lhs,
-                                               const PromiseAdaptor *rhs) const {
-  return lhs->m_time < rhs->m_time;
+bool Timer::PromiseAdaptor::before(const PromiseAdaptor &lhs, const PromiseAdaptor &rhs) {
+  if (lhs.m_time < rhs.m_time) return true;
+  if (rhs.m_time < lhs.m_time) return false;
+  return lhs.m_seq < rhs.m_seq;
 }
 
 KFC_NAMESPACE_END
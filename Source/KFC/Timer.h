@@ -1,47 +1,158 @@
 #pragma once
 
 #include "KFC/Async.h"
+#include "KFC/List.h"
 #include "KFC/Option.h"
 #include "KFC/Preclude.h"
 #include "KFC/Time.h"
 
-#include <set>
+#include <algorithm>
+#include <vector>
 
 KFC_NAMESPACE_BEG
 
+// Timer events are kept in a hierarchical timing wheel of 1 ms ticks: level 0 has a slot per tick
+// of the current 64 ms, and each level above has a slot per block of the level below, up to about
+// two years; events further away wait in an overflow list. Adding and canceling an event is O(1)
+// without allocation, and an event moves down at most once per level before it fires.
+//
+// Events fire at their exact time, not at the end of their tick, and in order of time, then of
+// creation.
 class Timer final {
 public:
+  // How late an event may fire, which lets the port wake up less often.
+  enum class Slack {
+    // The port wakes up at the exact time, with a timerfd where its wait is coarser, e.g. epoll's
+    // millisecond timeout. For pacing and other precision timers.
+    Precise,
+    // The port may wake up as late as its wait granularity.
+    Default,
+    // The event may fire up to an eighth of its delay late, at most the background slack. Its time
+    // is rounded up to a power-of-two number of ticks, so that background events line up on the
+    // same wakeups, e.g. periodic timeouts of many connections.
+    Background,
+  };
+
   explicit Timer(const Time &time);
+  KFC_DISALLOW_COPY_AND_MOVE(Timer)
+
+  // Fire the events due by `time` and return the delay until the next one, if any.
   Option<Duration> advanceTo(const Time &time);
-  Promise<void> atTime(Time time);
-  Promise<void> afterDelay(Duration delay);
+  // The time the timer has been advanced to, which `afterDelay` counts from.
+  KFC_NODISCARD Time now() const { return m_time; }
+  // Get the time of the earliest pending event, if any, without firing it.
+  KFC_NODISCARD Option<Time> nextEvent() const;
+  // Whether the earliest pending event is `Precise`.
+  KFC_NODISCARD bool isNextEventPrecise() const;
+  Promise<void> atTime(Time time, Slack slack = Slack::Default);
+  Promise<void> afterDelay(Duration delay, Slack slack = Slack::Default);
+  // Set the most a `Background` event may be delayed, 100 ms by default.
+  void setBackgroundSlack(Duration slack) { m_backgroundSlack = slack; }
 
 private:
-  class PromiseAdaptor;
-  struct PromiseAdaptorComparer {
-    bool operator()(const PromiseAdaptor *lhs, const PromiseAdaptor *rhs) const;
+  static constexpr int kSlotBits = 6;
+  static constexpr int kSlots = 1 << kSlotBits;
+  static constexpr int kLevels = 6;
+  static constexpr int kOverflow = kLevels; // The level of the events beyond the wheel.
+  static constexpr int64_t kTickNs = 1000000;
+
+  class PromiseAdaptor final {
+  public:
+    explicit PromiseAdaptor(_::PromiseResolver<void> &resolver, Timer &timer, Time time,
+                            bool precise);
+    ~PromiseAdaptor() noexcept(false);
+    KFC_DISALLOW_COPY_AND_MOVE(PromiseAdaptor)
+
+  private:
+    static bool before(const PromiseAdaptor &lhs, const PromiseAdaptor &rhs);
+
+    _::PromiseResolver<void> &m_resolver;
+    Timer &m_timer;
+    Time m_time;
+    uint64_t m_tick;
+    uint64_t m_seq; // Orders the events of the same time.
+    int m_level;    // -1 once the event has left the wheel.
+    int m_slot;
+    bool m_precise;
+    ListLink<PromiseAdaptor> m_link;
+
+    friend Timer;
   };
+  using Slot = List<PromiseAdaptor, &PromiseAdaptor::m_link>;
 
-  std::multiset<PromiseAdaptor *, PromiseAdaptorComparer> m_events;
-  Time m_time;
+  KFC_NODISCARD uint64_t tickOf(const Time &time) const;
+  // Round the time of a `Background` event up to line it up with the others.
+  KFC_NODISCARD Time alignBackground(const Time &time) const;
+  // Put an event in the slot of its tick relative to the current one, or take it out.
+  void link(PromiseAdaptor &event);
+  void unlink(PromiseAdaptor &event);
+  Slot &slotOf(const PromiseAdaptor &event);
+  // Find the first occupied slot, which holds the earliest events. Return false if the wheel is
+  // empty, overflow aside.
+  bool findFirst(int &level, int &slot) const;
+  // Move the events of a slot to the slots of their ticks, relative to the current one.
+  void relink(Slot &slot);
+  // Fire the events of a level-0 slot that are due by the current time.
+  void expire(Slot &slot, bool all);
 
-  friend PromiseAdaptor;
+  Time m_origin; // Tick 0.
+  Time m_time;
+  uint64_t m_tick;
+  uint64_t m_nextSeq;
+  Duration m_backgroundSlack;
+  Slot m_slots[kLevels][kSlots];
+  uint64_t m_occupied[kLevels]; // A bit per non-empty slot.
+  Slot m_overflow;
+  mutable PromiseAdaptor *m_earliest; // Cached by `nextEvent`, valid if `m_earliestKnown`.
+  mutable bool m_earliestKnown;
+  std::vector<PromiseAdaptor *> m_expired;
 };
 
-class Timer::PromiseAdaptor final {
+// Bounds the time of the operations started in the current thread while it is alive:
+// `Promise::timeoutAfter` and `timeoutAt` wait at most until its deadline, and
+// `Promise::withinDeadline` applies it to operations that have no timeout of their own. Scopes
+// nest, an inner scope can only shorten the deadline, so a request handler can give each step its
+// own budget without exceeding the request's.
+//
+// The scope only covers code that runs while it is on the stack. To carry the deadline into a
+// continuation, capture `deadline()` and open a new scope there.
+class DeadlineScope final {
 public:
-  explicit PromiseAdaptor(_::PromiseResolver<void> &resolver, Timer &timer, Time time);
-  ~PromiseAdaptor() noexcept(false);
-  void resolve();
+  explicit DeadlineScope(Timer &timer, Duration budget);
+  explicit DeadlineScope(Timer &timer, const Time &deadline);
+  ~DeadlineScope() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(DeadlineScope)
+
+  // The innermost scope of the current thread, if any.
+  static Option<DeadlineScope &> current();
+
+  KFC_NODISCARD Time deadline() const { return m_deadline; }
+  // The time left until the deadline, 0 once it has passed.
+  KFC_NODISCARD Duration remaining() const;
+  Timer &getTimer() { return m_timer; }
 
 private:
-  _::PromiseResolver<void> &m_resolver;
-  std::multiset<PromiseAdaptor *, PromiseAdaptorComparer>::iterator m_pos;
   Timer &m_timer;
-  Time m_time;
-
-  friend Timer;
-  friend PromiseAdaptorComparer;
+  Time m_deadline;
+  DeadlineScope *m_outer;
 };
 
+template <class T> Promise<T> Promise<T>::timeoutAfter(const Duration delay, Timer &timer) {
+  return timeoutAt(timer.now() + delay, timer);
+}
+
+template <class T> Promise<T> Promise<T>::timeoutAt(Time deadline, Timer &timer) {
+  if (isReady()) return std::move(*this);
+  KFC_IF_SOME(scope, DeadlineScope::current()) { deadline = std::min(deadline, scope.deadline()); }
+  return _::PromiseNode::to<Promise<T>>(new _::TimeoutPromiseNode<FixVoid<T>>(
+      _::PromiseNode::from(std::move(*this)), _::PromiseNode::from(timer.atTime(deadline))));
+}
+
+template <class T> Promise<T> Promise<T>::withinDeadline() {
+  KFC_IF_SOME(scope, DeadlineScope::current()) {
+    return timeoutAt(scope.deadline(), scope.getTimer());
+  }
+  return std::move(*this);
+}
+
 KFC_NAMESPACE_END
@@ -0,0 +1,173 @@
+#include "KFC/SimEventPort.h"
+#include "KFC/Testing.h"
+#include "KFC/Timer.h"
+
+#include <algorithm>
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  EventLoop loop;                                                                                  \
+  WaitScope scope(loop)
+
+TEST(TimerTest, ExactTime) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time(0));
+  Promise<void> p = timer.atTime(Time(500 * 1000));
+  // Not fired at the start of its tick.
+  EXPECT_EQ(timer.advanceTo(Time(400 * 1000)).unwrap(), 100_us);
+  EXPECT_EQ(timer.nextEvent().unwrap(), Time(500 * 1000));
+  EXPECT_TRUE(timer.advanceTo(Time(500 * 1000)).isNone());
+  EXPECT_TRUE(timer.nextEvent().isNone());
+  p.wait(scope);
+}
+
+TEST(TimerTest, PastEvent) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time(0) + 10_s);
+  Promise<void> p = timer.atTime(Time(0));
+  EXPECT_TRUE(timer.advanceTo(Time(0)).isNone());
+  p.wait(scope);
+}
+
+TEST(TimerTest, Cancel) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time(0));
+  std::vector<Promise<void>> promises;
+  for (int i = 1; i <= 1000; ++i) promises.push_back(timer.afterDelay(Duration::fromSecond(i)));
+  EXPECT_EQ(timer.nextEvent().unwrap(), Time(0) + 1_s);
+  // Drop the earliest half, the next event follows.
+  promises.erase(promises.begin(), promises.begin() + 500);
+  EXPECT_EQ(timer.nextEvent().unwrap(), Time(0) + 501_s);
+  EXPECT_EQ(timer.advanceTo(Time(0) + 500_s).unwrap(), 1_s);
+  promises.clear();
+  EXPECT_TRUE(timer.nextEvent().isNone());
+  EXPECT_TRUE(timer.advanceTo(Time(0) + 1000_s).isNone());
+}
+
+TEST(TimerTest, BeyondTheWheel) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time(0));
+  const Duration year = Duration::fromHour(365 * 24);
+  Promise<void> far = timer.afterDelay(year * 5);
+  Promise<void> near = timer.afterDelay(year * 3);
+  EXPECT_EQ(timer.nextEvent().unwrap(), Time(0) + year * 3);
+  EXPECT_EQ(timer.advanceTo(Time(0) + year * 2).unwrap(), year);
+  EXPECT_EQ(timer.advanceTo(Time(0) + year * 3).unwrap(), year * 2);
+  near.wait(scope);
+  EXPECT_TRUE(timer.advanceTo(Time(0) + year * 6).isNone());
+  far.wait(scope);
+}
+
+TEST(TimerTest, BackgroundSlack) {
+  SETUP_TEST_EVENT_LOOP;
+  Timer timer(Time(0));
+  // Slack of min(100 ms, delay / 8), aligned on 64 ms.
+  Promise<void> p1 = timer.afterDelay(1001_ms, Timer::Slack::Background);
+  Promise<void> p2 = timer.afterDelay(1020_ms, Timer::Slack::Background);
+  EXPECT_EQ(timer.nextEvent().unwrap(), Time(0) + 1024_ms);
+  EXPECT_FALSE(timer.isNextEventPrecise());
+  // Short delays are barely delayed, and a precise event goes first.
+  Promise<void> p3 = timer.afterDelay(5_ms, Timer::Slack::Background);
+  Promise<void> p4 = timer.afterDelay(3_ms, Timer::Slack::Precise);
+  EXPECT_TRUE(timer.isNextEventPrecise());
+  EXPECT_EQ(timer.advanceTo(Time(0) + 3_ms).unwrap(), 2_ms);
+  EXPECT_EQ(timer.advanceTo(Time(0) + 5_ms).unwrap(), 1019_ms);
+  EXPECT_TRUE(timer.advanceTo(Time(0) + 1024_ms).isNone());
+  joinPromises([&] {
+    std::vector<Promise<void>> promises;
+    for (Promise<void> *p : {&p1, &p2, &p3, &p4}) promises.push_back(std::move(*p));
+    return promises;
+  }()).wait(scope);
+}
+
+TEST(TimerTest, FiresInOrder) {
+  SimEventPort port(7);
+  EventLoop loop(port);
+  WaitScope scope(loop);
+  // Times spread from sub-millisecond to years apart, with duplicates, so events go through every
+  // level of the wheel and the overflow.
+  std::vector<Time> times;
+  for (int i = 0; i < 20000; ++i) {
+    const double r = port.random();
+    const int64_t ns = static_cast<int64_t>(r * r * r * r * 1e17) / 1000 * 1000;
+    times.push_back(Time(ns));
+  }
+  std::vector<int> fired;
+  std::vector<Promise<void>> promises;
+  for (int i = 0; i < static_cast<int>(times.size()); ++i) {
+    promises.push_back(port.getTimer().atTime(times[i]).then([&, i] { fired.push_back(i); }));
+  }
+  joinPromises(std::move(promises)).wait(scope);
+
+  std::vector<int> expected(times.size());
+  for (int i = 0; i < static_cast<int>(expected.size()); ++i) expected[i] = i;
+  std::stable_sort(expected.begin(), expected.end(),
+                   [&](const int lhs, const int rhs) { return times[lhs] < times[rhs]; });
+  EXPECT_EQ(fired, expected);
+}
+
+#define SETUP_SIM_EVENT_LOOP                                                                       \
+  SimEventPort port;                                                                               \
+  EventLoop loop(port);                                                                            \
+  WaitScope scope(loop);                                                                           \
+  Timer &timer = port.getTimer()
+
+TEST(TimerTest, TimeoutAfter) {
+  SETUP_SIM_EVENT_LOOP;
+  auto par = createPromiseAndResolver<int>();
+  const Time start = Time::now();
+  try {
+    par.promise.timeoutAfter(1_s, timer).wait(scope);
+    FAIL() << "Should have timed out";
+  } catch (const Exception &e) {
+    EXPECT_EQ(e.getKind(), Exception::Kind::Timeout);
+  }
+  EXPECT_EQ(Time::since(start), 1_s);
+}
+
+TEST(TimerTest, TimeoutNotReached) {
+  SETUP_SIM_EVENT_LOOP;
+  Promise<int> p = timer.afterDelay(1_s).then([] { return 42; }).timeoutAfter(2_s, timer);
+  EXPECT_EQ(p.wait(scope), 42);
+  // The timeout has been removed from the timer.
+  EXPECT_TRUE(timer.nextEvent().isNone());
+
+  // An error of the promise goes through, and a ready promise needs no timer.
+  Promise<void> failed = timer.afterDelay(1_s)
+                             .then([] { KFC_THROW_FATAL(Exception::Kind::Logic, "failed"); })
+                             .timeoutAfter(2_s, timer);
+  EXPECT_THROW(failed.wait(scope), Exception);
+  EXPECT_EQ(Promise<int>(7).timeoutAfter(1_s, timer).wait(scope), 7);
+  EXPECT_TRUE(timer.nextEvent().isNone());
+}
+
+TEST(TimerTest, DeadlineScope) {
+  SETUP_SIM_EVENT_LOOP;
+  const Time start = Time::now();
+  EXPECT_TRUE(DeadlineScope::current().isNone());
+  {
+    DeadlineScope outer(timer, 5_s);
+    {
+      // An inner scope can't extend the deadline.
+      DeadlineScope inner(timer, 10_s);
+      EXPECT_EQ(inner.deadline(), start + 5_s);
+      EXPECT_EQ(inner.remaining(), 5_s);
+      EXPECT_EQ(&DeadlineScope::current().unwrap(), &inner);
+    }
+    EXPECT_EQ(&DeadlineScope::current().unwrap(), &outer);
+    Promise<void> step = timer.afterDelay(Duration::fromHour(1)).timeoutAfter(1_m, timer);
+    Promise<void> rest = timer.afterDelay(Duration::fromHour(1)).withinDeadline();
+    EXPECT_THROW(step.wait(scope), Exception);
+    EXPECT_EQ(Time::since(start), 5_s);
+    EXPECT_THROW(rest.wait(scope), Exception);
+    EXPECT_EQ(outer.remaining(), 0);
+  }
+  EXPECT_TRUE(DeadlineScope::current().isNone());
+  // Without a scope, `withinDeadline` doesn't wait on the timer.
+  timer.afterDelay(1_s).withinDeadline().wait(scope);
+  EXPECT_EQ(Time::since(start), 6_s);
+}
+
+KFC_NAMESPACE_END
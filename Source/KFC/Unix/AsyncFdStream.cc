@@ -0,0 +1,230 @@
+#include "KFC/Unix/AsyncFdStream.h"
+
+#include "KFC/RunCatchingExceptions.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+KFC_NAMESPACE_BEG
+
+namespace {
+// The most pieces handed to a single `writev`.
+constexpr size_t kMaxWritePieces = 64;
+
+template <class T> Promise<T> syscallError(const char *call, const int err) {
+  return Promise<T>(_::PromiseResult<T>(
+      KFC_EXCEPTION(Exception::Kind::Syscall, "%s errno: %d", call, err)));
+}
+
+bool isWouldBlock(const int err) { return err == EAGAIN || err == EWOULDBLOCK; }
+} // namespace
+
+#ifdef __linux__
+// Moves bytes from one fd to another with `splice` through a pipe: input to pipe, then pipe to
+// output. The pipe is only refilled once it has been drained, so an EAGAIN always points at one
+// end, and at most a chunk is read ahead of the output. Like the generic pump, it is the adapter
+// of the returned promise and the event waiting for the fds.
+class AsyncFdStream::SplicePump final : public _::Event {
+public:
+  explicit SplicePump(_::PromiseResolver<uint64_t> &resolver, AsyncFdStream &input,
+                      AsyncFdStream &output, const uint64_t limit)
+      : m_resolver(resolver), m_input(input), m_output(output), m_limit(limit), m_done(0),
+        m_buffered(0), m_eof(false) {
+    armBreadthFirst();
+  }
+  ~SplicePump() noexcept(false) override = default;
+  KFC_DISALLOW_COPY_AND_MOVE(SplicePump)
+
+private:
+  Option<Own<Event>> fire() override {
+    if (m_wait) {
+      _::PromiseResult<Void> result;
+      m_wait->read(result);
+      m_wait = nullptr;
+      if (result.isErr()) {
+        m_resolver.resolve(std::move(result.unwrapErr()));
+        return None;
+      }
+    }
+    KFC_IF_SOME(e, runCatchingExceptions([&] { pump(); })) { m_resolver.resolve(std::move(e)); }
+    return None;
+  }
+
+  void pump() {
+    if (m_pipe[0] < 0) {
+      int fds[2];
+      KFC_CHECK_SYSCALL(pipe2(fds, O_NONBLOCK | O_CLOEXEC));
+      m_pipe[0] = fds[0];
+      m_pipe[1] = fds[1];
+    }
+    for (;;) {
+      if (m_buffered > 0) {
+        const ssize_t n = splice(m_pipe[0], nullptr, m_output.m_fd, nullptr, m_buffered,
+                                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+          const int err = errno;
+          if (err == EINTR) continue;
+          // The pipe has data, so the output is full.
+          if (isWouldBlock(err)) return wait(m_output.whenWritable());
+          KFC_THROW_FATAL(Exception::Kind::Syscall, "splice errno: %d", err);
+        }
+        m_buffered -= n;
+        m_done += n;
+        continue;
+      }
+      if (m_eof || m_done == m_limit) {
+        m_resolver.resolve(uint64_t(m_done));
+        return;
+      }
+      const size_t chunk = std::min<uint64_t>(m_limit - m_done, kAsyncPumpBufferSize);
+      const ssize_t n = splice(m_input.m_fd, nullptr, m_pipe[1], nullptr, chunk,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      if (n < 0) {
+        const int err = errno;
+        if (err == EINTR) continue;
+        // The pipe is empty, so the input is.
+        if (isWouldBlock(err)) return wait(m_input.whenReadable());
+        KFC_THROW_FATAL(Exception::Kind::Syscall, "splice errno: %d", err);
+      }
+      if (n == 0) m_eof = true;
+      m_buffered += n;
+    }
+  }
+
+  void wait(Promise<void> &&promise) {
+    m_wait = _::PromiseNode::from(std::move(promise));
+    m_wait->poll(this);
+  }
+
+  _::PromiseResolver<uint64_t> &m_resolver;
+  AsyncFdStream &m_input;
+  AsyncFdStream &m_output;
+  const uint64_t m_limit;
+  uint64_t m_done;     // Bytes written to the output.
+  size_t m_buffered;   // Bytes in the pipe.
+  bool m_eof;
+  OwnFd m_pipe[2];
+  _::OwnPromiseNode m_wait;
+};
+#endif
+
+AsyncFdStream::AsyncFdStream(UnixEventPort &port, OwnFd fd) : m_fd(std::move(fd)) {
+  struct stat st{};
+  KFC_CHECK_SYSCALL(fstat(m_fd, &st));
+  m_isSocket = S_ISSOCK(st.st_mode);
+  // Regular files are always ready, and epoll refuses them anyway.
+  if (S_ISREG(st.st_mode)) return;
+  const int flags = fcntl(m_fd, F_GETFL);
+  KFC_CHECK_SYSCALL(flags);
+  if (!(flags & O_NONBLOCK)) KFC_CHECK_SYSCALL(fcntl(m_fd, F_SETFL, flags | O_NONBLOCK));
+  m_observer.emplace(port, m_fd,
+                     static_cast<UnixEventPort::FdObserver::Flag>(
+                         UnixEventPort::FdObserver::Read | UnixEventPort::FdObserver::Write));
+}
+
+AsyncFdStream::~AsyncFdStream() noexcept(false) = default;
+
+void AsyncFdStream::shutdownWrite() { KFC_CHECK_SYSCALL(shutdown(m_fd, SHUT_WR)); }
+
+Promise<void> AsyncFdStream::whenReadable() { return m_observer.unwrap().whenBecomeReadable(); }
+
+Promise<void> AsyncFdStream::whenWritable() { return m_observer.unwrap().whenBecomeWritable(); }
+
+Promise<size_t> AsyncFdStream::tryRead(void *buffer, const size_t minBytes,
+                                       const size_t maxBytes) {
+  return tryReadInternal(static_cast<unsigned char *>(buffer), minBytes, maxBytes, 0);
+}
+
+Promise<size_t> AsyncFdStream::tryReadInternal(unsigned char *buffer, size_t minBytes,
+                                               size_t maxBytes, size_t alreadyRead) {
+  for (;;) {
+    const ssize_t n = ::read(m_fd, buffer, maxBytes);
+    if (n < 0) {
+      const int err = errno;
+      if (err == EINTR) continue;
+      if (!isWouldBlock(err)) return syscallError<size_t>("read", err);
+      if (minBytes == 0) return Promise<size_t>(alreadyRead);
+      return whenReadable().then([this, buffer, minBytes, maxBytes, alreadyRead] {
+        return tryReadInternal(buffer, minBytes, maxBytes, alreadyRead);
+      });
+    }
+    alreadyRead += n;
+    // A read of nothing is the end of the stream.
+    if (n == 0 || static_cast<size_t>(n) >= minBytes) return Promise<size_t>(alreadyRead);
+    buffer += n;
+    minBytes -= n;
+    maxBytes -= n;
+  }
+}
+
+Promise<void> AsyncFdStream::write(const void *buffer, const size_t size) {
+  return writeInternal({WritePiece{buffer, size}}, 0, 0);
+}
+
+Promise<void> AsyncFdStream::write(std::vector<WritePiece> pieces) {
+  return writeInternal(std::move(pieces), 0, 0);
+}
+
+Promise<void> AsyncFdStream::writeInternal(std::vector<WritePiece> pieces, size_t index,
+                                           size_t offset) {
+  for (;;) {
+    while (index < pieces.size() && offset == pieces[index].size) {
+      ++index;
+      offset = 0;
+    }
+    if (index == pieces.size()) return Promise<void>(Void());
+
+    struct iovec iov[kMaxWritePieces];
+    size_t count = 0;
+    for (size_t i = index; i < pieces.size() && count < kMaxWritePieces; ++i, ++count) {
+      const size_t skip = i == index ? offset : 0;
+      iov[count].iov_base =
+          const_cast<unsigned char *>(static_cast<const unsigned char *>(pieces[i].data) + skip);
+      iov[count].iov_len = pieces[i].size - skip;
+    }
+    ssize_t n;
+    if (m_isSocket) {
+      // Report a closed peer as EPIPE rather than raising SIGPIPE.
+      struct msghdr msg{};
+      msg.msg_iov = iov;
+      msg.msg_iovlen = count;
+      n = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+    } else {
+      n = writev(m_fd, iov, static_cast<int>(count));
+    }
+    if (n < 0) {
+      const int err = errno;
+      if (err == EINTR) continue;
+      if (!isWouldBlock(err)) return syscallError<void>("write", err);
+      return whenWritable().then([this, pieces = std::move(pieces), index, offset]() mutable {
+        return writeInternal(std::move(pieces), index, offset);
+      });
+    }
+    for (size_t left = n; left > 0;) {
+      const size_t rest = pieces[index].size - offset;
+      if (left < rest) {
+        offset += left;
+        break;
+      }
+      left -= rest;
+      ++index;
+      offset = 0;
+    }
+  }
+}
+
+Option<Promise<uint64_t>> AsyncFdStream::tryPumpFrom(AsyncInputStream &input,
+                                                     const uint64_t amount) {
+#ifdef __linux__
+  if (auto *fdInput = dynamic_cast<AsyncFdStream *>(&input)) {
+    return _::createAdaptedPromise<uint64_t, SplicePump>(*fdInput, *this, amount);
+  }
+#endif
+  return None;
+}
+
+KFC_NAMESPACE_END
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "KFC/AsyncStream.h"
+#include "KFC/Preclude.h"
+#include "KFC/Unix/EventPort.h"
+#include "KFC/Unix/OwnFd.h"
+
+KFC_NAMESPACE_BEG
+
+// An AsyncIoStream over a file descriptor: a socket, a pipe or a regular file. Sockets and pipes
+// are switched to non-blocking mode and waited for through an FdObserver of `port`; regular files
+// can't be polled and are read and written directly.
+//
+// Pumping from one AsyncFdStream to another, in either direction of `pumpTo`, moves the bytes with
+// `splice` through an intermediate pipe on Linux, so they never reach user space. The pipe bounds
+// how much is read ahead of the output.
+class AsyncFdStream final : public AsyncIoStream {
+public:
+  explicit AsyncFdStream(UnixEventPort &port, OwnFd fd);
+  ~AsyncFdStream() noexcept(false) override;
+  KFC_DISALLOW_COPY_AND_MOVE(AsyncFdStream)
+
+  KFC_NODISCARD int getFd() const { return m_fd; }
+  // Shut down the writing side of a socket, the peer reads the end of the stream.
+  void shutdownWrite();
+
+  Promise<size_t> tryRead(void *buffer, size_t minBytes, size_t maxBytes) override;
+  using AsyncOutputStream::write;
+  Promise<void> write(const void *buffer, size_t size) override;
+  Promise<void> write(std::vector<WritePiece> pieces) override;
+  Option<Promise<uint64_t>> tryPumpFrom(AsyncInputStream &input, uint64_t amount) override;
+
+private:
+  class SplicePump;
+
+  Promise<size_t> tryReadInternal(unsigned char *buffer, size_t minBytes, size_t maxBytes,
+                                  size_t alreadyRead);
+  // Write the pieces from `index` on, the first one starting at `offset`.
+  Promise<void> writeInternal(std::vector<WritePiece> pieces, size_t index, size_t offset);
+  Promise<void> whenReadable();
+  Promise<void> whenWritable();
+
+  OwnFd m_fd;
+  bool m_isSocket;
+  Option<UnixEventPort::FdObserver> m_observer; // None for regular files.
+};
+
+KFC_NAMESPACE_END
@@ -0,0 +1,160 @@
+#include "KFC/Testing.h"
+#include "KFC/Unix/AsyncFdStream.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+KFC_NAMESPACE_BEG
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  UnixEventPort port;                                                                              \
+  EventLoop loop(port);                                                                            \
+  WaitScope scope(loop)
+
+// An output stream collecting what is written, to exercise the generic pump.
+class StringOutputStream final : public AsyncOutputStream {
+public:
+  Promise<void> write(const void *buffer, const size_t size) override {
+    data.append(static_cast<const char *>(buffer), size);
+    return evaluateLater([] {});
+  }
+  Promise<void> write(std::vector<WritePiece> pieces) override {
+    for (const WritePiece &piece : pieces) {
+      data.append(static_cast<const char *>(piece.data), piece.size);
+    }
+    return Promise<void>(Void());
+  }
+  std::string data;
+};
+
+static void makePipe(int fds[2]) { KFC_CHECK_SYSCALL(pipe2(fds, O_CLOEXEC)); }
+
+static void makeSocketPair(int fds[2]) {
+  KFC_CHECK_SYSCALL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+}
+
+static std::string makeData(const size_t size) {
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) data[i] = static_cast<char>('a' + i % 26);
+  return data;
+}
+
+TEST(AsyncFdStreamTest, ReadWrite) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makeSocketPair(fds);
+  AsyncFdStream a(port, fds[0]), b(port, fds[1]);
+  a.write("hello", 5).wait(scope);
+  char buf[16];
+  EXPECT_EQ(b.read(buf, 5, sizeof(buf)).wait(scope), 5);
+  EXPECT_EQ(std::string(buf, 5), "hello");
+}
+
+TEST(AsyncFdStreamTest, ReadWaitsForMinBytes) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makePipe(fds);
+  AsyncFdStream in(port, fds[0]), out(port, fds[1]);
+  char buf[16];
+  Promise<size_t> read = in.read(buf, 6, sizeof(buf));
+  Promise<void> written = out.write("abc", 3).then([&] { return out.write("def", 3); });
+  written.wait(scope);
+  EXPECT_EQ(read.wait(scope), 6);
+  EXPECT_EQ(std::string(buf, 6), "abcdef");
+}
+
+TEST(AsyncFdStreamTest, Eof) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makeSocketPair(fds);
+  AsyncFdStream a(port, fds[0]), b(port, fds[1]);
+  a.write("ab", 2).wait(scope);
+  a.shutdownWrite();
+  char buf[16];
+  EXPECT_EQ(b.tryRead(buf, 4, sizeof(buf)).wait(scope), 2);
+  EXPECT_EQ(b.tryRead(buf, 1, sizeof(buf)).wait(scope), 0);
+  EXPECT_THROW(b.read(buf, 1, sizeof(buf)).wait(scope), Exception);
+}
+
+TEST(AsyncFdStreamTest, VectoredWriteWithBackpressure) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makeSocketPair(fds);
+  AsyncFdStream a(port, fds[0]), b(port, fds[1]);
+  // Larger than the socket buffers, the write has to wait for the reader.
+  const std::string data = makeData(4 << 20);
+  const size_t half = data.size() / 2;
+  Promise<void> written = a.write({{data.data(), half}, {data.data() + half, data.size() - half}});
+  std::string received(data.size(), '\0');
+  EXPECT_EQ(b.read(&received[0], data.size(), data.size()).wait(scope), data.size());
+  written.wait(scope);
+  EXPECT_EQ(received, data);
+}
+
+TEST(AsyncFdStreamTest, PumpSplice) {
+  SETUP_TEST_EVENT_LOOP;
+  int in[2], out[2];
+  makeSocketPair(in);
+  makeSocketPair(out);
+  AsyncFdStream source(port, in[0]), from(port, in[1]), to(port, out[0]), sink(port, out[1]);
+  const std::string data = makeData(1 << 20);
+  Promise<uint64_t> pumped = from.pumpTo(to);
+  Promise<void> written = source.write(data.data(), data.size()).then([&] {
+    source.shutdownWrite();
+  });
+  std::string received(data.size(), '\0');
+  EXPECT_EQ(sink.read(&received[0], data.size(), data.size()).wait(scope), data.size());
+  written.wait(scope);
+  EXPECT_EQ(pumped.wait(scope), data.size());
+  EXPECT_EQ(received, data);
+}
+
+TEST(AsyncFdStreamTest, PumpLimit) {
+  SETUP_TEST_EVENT_LOOP;
+  int in[2], out[2];
+  makePipe(in);
+  makePipe(out);
+  AsyncFdStream source(port, in[1]), from(port, in[0]), to(port, out[1]), sink(port, out[0]);
+  source.write("0123456789", 10).wait(scope);
+  EXPECT_EQ(from.pumpTo(to, 4).wait(scope), 4);
+  char buf[16];
+  EXPECT_EQ(sink.read(buf, 4, 4).wait(scope), 4);
+  EXPECT_EQ(std::string(buf, 4), "0123");
+  EXPECT_EQ(from.read(buf, 6, 6).wait(scope), 6);
+}
+
+TEST(AsyncFdStreamTest, PumpFileToGenericOutput) {
+  SETUP_TEST_EVENT_LOOP;
+  char path[] = "/tmp/KFCAsyncFdStreamTestXXXXXX";
+  const int fd = mkstemp(path);
+  KFC_CHECK_SYSCALL(fd);
+  KFC_CHECK_SYSCALL(unlink(path));
+  AsyncFdStream file(port, fd);
+  const std::string data = makeData(3 * kAsyncPumpBufferSize + 7);
+  file.write(data.data(), data.size()).wait(scope);
+  KFC_CHECK_SYSCALL(lseek(fd, 0, SEEK_SET));
+  StringOutputStream output;
+  EXPECT_EQ(file.pumpTo(output).wait(scope), data.size());
+  EXPECT_EQ(output.data, data);
+}
+
+TEST(AsyncFdStreamTest, DropPump) {
+  SETUP_TEST_EVENT_LOOP;
+  int in[2], out[2];
+  makePipe(in);
+  makePipe(out);
+  AsyncFdStream from(port, in[0]), to(port, out[1]);
+  KFC_DISCARD(from.pumpTo(to));
+  Promise<uint64_t> pumped = from.pumpTo(to);
+  // Let the pump start and wait for the input.
+  evaluateLater([] {}).wait(scope);
+  // Dropping a pending pump unregisters its wait.
+  pumped = Promise<uint64_t>(0);
+  KFC_CHECK_SYSCALL(write(in[1], "x", 1));
+  KFC_CHECK_SYSCALL(close(in[1]));
+  EXPECT_EQ(from.pumpTo(to).wait(scope), 1);
+}
+
+KFC_NAMESPACE_END
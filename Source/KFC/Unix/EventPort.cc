@@ -1,5 +1,13 @@
 #include "KFC/Unix/EventPort.h"
 #include <sys/fcntl.h>
+#include <unistd.h>
+
+#if KFC_USE_EPOLL
+#include <algorithm>
+#include <climits>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
 
 KFC_NAMESPACE_BEG
 
@@ -38,6 +46,13 @@ bool UnixEventPort::poll() {
   return doKqueueWait(pts);
 }
 
+bool UnixEventPort::tryPoll() {
+  const struct timespec zero = {0, 0};
+  const bool woken = doKqueueWait(&zero);
+  KFC_DISCARD(m_timer.advanceTo(Time::now()));
+  return woken;
+}
+
 bool UnixEventPort::doKqueueWait(const struct timespec *timeout) const {
   struct kevent events[16];
   int n = kevent(m_kqueueFd, nullptr, 0, events, sizeOf(events), timeout);
@@ -87,6 +102,7 @@ UnixEventPort::FdObserver::FdObserver(UnixEventPort &port, const int fd, const F
 }
 
 UnixEventPort::FdObserver::~FdObserver() noexcept(false) {
+  settleAll();
   struct kevent events[3];
   int n = 0;
   if (m_flags & Read) EV_SET(&events[n++], m_fd, EVFILT_READ, EV_DELETE, 0, 0, this);
@@ -104,48 +120,238 @@ void UnixEventPort::FdObserver::fire(const struct kevent *event) {
     // throwing an exception
   case EVFILT_READ:
     m_atEnd = !(event->flags & EV_EOF);
-    KFC_IF_SOME(r, m_readResolver) {
-      r->resolve();
-      m_readResolver = None;
-    }
+    settle(m_readWaiter);
     break;
   case EVFILT_WRITE:
-    KFC_IF_SOME(r, m_writeResolver) {
-      r->resolve();
-      m_writeResolver = None;
-    }
+    settle(m_writeWaiter);
     break;
   case EVFILT_EXCEPT:
-    KFC_IF_SOME(r, m_urgentResolver) {
-      r->resolve();
-      m_urgentResolver = None;
-    }
+    settle(m_urgentWaiter);
     break;
   }
 }
 
 #elif KFC_USE_EPOLL
+// Maximum number of events drained from the kernel per `epoll_wait`. Edge-triggered events that
+// don't fit are simply reported by the next call.
+static constexpr int kEpollMaxEvents = 128;
+
+UnixEventPort::UnixEventPort() : m_timer(Time::preciseNow()) {
+  const int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  KFC_CHECK_SYSCALL(epollFd);
+  m_epollFd = epollFd;
+
+  const int eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  KFC_CHECK_SYSCALL(eventFd);
+  m_eventFd = eventFd;
+
+  // The event fd is the only registration without an observer, it is told apart from the others
+  // by a null `data.ptr`.
+  struct epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;
+  KFC_CHECK_SYSCALL(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &event));
+}
+
+void UnixEventPort::wake() const {
+  const uint64_t one = 1;
+  ssize_t n;
+  do {
+    n = write(m_eventFd, &one, sizeof(one));
+  } while (n < 0 && errno == EINTR);
+  // EAGAIN means the counter is about to overflow, in which case the port is already woken.
+  if (n < 0 && errno != EAGAIN) {
+    KFC_THROW_FATAL(Exception::Syscall, "write(eventfd) errno: %d", errno);
+  }
+}
+
+bool UnixEventPort::poll() {
+  struct timespec ts, *pts = nullptr; // NOLINT(*-pro-type-member-init)
+  KFC_IF_SOME_CONST(t, m_timer.nextEvent()) {
+    const Duration delay = std::max(t - Time::preciseNow(), Duration(0));
+    if (delay > 0 && m_timer.isNextEventPrecise()) {
+      // Wait without a timeout, the timer fd ends the wait.
+      armTimerFd(t);
+    } else {
+      const Clock::TimePoint tp = delay.toTimePoint();
+      ts.tv_sec = tp.sec;
+      ts.tv_nsec = tp.nsec;
+      pts = &ts;
+    }
+  }
+  const bool woken = doEpollWait(pts);
+  // Fire the timers that expired while we were waiting, so that their events are queued by the
+  // time `poll` returns.
+  advanceTimer();
+  return woken;
+}
+
+bool UnixEventPort::tryPoll() {
+  const struct timespec zero = {0, 0};
+  const bool woken = doEpollWait(&zero);
+  advanceTimer();
+  return woken;
+}
+
+void UnixEventPort::advanceTimer() {
+  // The timer runs on the precise clock, the one the timer fd counts on, so that a `Precise`
+  // deadline has passed by the time the fd expires. The coarse clock lags it by up to a jiffy:
+  // `afterDelay` would count from that stale time, and the fd would expire before the timer saw its
+  // deadline.
+  KFC_DISCARD(m_timer.advanceTo(Time::preciseNow()));
+}
+
+void UnixEventPort::armTimerFd(const Time &time) {
+  if (m_timerFd < 0) {
+    const int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    KFC_CHECK_SYSCALL(timerFd);
+    m_timerFd = timerFd;
+    // Told apart from the observers by its address, like the event fd by a null `data.ptr`.
+    struct epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &m_timerFd;
+    KFC_CHECK_SYSCALL(epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_timerFd, &event));
+  }
+  // The fd stays armed across polls until the deadline changes, so a busy loop waiting on the same
+  // timer doesn't pay a syscall per turn. A stale deadline only causes a spurious wakeup.
+  KFC_IF_SOME_CONST(armed, m_timerFdArmed) {
+    if (armed == time) return;
+  }
+  // Arm at an absolute time, as the timer counts on CLOCK_MONOTONIC. The clock is read after the
+  // `now` that the delay is based on, so the deadline can only be late by the gap between the two
+  // reads, never early.
+  const Duration delay = time - Time::preciseNow();
+  const Clock::TimePoint mono = Clock::preciseMonotonic();
+  // A zero value would disarm the fd, a deadline in the past expires at once.
+  const int64_t deadline =
+      std::max<int64_t>(mono.sec * 1000000000 + mono.nsec + delay.toNanoSeconds(), 1);
+  struct itimerspec spec{};
+  spec.it_value.tv_sec = deadline / 1000000000;
+  spec.it_value.tv_nsec = deadline % 1000000000;
+  KFC_CHECK_SYSCALL(timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr));
+  m_timerFdArmed = time;
+}
+
+bool UnixEventPort::doEpollWait(const struct timespec *timeout) {
+  int timeoutMs = -1;
+  if (timeout) {
+    // Round up to the next millisecond so that we never wake up before the deadline and spin.
+    const int64_t ms = timeout->tv_sec * 1000 + (timeout->tv_nsec + 999999) / 1000000;
+    timeoutMs = static_cast<int>(std::min<int64_t>(ms, INT_MAX));
+  }
+
+  struct epoll_event events[kEpollMaxEvents];
+  int n;
+  do {
+    // The kernel interrupts the thread with EINTR for more than signals, e.g. when tearing down an
+    // io_uring instance the thread used. Only a wait with a timeout returns early on it, the caller
+    // re-evaluates the timers then; an indefinite wait would report a spurious wakeup instead.
+    n = epoll_wait(m_epollFd, events, kEpollMaxEvents, timeoutMs);
+  } while (n < 0 && errno == EINTR && timeoutMs < 0);
+  bool woken = false;
+
+  if (n < 0) {
+    const int err = errno;
+    if (err == EINTR) {
+      n = 0;
+    } else {
+      KFC_THROW_FATAL(Exception::Syscall, "epoll_wait errno: %d", err);
+    }
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (events[i].data.ptr == &m_timerFd) {
+      // The timer has expired, the caller fires it after the wait.
+      uint64_t expirations;
+      KFC_DISCARD(read(m_timerFd, &expirations, sizeof(expirations)));
+      m_timerFdArmed = None;
+    } else if (auto *observer = static_cast<FdObserver *>(events[i].data.ptr)) {
+      observer->fire(events + i);
+    } else {
+      // Reset the event fd counter, there's nothing to do if it has been reset by someone else.
+      uint64_t value;
+      KFC_DISCARD(read(m_eventFd, &value, sizeof(value)));
+      woken = true;
+    }
+  }
+  return woken;
+}
+
+UnixEventPort::FdObserver::FdObserver(UnixEventPort &port, const int fd, const Flag flags)
+    : m_port(port), m_fd(fd), m_flags(flags) {
+  struct epoll_event event{};
+  event.events = EPOLLET;
+  if (m_flags & Read) event.events |= EPOLLIN | EPOLLRDHUP;
+  if (m_flags & Write) event.events |= EPOLLOUT;
+  if (m_flags & Urgent) event.events |= EPOLLPRI;
+  event.data.ptr = this;
+  KFC_CHECK_SYSCALL(epoll_ctl(m_port.m_epollFd, EPOLL_CTL_ADD, m_fd, &event));
+}
+
+UnixEventPort::FdObserver::~FdObserver() noexcept(false) {
+  settleAll();
+  KFC_CHECK_SYSCALL(epoll_ctl(m_port.m_epollFd, EPOLL_CTL_DEL, m_fd, nullptr));
+}
+
+void UnixEventPort::FdObserver::fire(const struct epoll_event *event) {
+  const uint32_t events = event->events;
+  if (events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP | EPOLLERR)) {
+    // A hang-up or an error is reported as readable so that the reader sees EOF or the error from
+    // its next `read`.
+    m_atEnd = static_cast<bool>(events & (EPOLLHUP | EPOLLRDHUP));
+    settle(m_readWaiter);
+  }
+  if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+    settle(m_writeWaiter);
+  }
+  if (events & EPOLLPRI) {
+    settle(m_urgentWaiter);
+  }
+}
 #endif
 
 Promise<void> UnixEventPort::FdObserver::whenBecomeReadable() {
   KFC_CHECK(m_flags & Flag::Read, "FdObserver was not set to observe reads");
-  auto par = createPromiseAndResolver<void>();
-  m_readResolver = std::move(par.resolver);
-  return std::move(par.promise);
+  return wait(m_readWaiter);
 }
 
 Promise<void> UnixEventPort::FdObserver::whenBecomeWritable() {
   KFC_CHECK(m_flags & Flag::Write, "FdObserver was not set to observe writes");
-  auto par = createPromiseAndResolver<void>();
-  m_writeResolver = std::move(par.resolver);
-  return std::move(par.promise);
+  return wait(m_writeWaiter);
 }
 
 Promise<void> UnixEventPort::FdObserver::whenUrgentDataAvailable() {
   KFC_CHECK(m_flags & Flag::Urgent, "FdObserver was not set to observe urgent data");
-  auto par = createPromiseAndResolver<void>();
-  m_urgentResolver = std::move(par.resolver);
-  return std::move(par.promise);
+  return wait(m_urgentWaiter);
+}
+
+void UnixEventPort::FdObserver::settleAll() {
+  for (Option<Waiter &> *slot : {&m_readWaiter, &m_writeWaiter, &m_urgentWaiter}) {
+    settle(*slot, KFC_EXCEPTION(Exception::Kind::Logic, "FdObserver was destroyed"));
+  }
+}
+
+Promise<void> UnixEventPort::FdObserver::wait(Option<Waiter &> &slot) {
+  settle(slot, KFC_EXCEPTION(Exception::Kind::Logic, "Replaced by a newer wait on the same fd"));
+  return _::createAdaptedPromise<void, Waiter>(slot);
+}
+
+void UnixEventPort::FdObserver::settle(Option<Waiter &> &slot, _::PromiseResult<void> &&result) {
+  KFC_IF_SOME(w, slot) {
+    w.m_slot = nullptr;
+    slot = None;
+    w.m_resolver.resolve(std::move(result));
+  }
+}
+
+UnixEventPort::FdObserver::Waiter::Waiter(_::PromiseResolver<void> &resolver,
+                                          Option<Waiter &> &slot)
+    : m_resolver(resolver), m_slot(&slot) {
+  slot = *this;
+}
+
+UnixEventPort::FdObserver::Waiter::~Waiter() noexcept(false) {
+  if (m_slot) *m_slot = None;
 }
 
 Timer &UnixEventPort::getTimer() { return m_timer; }
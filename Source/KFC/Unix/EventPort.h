@@ -9,6 +9,7 @@
 #include <sys/event.h>
 #define KFC_USE_KQUEUE 1
 #elif defined(__linux__)
+#include <sys/epoll.h>
 #define KFC_USE_EPOLL 1
 #else
 #include <sys/poll.h>
@@ -22,6 +23,7 @@ public:
   class FdObserver;
   explicit UnixEventPort();
   bool poll() override;
+  bool tryPoll() override;
   void wake() const override;
   Timer &getTimer();
 
@@ -30,8 +32,17 @@ private:
   bool doKqueueWait(const struct timespec *timeout) const;
   OwnFd m_kqueueFd;
 #elif KFC_USE_EPOLL
-  bool doEpollWait(struct timespec *ts);
+  bool doEpollWait(const struct timespec *timeout);
+  // Arm the timer fd to wake the next wait at `time`.
+  void armTimerFd(const Time &time);
+  // Fire the timers that are due after a wait.
+  void advanceTimer();
   OwnFd m_epollFd;
+  OwnFd m_eventFd;
+  // Wakes up epoll for `Precise` timers, whose deadline the millisecond timeout of `epoll_wait`
+  // would miss. Created on the first of them.
+  OwnFd m_timerFd;
+  Option<Time> m_timerFdArmed;
 #endif
   Timer m_timer;
   friend FdObserver;
@@ -55,6 +66,7 @@ public:
 #if KFC_USE_KQUEUE
   void fire(const struct kevent *event);
 #elif KFC_USE_EPOLL
+  void fire(const struct epoll_event *event);
 #elif KFC_USE_POLL
 #endif
 
@@ -64,9 +76,29 @@ private:
   Flag m_flags;
   Option<bool> m_atEnd;
 
-  Option<Own<_::PromiseResolver<void>>> m_readResolver;
-  Option<Own<_::PromiseResolver<void>>> m_writeResolver;
-  Option<Own<_::PromiseResolver<void>>> m_urgentResolver;
+  // A pending wait. It is the adapter of the returned promise, so dropping the promise, directly
+  // or through a Canceler, unregisters the wait right away.
+  class Waiter;
+  Promise<void> wait(Option<Waiter &> &slot);
+  static void settle(Option<Waiter &> &slot, _::PromiseResult<void> &&result = Void{});
+  // Fail the pending waits, the observer is going away.
+  void settleAll();
+
+  Option<Waiter &> m_readWaiter;
+  Option<Waiter &> m_writeWaiter;
+  Option<Waiter &> m_urgentWaiter;
+};
+
+class UnixEventPort::FdObserver::Waiter final {
+public:
+  explicit Waiter(_::PromiseResolver<void> &resolver, Option<Waiter &> &slot);
+  ~Waiter() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(Waiter)
+
+private:
+  _::PromiseResolver<void> &m_resolver;
+  Option<Waiter &> *m_slot; // Null once resolved or once the observer is gone.
+  friend FdObserver;
 };
 
 KFC_NAMESPACE_END
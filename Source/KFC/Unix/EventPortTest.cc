@@ -34,4 +34,89 @@ TEST(UnixEventPortTest, ReadObserverAsync) {
   observer.whenBecomeReadable().wait(scope);
 }
 
+TEST(UnixEventPortTest, CancelReadObserver) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  KFC_CHECK_SYSCALL(pipe(fds));
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  UnixEventPort::FdObserver observer(port, rfd, UnixEventPort::FdObserver::Read);
+  Canceler canceler;
+  Promise<void> p = canceler.wrap(observer.whenBecomeReadable());
+  canceler.cancel("closing");
+  EXPECT_THROW(p.wait(scope), Exception);
+  // The canceled wait is gone from the observer, a new one is served as usual.
+  KFC_CHECK_SYSCALL(write(wfd, "abc", 3));
+  observer.whenBecomeReadable().wait(scope);
+}
+
+static Promise<void> spin(int &count, const int n) {
+  if (++count == n) return yield();
+  return evaluateLater([&count, n] { return spin(count, n); });
+}
+
+TEST(UnixEventPortTest, TurnBudget) {
+  SETUP_TEST_EVENT_LOOP;
+  loop.setTurnBudget(16);
+  int fds[2];
+  KFC_CHECK_SYSCALL(pipe(fds));
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  UnixEventPort::FdObserver observer(port, rfd, UnixEventPort::FdObserver::Read);
+  KFC_CHECK_SYSCALL(write(wfd, "abc", 3));
+  // Without a budget, the port would only be polled once the spinning chain is done.
+  int count = 0, countWhenReadable = -1;
+  std::vector<Promise<void>> promises;
+  promises.push_back(observer.whenBecomeReadable().then([&] { countWhenReadable = count; }));
+  promises.push_back(spin(count, 1000));
+  joinPromises(std::move(promises)).wait(scope);
+  EXPECT_GE(countWhenReadable, 0);
+  EXPECT_LT(countWhenReadable, 100);
+}
+
+TEST(UnixEventPortTest, WriteObserver) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  KFC_CHECK_SYSCALL(pipe(fds));
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  UnixEventPort::FdObserver observer(port, wfd, UnixEventPort::FdObserver::Write);
+  observer.whenBecomeWritable().wait(scope);
+}
+
+TEST(UnixEventPortTest, Wake) {
+  SETUP_TEST_EVENT_LOOP;
+  Thread t([&] {
+    KFC_SLEEP_US(100 * 1000);
+    port.wake();
+  });
+  EXPECT_TRUE(port.poll());
+}
+
+TEST(UnixEventPortTest, AfterDelay) {
+  SETUP_TEST_EVENT_LOOP;
+  // The delay counts from the timer's time, on the precise clock.
+  const Time start = port.getTimer().now();
+  port.getTimer().afterDelay(50_ms).wait(scope);
+  EXPECT_GE(Time::preciseNow() - start, 50_ms);
+}
+
+TEST(UnixEventPortTest, PreciseTimer) {
+  SETUP_TEST_EVENT_LOOP;
+  // Measured on the precise clock, `Time::now` only knows the time to a jiffy. A wait to the
+  // millisecond, e.g. epoll's timeout, would be late by up to a millisecond.
+  const auto nanos = [] {
+    const Clock::TimePoint tp = Clock::preciseMonotonic();
+    return tp.sec * 1000000000 + tp.nsec;
+  };
+  int late = 0;
+  for (int i = 0; i < 20; ++i) {
+    // Read before the deadline is set, so the lateness is an upper bound.
+    const int64_t deadline = nanos() + 1500000;
+    port.getTimer().atTime(Time::preciseNow() + 1500_us, Timer::Slack::Precise).wait(scope);
+    const int64_t lateness = nanos() - deadline;
+    EXPECT_GE(lateness, 0);
+    if (lateness > 500000) ++late;
+  }
+  // Leave room for a few preemptions on a loaded machine.
+  EXPECT_LE(late, 3);
+}
+
 KFC_NAMESPACE_END
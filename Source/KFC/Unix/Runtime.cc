@@ -0,0 +1,106 @@
+#include "KFC/Unix/Runtime.h"
+
+#include "KFC/RunCatchingExceptions.h"
+#include "KFC/System.h"
+
+#include <string>
+
+KFC_NAMESPACE_BEG
+
+namespace {
+thread_local int threadLocalShardIndex = -1;
+thread_local UnixEventPort *threadLocalShardPort = nullptr;
+} // namespace
+
+Runtime::Runtime(int shardCount, const bool pinThreads) {
+  const std::vector<int> cpus = getAllowedCpus();
+  if (shardCount <= 0) shardCount = static_cast<int>(cpus.size());
+
+  WaitGroup ready(shardCount);
+  m_shards.reserve(shardCount);
+  for (int i = 0; i < shardCount; ++i) {
+    Own<Shard, DeleteStaticDisposer<Shard>> shard = new Shard{i, None, None, None, None, None};
+    if (pinThreads) shard->cpu = cpus[i % cpus.size()];
+    Shard &ref = *shard;
+    m_shards.push_back(std::move(shard));
+    ref.thread = Thread::spawn([&ref, &ready] { runShard(ref, ready); },
+                               "shard-" + std::to_string(i));
+  }
+  ready.wait();
+
+  for (auto &shard : m_shards) {
+    if (shard->executor.isNone()) {
+      // A shard failed to start, joining its thread throws its exception.
+      shutdown();
+      KFC_THROW_FATAL(KFC::Exception::Kind::Logic, "Shard %d of the Runtime failed to start",
+                      shard->index);
+    }
+  }
+}
+
+Runtime::~Runtime() noexcept(false) { shutdown(); }
+
+int Runtime::getShardCount() const { return static_cast<int>(m_shards.size()); }
+
+int Runtime::shardOf(const uint64_t key) const {
+  // Fibonacci hashing: the high bits of the product depend on every bit of the key.
+  const uint64_t mixed = key * 0x9E3779B97F4A7C15ULL;
+  return static_cast<int>((mixed >> 32) % m_shards.size());
+}
+
+Option<int> Runtime::currentShard() {
+  if (threadLocalShardIndex < 0) return None;
+  return threadLocalShardIndex;
+}
+
+UnixEventPort &Runtime::currentPort() {
+  KFC_CHECK(threadLocalShardPort, "Runtime::currentPort() called outside of a shard");
+  return *threadLocalShardPort;
+}
+
+Runtime::Shard &Runtime::getShard(const int index) {
+  KFC_CHECK(index >= 0 && index < getShardCount(), "Shard index %d out of range [0, %d)", index,
+            getShardCount());
+  return *m_shards[index];
+}
+
+void Runtime::runShard(Shard &shard, WaitGroup &ready) {
+  KFC_IF_SOME(cpu, shard.cpu) { bindCurrentThread({cpu}); }
+
+  bool started = false;
+  Option<Exception> error = runCatchingExceptions([&] {
+    UnixEventPort port;
+    EventLoop loop(port);
+    WaitScope scope(loop);
+    auto stop = createPromiseAndResolver<void>();
+    shard.executor = loop.getExecutor();
+    shard.port = port;
+    shard.stop = std::move(stop.resolver);
+    threadLocalShardIndex = shard.index;
+    threadLocalShardPort = &port;
+    started = true;
+    ready.done();
+
+    stop.promise.wait(scope);
+
+    threadLocalShardIndex = -1;
+    threadLocalShardPort = nullptr;
+    shard.port = None;
+    shard.stop = None;
+  });
+  if (!started) ready.done();
+  KFC_IF_SOME(e, error) { throw std::move(e); }
+}
+
+void Runtime::shutdown() {
+  for (auto &shard : m_shards) {
+    if (shard->executor.isNone()) continue;
+    Shard &ref = *shard;
+    executeSync(ref.index, [&ref] {
+      KFC_IF_SOME(stop, ref.stop) { stop->resolve(); }
+    });
+  }
+  for (auto &shard : m_shards) shard->thread = None;
+}
+
+KFC_NAMESPACE_END
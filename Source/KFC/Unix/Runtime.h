@@ -0,0 +1,73 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/Preclude.h"
+#include "KFC/Thread.h"
+#include "KFC/Unix/EventPort.h"
+#include "KFC/WaitGroup.h"
+
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+constexpr int kRuntimeShardCountAuto = -1;
+
+// A thread-per-core runtime. Each shard is a thread named "shard-<index>" that runs its own
+// EventLoop on a UnixEventPort, optionally pinned to one CPU. State owned by a shard is only
+// touched by its thread and needs no lock; other threads reach it by sending functions to the
+// shard's Executor, which costs a queue push and at most one wake per turn of the target loop.
+//
+// Work is spread by key: `shardOf` maps a key, e.g. a task or connection id, to the shard that owns
+// it, so that everything about one key is handled by the same thread.
+class Runtime final {
+public:
+  // Start `shardCount` shards, by default one per CPU the process may run on. With `pinThreads`,
+  // shard `i` is bound to the `i`-th of those CPUs, wrapping around if there are more shards.
+  explicit Runtime(int shardCount = kRuntimeShardCountAuto, bool pinThreads = true);
+  // Stop the shards and join their threads. Events still queued on a shard fail, see below.
+  ~Runtime() noexcept(false);
+  KFC_DISALLOW_COPY_AND_MOVE(Runtime)
+
+  KFC_NODISCARD int getShardCount() const;
+  // The shard owning `key`. Keys are mixed before the modulo, so that sequential ids spread evenly.
+  KFC_NODISCARD int shardOf(uint64_t key) const;
+
+  // Run `func` on shard `index`. The returned promise resolves on the caller's EventLoop, so this
+  // is how shards message each other; a thread without an EventLoop uses `executeSync`.
+  //
+  // Once the destructor has stopped shard `index`, e.g. while another shard still runs, both
+  // throw a `Logic` exception, and what was queued before fails with one.
+  template <class Func> PromiseForResult<Func, void> executeAsync(int index, Func &&func) {
+    return getShard(index).executor.unwrap()->executeAsync(std::forward<Func>(func));
+  }
+  // Run `func` on shard `index` and block until it returns. Any thread may call it.
+  template <class Func> ReturnType<Func, void> executeSync(int index, Func &&func) {
+    return getShard(index).executor.unwrap()->executeSync(std::forward<Func>(func));
+  }
+
+  // The index of the shard running the calling thread, None outside of any Runtime.
+  static Option<int> currentShard();
+  // The UnixEventPort of the shard running the calling thread, to observe fds and set timers.
+  static UnixEventPort &currentPort();
+
+private:
+  struct Shard {
+    int index;
+    Option<int> cpu;
+    // Set by the shard's thread before the Runtime constructor returns, read-only afterwards. It
+    // outlives the shard's loop and refuses events once the loop is gone.
+    Option<Ref<Executor>> executor;
+    Option<UnixEventPort &> port;
+    Option<Own<_::PromiseResolver<void>>> stop;
+    Option<OwnThread> thread;
+  };
+
+  Shard &getShard(int index);
+  static void runShard(Shard &shard, WaitGroup &ready);
+  // Resolve the stop promise of every running shard, then join all threads.
+  void shutdown();
+
+  std::vector<Own<Shard, DeleteStaticDisposer<Shard>>> m_shards;
+};
+
+KFC_NAMESPACE_END
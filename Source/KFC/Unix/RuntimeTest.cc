@@ -0,0 +1,90 @@
+#include "KFC/RunCatchingExceptions.h"
+#include "KFC/Sleep.h"
+#include "KFC/Testing.h"
+#include "KFC/Unix/Runtime.h"
+
+#include <set>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+KFC_NAMESPACE_BEG
+
+TEST(RuntimeTest, Shards) {
+  Runtime runtime(4);
+  ASSERT_EQ(runtime.getShardCount(), 4);
+  EXPECT_EQ(Runtime::currentShard(), None);
+  for (int i = 0; i < runtime.getShardCount(); ++i) {
+    EXPECT_EQ(runtime.executeSync(i, [] { return Runtime::currentShard().unwrap(); }), i);
+    EXPECT_EQ(runtime.executeSync(i, [] { return getCurrentThreadName(); }),
+              "shard-" + std::to_string(i));
+  }
+}
+
+TEST(RuntimeTest, ShardOf) {
+  Runtime runtime(3, false);
+  std::set<int> used;
+  for (uint64_t key = 0; key < 64; ++key) {
+    const int shard = runtime.shardOf(key);
+    ASSERT_GE(shard, 0);
+    ASSERT_LT(shard, 3);
+    EXPECT_EQ(runtime.shardOf(key), shard);
+    used.insert(shard);
+  }
+  EXPECT_EQ(used.size(), 3U);
+}
+
+TEST(RuntimeTest, CrossShard) {
+  Runtime runtime(2, false);
+  EventLoop loop;
+  WaitScope scope(loop);
+  // Shard 0 messages shard 1 and finishes on its own loop once the answer is back.
+  auto askShard1 = [&] {
+    return runtime.executeAsync(1, [] { return Runtime::currentShard().unwrap() * 10; })
+        .then([](const int value) { return value + Runtime::currentShard().unwrap(); });
+  };
+  const int result = runtime.executeAsync(0, askShard1).wait(scope);
+  EXPECT_EQ(result, 10);
+}
+
+TEST(RuntimeTest, ShardTimer) {
+  Runtime runtime(1, false);
+  EventLoop loop;
+  WaitScope scope(loop);
+  const Time start = Time::now();
+  runtime.executeAsync(0, [] { return Runtime::currentPort().getTimer().afterDelay(10_ms); })
+      .wait(scope);
+  EXPECT_GE(Time::since(start), 10_ms);
+}
+
+TEST(RuntimeTest, StoppedShard) {
+  EventLoop loop;
+  WaitScope scope(loop);
+  Option<Promise<bool>> late;
+  {
+    Runtime runtime(2, false);
+    // Shard 1 runs this while the destructor stops shard 0, its own stop is queued behind it.
+    late.emplace(runtime.executeAsync(1, [&runtime] {
+      KFC_SLEEP_US(50 * 1000);
+      return runCatchingExceptions([&] { runtime.executeSync(0, [] {}); }).isSome();
+    }));
+  }
+  EXPECT_TRUE(late.unwrap().wait(scope));
+}
+
+#ifdef __linux__
+TEST(RuntimeTest, Pinned) {
+  Runtime runtime(2);
+  for (int i = 0; i < runtime.getShardCount(); ++i) {
+    EXPECT_EQ(runtime.executeSync(i, [] {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      pthread_getaffinity_np(pthread_self(), sizeof(set), &set);
+      return CPU_COUNT(&set);
+    }), 1);
+  }
+}
+#endif
+
+KFC_NAMESPACE_END
@@ -0,0 +1,495 @@
+#include "KFC/Unix/UringEventPort.h"
+
+#if KFC_USE_EPOLL
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+KFC_NAMESPACE_BEG
+
+// `user_data` of the completions that don't belong to an Op. Op pointers are never that small.
+static constexpr uint64_t kIgnoredTag = 0;
+static constexpr uint64_t kWakeTag = 1;
+
+static int uringSetup(const uint32_t entries, struct io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int uringEnter(const int fd, const uint32_t toSubmit, const uint32_t minComplete,
+                      const uint32_t flags, const void *arg, const size_t argSize) {
+  return static_cast<int>(
+      syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+template <class T> static T *ringPtr(void *ring, const uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+static int64_t resultOrErrno(const int64_t n) { return n < 0 ? -errno : n; }
+
+static int64_t checkResult(const int64_t res, const char *op) {
+  if (res < 0) {
+    throw KFC_EXCEPTION(Exception::Kind::Syscall, "%s errno: %d", op, static_cast<int>(-res));
+  }
+  return res;
+}
+
+// Resolves the promise of an Op when its completion is reaped, and cancels the Op when the
+// promise is dropped before that.
+class UringEventPort::OpAdapter {
+public:
+  explicit OpAdapter(_::PromiseResolver<int64_t> &resolver, UringEventPort &port, Op &op)
+      : m_resolver(resolver), m_port(port), m_op(&op) {
+    op.adapter = this;
+    m_port.submitOp(op);
+  }
+
+  ~OpAdapter() noexcept(false) {
+    if (!m_op) return;
+    m_op->adapter = nullptr;
+    m_port.submitCancel(*m_op);
+  }
+
+  KFC_DISALLOW_COPY_AND_MOVE(OpAdapter)
+
+private:
+  _::PromiseResolver<int64_t> &m_resolver;
+  UringEventPort &m_port;
+  Op *m_op;
+
+  friend UringEventPort;
+};
+
+// A reference to the shared observer of an fd, which is unregistered with its last reference.
+class UringEventPort::ObserverRef {
+public:
+  explicit ObserverRef(UringEventPort &port, const int fd) : m_port(port), m_fd(fd) {
+    SharedObserver &shared = m_port.m_observers[fd];
+    if (!shared.observer) {
+      constexpr auto kFlags =
+          static_cast<UnixEventPort::FdObserver::Flag>(UnixEventPort::FdObserver::Read |
+                                                       UnixEventPort::FdObserver::Write);
+      shared.observer = new UnixEventPort::FdObserver(m_port.m_fallback.unwrap(), fd, kFlags);
+    }
+    shared.refs++;
+  }
+
+  ~ObserverRef() noexcept(false) {
+    const auto it = m_port.m_observers.find(m_fd);
+    if (--it->second.refs == 0) m_port.m_observers.erase(it);
+  }
+
+  KFC_DISALLOW_COPY_AND_MOVE(ObserverRef)
+
+  UnixEventPort::FdObserver &get() { return *m_port.m_observers.at(m_fd).observer; }
+
+private:
+  UringEventPort &m_port;
+  const int m_fd;
+};
+
+template <class Func>
+Promise<int64_t> UringEventPort::retryWhenReady(const int fd,
+                                                const UnixEventPort::FdObserver::Flag flag,
+                                                Func func) {
+  using OwnObserverRef = Own<ObserverRef, DeleteStaticDisposer<ObserverRef>>;
+  int64_t res = func();
+  if (res != -EAGAIN && res != -EWOULDBLOCK) return Promise<int64_t>(std::move(res));
+
+  // The observer is edge-triggered and stays registered across the retries: `func` is always tried
+  // before waiting, so an edge reported while nobody waited isn't missed.
+  OwnObserverRef observer(new ObserverRef(*this, fd));
+  Promise<void> ready = flag == UnixEventPort::FdObserver::Read
+                            ? observer->get().whenBecomeReadable()
+                            : observer->get().whenBecomeWritable();
+  return ready.then([this, fd, flag, func = std::move(func),
+                     observer = std::move(observer)]() mutable {
+    return retryWhenReady(fd, flag, std::move(func));
+  });
+}
+
+UringEventPort::UringEventPort(const uint32_t entries, const bool tryUring)
+    : m_timer(Time::preciseNow()), m_wakeValue(0), m_sqRing(MAP_FAILED), m_cqRing(MAP_FAILED),
+      m_sqRingSize(0), m_cqRingSize(0), m_sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+      m_sqesSize(0), m_sqEntries(0), m_sqHead(nullptr), m_sqTail(nullptr), m_sqMask(nullptr),
+      m_sqArray(nullptr), m_cqHead(nullptr), m_cqTail(nullptr), m_cqMask(nullptr),
+      m_cqes(nullptr), m_sqLocalTail(0), m_sqSubmitted(0) {
+  struct io_uring_params params{};
+  const int ringFd = tryUring ? uringSetup(entries, &params) : -1;
+  // We need a single mmap for both rings and timeouts passed to `io_uring_enter`, both of which
+  // exist since Linux 5.11. Older kernels take the fallback.
+  constexpr uint32_t kRequiredFeatures = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG;
+  if (ringFd < 0 || (params.features & kRequiredFeatures) != kRequiredFeatures) {
+    if (ringFd >= 0) KFC_CHECK_SYSCALL(close(ringFd));
+    m_fallback.emplace();
+    return;
+  }
+  m_ringFd = ringFd;
+
+  m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+  m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  m_ringFd, IORING_OFF_SQ_RING);
+  KFC_CHECK(m_sqRing != MAP_FAILED, "mmap(IORING_OFF_SQ_RING) errno: %d", errno);
+  m_cqRing = m_sqRing;
+
+  m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  m_sqes = static_cast<struct io_uring_sqe *>(mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                                                   MAP_SHARED | MAP_POPULATE, m_ringFd,
+                                                   IORING_OFF_SQES));
+  KFC_CHECK(m_sqes != MAP_FAILED, "mmap(IORING_OFF_SQES) errno: %d", errno);
+
+  m_sqEntries = params.sq_entries;
+  m_sqHead = ringPtr<uint32_t>(m_sqRing, params.sq_off.head);
+  m_sqTail = ringPtr<uint32_t>(m_sqRing, params.sq_off.tail);
+  m_sqMask = ringPtr<uint32_t>(m_sqRing, params.sq_off.ring_mask);
+  m_sqArray = ringPtr<uint32_t>(m_sqRing, params.sq_off.array);
+  m_cqHead = ringPtr<uint32_t>(m_cqRing, params.cq_off.head);
+  m_cqTail = ringPtr<uint32_t>(m_cqRing, params.cq_off.tail);
+  m_cqMask = ringPtr<uint32_t>(m_cqRing, params.cq_off.ring_mask);
+  m_cqes = ringPtr<struct io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+  m_sqLocalTail = m_sqSubmitted = *m_sqTail;
+
+  // A blocking event fd, io_uring parks the read for us until `wake` writes to it.
+  const int eventFd = eventfd(0, EFD_CLOEXEC);
+  KFC_CHECK_SYSCALL(eventFd);
+  m_eventFd = eventFd;
+  submitWakeRead();
+}
+
+UringEventPort::~UringEventPort() noexcept(false) {
+  if (m_fallback) return;
+  cancelAll();
+  KFC_CHECK_SYSCALL(munmap(m_sqes, m_sqesSize));
+  KFC_CHECK_SYSCALL(munmap(m_sqRing, m_sqRingSize));
+}
+
+void UringEventPort::cancelAll() {
+  // Requests left in flight when the ring goes away are torn down by the kernel in the thread's
+  // task work, which interrupts the next blocking syscall of the thread with EINTR, and they may
+  // still write to their buffers meanwhile. Cancel them and reap their completions first.
+  for (Op &op : m_ops) {
+    if (op.adapter) op.adapter->m_op = nullptr;
+    op.adapter = nullptr;
+    submitCancel(op);
+  }
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = kWakeTag;
+  sqe->user_data = kIgnoredTag;
+
+  // A canceled request completes right away, unless it was already being performed, e.g. a write
+  // copying its data, which completes shortly after. Don't hang if the kernel disagrees.
+  bool wakeReadDone = false;
+  const Time deadline = Time::after(1_s);
+  while (!m_ops.empty() || !wakeReadDone) {
+    const Time now = Time::now();
+    if (!(now < deadline)) break;
+    enter(1, deadline - now);
+    uint32_t head = *m_cqHead;
+    const uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const struct io_uring_cqe &cqe = m_cqes[head & *m_cqMask];
+      if (cqe.user_data == kWakeTag) {
+        wakeReadDone = true;
+      } else if (cqe.user_data != kIgnoredTag) {
+        // Without an adapter, completing only frees the op.
+        complete(*reinterpret_cast<Op *>(cqe.user_data), cqe.res);
+      }
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  // Whatever is left is torn down with the ring, only its memory is ours to free.
+  while (!m_ops.empty()) {
+    Op &op = m_ops.front();
+    m_ops.remove(op);
+    delete &op;
+  }
+}
+
+bool UringEventPort::isUring() const { return m_fallback.isNone(); }
+
+Timer &UringEventPort::getTimer() {
+  KFC_IF_SOME(f, m_fallback) { return f.getTimer(); }
+  return m_timer;
+}
+
+void UringEventPort::wake() const {
+  KFC_IF_SOME_CONST(f, m_fallback) {
+    f.wake();
+    return;
+  }
+  const uint64_t one = 1;
+  ssize_t n;
+  do {
+    n = ::write(m_eventFd, &one, sizeof(one));
+  } while (n < 0 && errno == EINTR);
+  if (n < 0) KFC_THROW_FATAL(Exception::Syscall, "write(eventfd) errno: %d", errno);
+}
+
+bool UringEventPort::poll() {
+  KFC_IF_SOME(f, m_fallback) { return f.poll(); }
+  Option<Duration> timeout = None;
+  KFC_IF_SOME_CONST(t, m_timer.nextEvent()) {
+    timeout = std::max(t - Time::preciseNow(), Duration(0));
+  }
+  enter(1, timeout);
+  const bool woken = reap();
+  KFC_DISCARD(m_timer.advanceTo(Time::preciseNow()));
+  return woken;
+}
+
+bool UringEventPort::tryPoll() {
+  KFC_IF_SOME(f, m_fallback) { return f.tryPoll(); }
+  // Hand over the queued submissions, if any, and take whatever has completed without waiting.
+  if (m_sqLocalTail != m_sqSubmitted) enter(0, None);
+  const bool woken = reap();
+  KFC_DISCARD(m_timer.advanceTo(Time::preciseNow()));
+  return woken;
+}
+
+struct io_uring_sqe *UringEventPort::getSqe() {
+  if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) == m_sqEntries) {
+    // The queue is full, this is the only case we submit before `poll`.
+    enter(0, None);
+  }
+  struct io_uring_sqe *sqe = &m_sqes[m_sqLocalTail & *m_sqMask];
+  m_sqArray[m_sqLocalTail & *m_sqMask] = m_sqLocalTail & *m_sqMask;
+  m_sqLocalTail++;
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+UringEventPort::Op &UringEventPort::newOp(const short pollMask) {
+  Op *op = new Op();
+  op->pollMask = pollMask;
+  return *op;
+}
+
+Promise<int64_t> UringEventPort::submit(Op &op) {
+  return _::createAdaptedPromise<int64_t, OpAdapter>(*this, op);
+}
+
+void UringEventPort::submitOp(Op &op) {
+  if (!op.link.isLinked()) m_ops.add(op);
+  *getSqe() = op.sqe;
+  op.sqIndex = m_sqLocalTail - 1;
+  op.polling = false;
+}
+
+void UringEventPort::submitPoll(Op &op) {
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = op.sqe.fd;
+  sqe->poll32_events = op.pollMask;
+  sqe->user_data = op.sqe.user_data;
+  op.sqIndex = m_sqLocalTail - 1;
+  op.polling = true;
+}
+
+void UringEventPort::submitCancel(Op &op) {
+  if (m_sqLocalTail - op.sqIndex <= m_sqLocalTail - m_sqSubmitted) {
+    // The kernel hasn't seen the op yet. Turn it into a no-op rather than racing it with a cancel,
+    // a read could otherwise still consume data nobody is waiting for.
+    struct io_uring_sqe *sqe = &m_sqes[op.sqIndex & *m_sqMask];
+    const uint64_t userData = sqe->user_data;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = userData;
+    return;
+  }
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = op.sqe.user_data;
+  sqe->user_data = kIgnoredTag;
+}
+
+void UringEventPort::submitWakeRead() {
+  struct io_uring_sqe *sqe = getSqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = m_eventFd;
+  sqe->addr = reinterpret_cast<uint64_t>(&m_wakeValue);
+  sqe->len = sizeof(m_wakeValue);
+  sqe->user_data = kWakeTag;
+}
+
+void UringEventPort::enter(const uint32_t minComplete, const Option<Duration> &timeout) {
+  __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+  const uint32_t toSubmit = m_sqLocalTail - m_sqSubmitted;
+
+  struct __kernel_timespec ts{};
+  struct io_uring_getevents_arg arg{};
+  uint32_t flags = IORING_ENTER_EXT_ARG;
+  if (minComplete) flags |= IORING_ENTER_GETEVENTS;
+  KFC_IF_SOME_CONST(t, timeout) {
+    const Clock::TimePoint tp = t.toTimePoint();
+    ts.tv_sec = tp.sec;
+    ts.tv_nsec = tp.nsec;
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+  }
+
+  const int n = uringEnter(m_ringFd, toSubmit, minComplete, flags, &arg, sizeof(arg));
+  if (n < 0) {
+    const int err = errno;
+    // ETIME: the timeout expired, EINTR: a signal arrived, EBUSY: the completion queue overflowed
+    // and has to be reaped first. In all cases the caller reaps and tries again later.
+    if (err != ETIME && err != EINTR && err != EBUSY) {
+      KFC_THROW_FATAL(Exception::Syscall, "io_uring_enter errno: %d", err);
+    }
+    return;
+  }
+  m_sqSubmitted += n;
+}
+
+bool UringEventPort::reap() {
+  bool woken = false;
+  uint32_t head = *m_cqHead;
+  const uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; head++) {
+    const struct io_uring_cqe &cqe = m_cqes[head & *m_cqMask];
+    switch (cqe.user_data) {
+    case kIgnoredTag:
+      break;
+    case kWakeTag:
+      woken = true;
+      submitWakeRead();
+      break;
+    default:
+      complete(*reinterpret_cast<Op *>(cqe.user_data), cqe.res);
+      break;
+    }
+  }
+  __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+  return woken;
+}
+
+void UringEventPort::complete(Op &op, const int32_t res) {
+  if (op.adapter) {
+    if (op.polling && res >= 0) {
+      // The fd became ready, perform the operation again.
+      submitOp(op);
+      return;
+    }
+    if (!op.polling && op.pollMask && (res == -EAGAIN || res == -EINPROGRESS)) {
+      // A non-blocking fd wasn't ready, wait for it without blocking the ring.
+      submitPoll(op);
+      return;
+    }
+    op.adapter->m_op = nullptr;
+    op.adapter->m_resolver.resolve(static_cast<int64_t>(res));
+  }
+  m_ops.remove(op);
+  delete &op;
+}
+
+Promise<size_t> UringEventPort::read(const int fd, void *buf, const size_t size) {
+  Promise<int64_t> promise = [&] {
+    if (m_fallback) {
+      return retryWhenReady(fd, UnixEventPort::FdObserver::Read,
+                            [=] { return resultOrErrno(::read(fd, buf, size)); });
+    }
+    Op &op = newOp(POLLIN);
+    op.sqe.opcode = IORING_OP_READ;
+    op.sqe.fd = fd;
+    op.sqe.addr = reinterpret_cast<uint64_t>(buf);
+    op.sqe.len = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+    op.sqe.off = static_cast<uint64_t>(-1); // Use and advance the file position.
+    op.sqe.user_data = reinterpret_cast<uint64_t>(&op);
+    return submit(op);
+  }();
+  return promise.then(
+      [](const int64_t res) { return static_cast<size_t>(checkResult(res, "read")); });
+}
+
+Promise<size_t> UringEventPort::write(const int fd, const void *buf, const size_t size) {
+  Promise<int64_t> promise = [&] {
+    if (m_fallback) {
+      return retryWhenReady(fd, UnixEventPort::FdObserver::Write,
+                            [=] { return resultOrErrno(::write(fd, buf, size)); });
+    }
+    Op &op = newOp(POLLOUT);
+    op.sqe.opcode = IORING_OP_WRITE;
+    op.sqe.fd = fd;
+    op.sqe.addr = reinterpret_cast<uint64_t>(buf);
+    op.sqe.len = static_cast<uint32_t>(std::min<size_t>(size, UINT32_MAX));
+    op.sqe.off = static_cast<uint64_t>(-1);
+    op.sqe.user_data = reinterpret_cast<uint64_t>(&op);
+    return submit(op);
+  }();
+  return promise.then(
+      [](const int64_t res) { return static_cast<size_t>(checkResult(res, "write")); });
+}
+
+Promise<int> UringEventPort::accept(const int fd) {
+  constexpr int kFlags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  Promise<int64_t> promise = [&] {
+    if (m_fallback) {
+      return retryWhenReady(fd, UnixEventPort::FdObserver::Read, [=] {
+        return resultOrErrno(accept4(fd, nullptr, nullptr, kFlags));
+      });
+    }
+    Op &op = newOp(POLLIN);
+    op.sqe.opcode = IORING_OP_ACCEPT;
+    op.sqe.fd = fd;
+    op.sqe.accept_flags = kFlags;
+    op.sqe.user_data = reinterpret_cast<uint64_t>(&op);
+    return submit(op);
+  }();
+  return promise.then(
+      [](const int64_t res) { return static_cast<int>(checkResult(res, "accept")); });
+}
+
+Promise<void> UringEventPort::connect(const int fd, const struct sockaddr *addr,
+                                      const socklen_t addrLen) {
+  KFC_CHECK(addrLen <= sizeof(struct sockaddr_storage), "Address is too long: %u", addrLen);
+  Promise<int64_t> promise = [&] {
+    if (m_fallback) {
+      int64_t res = resultOrErrno(::connect(fd, addr, addrLen));
+      if (res != -EINPROGRESS) return Promise<int64_t>(std::move(res));
+      return retryWhenReady(fd, UnixEventPort::FdObserver::Write, [fd]() -> int64_t {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) return -errno;
+        return -err;
+      });
+    }
+    Op &op = newOp(POLLOUT);
+    std::memcpy(&op.addr, addr, addrLen);
+    op.sqe.opcode = IORING_OP_CONNECT;
+    op.sqe.fd = fd;
+    op.sqe.addr = reinterpret_cast<uint64_t>(&op.addr);
+    op.sqe.off = addrLen;
+    op.sqe.user_data = reinterpret_cast<uint64_t>(&op);
+    return submit(op);
+  }();
+  return promise.then([](const int64_t res) {
+    // Connecting again after the socket became writable reports EISCONN on success.
+    if (res != -EISCONN) checkResult(res, "connect");
+  });
+}
+
+Promise<void> UringEventPort::afterDelay(const Duration delay) {
+  KFC_IF_SOME(f, m_fallback) { return f.getTimer().afterDelay(delay); }
+  Op &op = newOp(0);
+  const Clock::TimePoint tp = std::max(delay, Duration(0)).toTimePoint();
+  op.ts.tv_sec = tp.sec;
+  op.ts.tv_nsec = tp.nsec;
+  op.sqe.opcode = IORING_OP_TIMEOUT;
+  op.sqe.addr = reinterpret_cast<uint64_t>(&op.ts);
+  op.sqe.len = 1;
+  op.sqe.user_data = reinterpret_cast<uint64_t>(&op);
+  return submit(op).then([](const int64_t res) {
+    // An expired timeout completes with ETIME.
+    if (res != -ETIME) checkResult(res, "timeout");
+  });
+}
+
+KFC_NAMESPACE_END
+#endif
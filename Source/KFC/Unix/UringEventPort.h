@@ -0,0 +1,128 @@
+#pragma once
+
+#include "KFC/Async.h"
+#include "KFC/List.h"
+#include "KFC/Preclude.h"
+#include "KFC/Timer.h"
+#include "KFC/Unix/EventPort.h"
+#include "KFC/Unix/OwnFd.h"
+
+#if KFC_USE_EPOLL
+#include <linux/io_uring.h>
+#include <sys/socket.h>
+#include <unordered_map>
+
+KFC_NAMESPACE_BEG
+
+constexpr uint32_t kUringDefaultEntries = 256;
+
+// An EventPort backed by io_uring. Unlike UnixEventPort, which only reports readiness and leaves
+// the syscall to the caller, operations are handed to the kernel as a whole and the returned
+// promises are resolved from their completions. Submissions are queued in the ring and handed to
+// the kernel by a single `io_uring_enter` in `poll`, so a loop turn costs one syscall no matter how
+// many operations it starts.
+//
+// When io_uring is not available (old kernels, seccomp), the port falls back to a UnixEventPort
+// and performs the same operations on readiness. Fds passed to the port should therefore be
+// non-blocking, which is also what io_uring prefers for sockets.
+class UringEventPort final : public EventPort {
+public:
+  // `entries` is the size of the submission queue. Pass `tryUring = false` to use the fallback
+  // unconditionally.
+  explicit UringEventPort(uint32_t entries = kUringDefaultEntries, bool tryUring = true);
+  ~UringEventPort() noexcept(false) override;
+  KFC_DISALLOW_COPY_AND_MOVE(UringEventPort)
+
+  bool poll() override;
+  bool tryPoll() override;
+  void wake() const override;
+  Timer &getTimer();
+  // Whether operations go through io_uring rather than the epoll fallback.
+  KFC_NODISCARD bool isUring() const;
+
+  // Buffers and addresses must stay valid until the returned promise resolves. Dropping the
+  // promise cancels the operation, but the kernel may still touch the buffer until the port is
+  // polled again.
+  Promise<size_t> read(int fd, void *buf, size_t size);
+  Promise<size_t> write(int fd, const void *buf, size_t size);
+  // Accept a connection. The accepted fd is non-blocking and close-on-exec, the caller owns it.
+  Promise<int> accept(int fd);
+  Promise<void> connect(int fd, const struct sockaddr *addr, socklen_t addrLen);
+  Promise<void> afterDelay(Duration delay);
+
+private:
+  class OpAdapter;
+  class ObserverRef;
+
+  // An in-flight operation. It is owned by the port rather than by the promise, so that a dropped
+  // promise leaves a valid `user_data` behind until the kernel reports the cancellation.
+  struct Op {
+    ListLink<Op> link;
+    OpAdapter *adapter;            // Null once the promise has been dropped.
+    struct io_uring_sqe sqe;       // Kept to resubmit the operation after a readiness poll.
+    struct __kernel_timespec ts;   // Storage for timeouts.
+    struct sockaddr_storage addr;  // Storage for connects.
+    uint32_t sqIndex;              // Queue position of the latest entry submitted for the op.
+    short pollMask;                // Readiness to wait for if the fd reports EAGAIN.
+    bool polling;
+  };
+
+  // Get a zeroed submission entry, flushing the queue to the kernel if it is full.
+  struct io_uring_sqe *getSqe();
+  static Op &newOp(short pollMask);
+  // Queue an operation and return a promise for its raw result, a negative errno on failure.
+  Promise<int64_t> submit(Op &op);
+  void submitOp(Op &op);
+  void submitPoll(Op &op);
+  void submitCancel(Op &op);
+  void submitWakeRead();
+  // Hand queued submissions to the kernel and wait for at least `minComplete` completions.
+  void enter(uint32_t minComplete, const Option<Duration> &timeout);
+  // Consume all available completions. Return true if `wake` was called.
+  bool reap();
+  // Cancel the operations in flight, the wake read included, and wait for their completions.
+  void cancelAll();
+  void complete(Op &op, int32_t res);
+  // Perform `func` each time `fd` becomes ready for `flag`, until it stops failing with EAGAIN.
+  // This is how the fallback emulates a completion with a readiness-based port.
+  template <class Func>
+  Promise<int64_t> retryWhenReady(int fd, UnixEventPort::FdObserver::Flag flag, Func func);
+
+  // The fallback's observer of an fd, shared by the operations waiting on it: epoll takes a single
+  // registration per fd, and a read and a write may well be in flight together.
+  struct SharedObserver {
+    Own<UnixEventPort::FdObserver, DeleteStaticDisposer<UnixEventPort::FdObserver>> observer;
+    int refs = 0;
+  };
+
+  Option<UnixEventPort> m_fallback;
+  std::unordered_map<int, SharedObserver> m_observers; // Unregistered before the fallback goes.
+  Timer m_timer;
+
+  OwnFd m_ringFd;
+  OwnFd m_eventFd;
+  uint64_t m_wakeValue;
+
+  void *m_sqRing;
+  void *m_cqRing;
+  size_t m_sqRingSize;
+  size_t m_cqRingSize;
+  struct io_uring_sqe *m_sqes;
+  size_t m_sqesSize;
+  uint32_t m_sqEntries;
+  uint32_t *m_sqHead;
+  uint32_t *m_sqTail;
+  uint32_t *m_sqMask;
+  uint32_t *m_sqArray;
+  uint32_t *m_cqHead;
+  uint32_t *m_cqTail;
+  uint32_t *m_cqMask;
+  struct io_uring_cqe *m_cqes;
+
+  uint32_t m_sqLocalTail;   // Tail of the entries we have filled.
+  uint32_t m_sqSubmitted;   // Tail of the entries handed to the kernel.
+  List<Op, &Op::link> m_ops; // Operations whose completion has not been reaped yet.
+};
+
+KFC_NAMESPACE_END
+#endif
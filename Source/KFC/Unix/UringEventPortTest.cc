@@ -0,0 +1,130 @@
+#include "KFC/Sleep.h"
+#include "KFC/Testing.h"
+#include "KFC/Thread.h"
+#include "KFC/Unix/OwnFd.h"
+#include "KFC/Unix/UringEventPort.h"
+#include <fcntl.h>
+#include <netinet/in.h>
+
+KFC_NAMESPACE_BEG
+
+// Every test runs against both io_uring and the epoll fallback.
+class UringEventPortTest : public testing::TestWithParam<bool> {};
+
+#define SETUP_TEST_EVENT_LOOP                                                                      \
+  UringEventPort port(kUringDefaultEntries, GetParam());                                           \
+  EventLoop loop(port);                                                                            \
+  WaitScope scope(loop)
+
+static void makePipe(int fds[2]) { KFC_CHECK_SYSCALL(pipe2(fds, O_NONBLOCK | O_CLOEXEC)); }
+
+TEST_P(UringEventPortTest, ReadWrite) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makePipe(fds);
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  EXPECT_EQ(port.write(wfd, "abc", 3).wait(scope), 3);
+  char buf[8];
+  EXPECT_EQ(port.read(rfd, buf, sizeof(buf)).wait(scope), 3);
+  EXPECT_EQ(std::string(buf, 3), "abc");
+}
+
+TEST_P(UringEventPortTest, ReadAsync) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makePipe(fds);
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  Thread t([&] {
+    KFC_SLEEP_US(100 * 1000);
+    KFC_CHECK_SYSCALL(write(wfd, "abc", 3));
+  });
+  char buf[8];
+  EXPECT_EQ(port.read(rfd, buf, sizeof(buf)).wait(scope), 3);
+}
+
+TEST_P(UringEventPortTest, ReadCancel) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  makePipe(fds);
+  const OwnFd rfd(fds[0]), wfd(fds[1]);
+  char buf[8];
+  KFC_DISCARD(port.read(rfd, buf, sizeof(buf)));
+  // The cancelled read must not consume what is written afterwards.
+  KFC_CHECK_SYSCALL(write(wfd, "abc", 3));
+  EXPECT_EQ(port.read(rfd, buf, sizeof(buf)).wait(scope), 3);
+}
+
+TEST_P(UringEventPortTest, ReadWriteSameFd) {
+  SETUP_TEST_EVENT_LOOP;
+  int fds[2];
+  KFC_CHECK_SYSCALL(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds));
+  const OwnFd a(fds[0]), b(fds[1]);
+  // Fill the socket, so that both a read and a write on `a` have to wait.
+  char chunk[4096] = {};
+  while (::write(a, chunk, sizeof(chunk)) > 0) {
+  }
+  char in[8], out = 'x';
+  Promise<size_t> read = port.read(a, in, sizeof(in));
+  Promise<size_t> write = port.write(a, &out, 1);
+  while (::read(b, chunk, sizeof(chunk)) > 0) {
+  }
+  KFC_CHECK_SYSCALL(::write(b, "abc", 3));
+  EXPECT_EQ(read.wait(scope), 3);
+  EXPECT_EQ(write.wait(scope), 1);
+}
+
+TEST_P(UringEventPortTest, AcceptConnect) {
+  SETUP_TEST_EVENT_LOOP;
+  const OwnFd listener(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addrLen = sizeof(addr);
+  KFC_CHECK_SYSCALL(bind(listener, reinterpret_cast<struct sockaddr *>(&addr), addrLen));
+  KFC_CHECK_SYSCALL(listen(listener, 1));
+  KFC_CHECK_SYSCALL(getsockname(listener, reinterpret_cast<struct sockaddr *>(&addr), &addrLen));
+
+  Promise<int> accepted = port.accept(listener);
+  const OwnFd client(socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+  port.connect(client, reinterpret_cast<struct sockaddr *>(&addr), addrLen).wait(scope);
+  const OwnFd server(accepted.wait(scope));
+  EXPECT_EQ(port.write(client, "abc", 3).wait(scope), 3);
+  char buf[8];
+  EXPECT_EQ(port.read(server, buf, sizeof(buf)).wait(scope), 3);
+}
+
+TEST_P(UringEventPortTest, Wake) {
+  SETUP_TEST_EVENT_LOOP;
+  Thread t([&] {
+    KFC_SLEEP_US(100 * 1000);
+    port.wake();
+  });
+  EXPECT_TRUE(port.poll());
+}
+
+TEST_P(UringEventPortTest, TryPoll) {
+  SETUP_TEST_EVENT_LOOP;
+  EXPECT_FALSE(port.tryPoll());
+  port.wake();
+  EXPECT_TRUE(port.tryPoll());
+  EXPECT_FALSE(port.tryPoll());
+}
+
+TEST_P(UringEventPortTest, AfterDelay) {
+  SETUP_TEST_EVENT_LOOP;
+  const Time start = Time::preciseNow();
+  port.afterDelay(50_ms).wait(scope);
+  EXPECT_GE(Time::preciseNow() - start, 50_ms);
+}
+
+TEST_P(UringEventPortTest, TimerAfterDelay) {
+  SETUP_TEST_EVENT_LOOP;
+  // The delay counts from the timer's time, on the precise clock.
+  const Time start = port.getTimer().now();
+  port.getTimer().afterDelay(50_ms).wait(scope);
+  EXPECT_GE(Time::preciseNow() - start, 50_ms);
+}
+
+INSTANTIATE_TEST_SUITE_P(UringOrFallback, UringEventPortTest, testing::Bool());
+
+KFC_NAMESPACE_END
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "KFC/CopyMove.h"
+#include "KFC/Option.h"
+#include "KFC/Own.h"
+#include "KFC/Preclude.h"
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+// A Chase-Lev work-stealing deque, after "Correct and Efficient Work-Stealing for Weak Memory
+// Models" (Lê et al., 2013). The owner thread pushes and takes at the bottom, in LIFO order,
+// without any read-modify-write unless the deque is down to its last item; other threads steal from
+// the top, in FIFO order, with a CAS. The buffer grows as needed; outgrown buffers are kept until
+// the deque is destroyed, since a thief may still be reading them.
+//
+// T must be trivially copyable, typically a pointer.
+template <class T> class WorkStealingDeque final {
+  static_assert(std::is_trivially_copyable<T>::value, "T must be trivially copyable");
+
+public:
+  explicit WorkStealingDeque(const size_t capacity = 64)
+      : m_top(0), m_bottom(0), m_buffer(new Buffer(roundUp(capacity))) {
+    m_buffers.emplace_back(m_buffer.load(std::memory_order_relaxed));
+  }
+  KFC_DISALLOW_COPY_AND_MOVE(WorkStealingDeque)
+
+  // Push an item at the bottom. Owner only.
+  void push(T item) {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t t = m_top.load(std::memory_order_acquire);
+    Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+    if (b - t > buffer->mask) buffer = grow(buffer, t, b);
+    buffer->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // Take the item at the bottom, the one pushed last. Owner only.
+  Option<T> take() {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Buffer *buffer = m_buffer.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      // Empty.
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return None;
+    }
+    T item = buffer->get(b);
+    if (t == b) {
+      // The last item, race the thieves for it.
+      const bool won = m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                     std::memory_order_relaxed);
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      if (!won) return None;
+    }
+    return item;
+  }
+
+  enum class StealResult { Success, Empty, Abort };
+
+  // Steal the item at the top, the oldest one, into `item`. Any thread. `Abort` means another
+  // thread got the item first, the deque may still have others.
+  StealResult steal(T &item) {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) return StealResult::Empty;
+    Buffer *buffer = m_buffer.load(std::memory_order_acquire);
+    item = buffer->get(t);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+      return StealResult::Abort;
+    }
+    return StealResult::Success;
+  }
+
+  // An estimate of the number of items, exact when called by the owner with no thief around.
+  KFC_NODISCARD size_t size() const {
+    const int64_t b = m_bottom.load(std::memory_order_relaxed);
+    const int64_t t = m_top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+  KFC_NODISCARD bool empty() const { return size() == 0; }
+
+private:
+  struct Buffer {
+    explicit Buffer(const size_t capacity)
+        : mask(static_cast<int64_t>(capacity) - 1), items(capacity) {}
+
+    T get(const int64_t i) const { return items[i & mask].load(std::memory_order_relaxed); }
+    void put(const int64_t i, T item) { items[i & mask].store(item, std::memory_order_relaxed); }
+
+    const int64_t mask;
+    std::vector<std::atomic<T>> items;
+  };
+
+  static size_t roundUp(const size_t capacity) {
+    size_t n = 1;
+    while (n < capacity) n <<= 1;
+    return n;
+  }
+
+  Buffer *grow(Buffer *buffer, const int64_t top, const int64_t bottom) {
+    auto *bigger = new Buffer(static_cast<size_t>(buffer->mask + 1) * 2);
+    m_buffers.emplace_back(bigger);
+    for (int64_t i = top; i < bottom; i++) bigger->put(i, buffer->get(i));
+    m_buffer.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  // Keep the top and the bottom on different cache lines, thieves hammer the former.
+  alignas(64) std::atomic<int64_t> m_top;
+  alignas(64) std::atomic<int64_t> m_bottom;
+  std::atomic<Buffer *> m_buffer;
+  std::vector<Own<Buffer, DeleteStaticDisposer<Buffer>>> m_buffers; // Owner only.
+};
+
+KFC_NAMESPACE_END
@@ -0,0 +1,81 @@
+#include "KFC/Testing.h"
+#include "KFC/Thread.h"
+#include "KFC/WorkStealingDeque.h"
+
+#include <atomic>
+#include <vector>
+
+KFC_NAMESPACE_BEG
+
+using Deque = WorkStealingDeque<int>;
+
+TEST(WorkStealingDequeTest, TakeIsLifo) {
+  Deque deque;
+  for (int i = 0; i < 3; i++) deque.push(i);
+  EXPECT_EQ(deque.size(), 3u);
+  for (int i = 2; i >= 0; i--) {
+    KFC_IF_SOME(item, deque.take()) { EXPECT_EQ(item, i); }
+    else FAIL();
+  }
+  EXPECT_FALSE(deque.take().isSome());
+  EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, StealIsFifo) {
+  Deque deque;
+  for (int i = 0; i < 3; i++) deque.push(i);
+  int item = -1;
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(deque.steal(item), Deque::StealResult::Success);
+    EXPECT_EQ(item, i);
+  }
+  EXPECT_EQ(deque.steal(item), Deque::StealResult::Empty);
+}
+
+TEST(WorkStealingDequeTest, Grow) {
+  Deque deque(2);
+  for (int i = 0; i < 1000; i++) deque.push(i);
+  int item = -1;
+  EXPECT_EQ(deque.steal(item), Deque::StealResult::Success);
+  EXPECT_EQ(item, 0);
+  for (int i = 999; i > 0; i--) {
+    KFC_IF_SOME(taken, deque.take()) { EXPECT_EQ(taken, i); }
+    else FAIL();
+  }
+  EXPECT_TRUE(deque.empty());
+}
+
+TEST(WorkStealingDequeTest, ConcurrentSteals) {
+  // Every item is taken exactly once, by the owner or by a thief.
+  constexpr int N = 100000;
+  constexpr int kThieves = 3;
+  Deque deque;
+  std::vector<std::atomic<int>> seen(N);
+  std::atomic<bool> done(false);
+  std::vector<OwnThread> thieves;
+  for (int i = 0; i < kThieves; i++) {
+    thieves.push_back(Thread::spawn([&] {
+      int item;
+      while (!done.load()) {
+        if (deque.steal(item) == Deque::StealResult::Success) seen[item].fetch_add(1);
+      }
+    }));
+  }
+
+  for (int i = 0; i < N; i++) {
+    deque.push(i);
+    if (i % 3 == 0) {
+      KFC_IF_SOME(item, deque.take()) { seen[item].fetch_add(1); }
+    }
+  }
+  while (true) {
+    KFC_IF_SOME(item, deque.take()) { seen[item].fetch_add(1); }
+    else break;
+  }
+  done.store(true);
+  thieves.clear();
+
+  for (int i = 0; i < N; i++) EXPECT_EQ(seen[i].load(), 1);
+}
+
+KFC_NAMESPACE_END
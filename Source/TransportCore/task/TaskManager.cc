@@ -10,9 +10,11 @@ TK_RESULT TaskManager::Start() {
 }
 
 TK_RESULT TaskManager::Stop() {
-  auto guard = m_guard.lock();
-  for (auto &it : guard->m_taskMap) {
-    it.second.Stop();
+  for (auto &shard : m_guards) {
+    auto guard = shard.lock();
+    for (auto &it : guard->m_taskMap) {
+      it.second.Stop();
+    }
   }
   m_scheduleHandle.stop();
   return TK_OK;
@@ -25,7 +27,7 @@ int32_t TaskManager::CreateTask(const TransportCoreTaskContext &context) {
   if (task_id < 0) return -1;
 
   Task task(task_id, context);
-  auto guard = m_guard.lock();
+  auto guard = shardOf(task_id).lock();
   guard->m_taskMap.insert({task_id, task});
   return task_id;
 }
@@ -64,8 +66,8 @@ std::string TaskManager::GetProxyURL(const int32_t task_id) {
 void TaskManager::OnSchedule(const KFC::Tick tick) {}
 
 KFC::Option<Task> TaskManager::findTask(const int32_t task_id) {
-  auto &task_map = m_guard.lock()->m_taskMap;
-  const auto it = task_map.find(task_id);
-  return it == task_map.end() ? KFC::None : KFC::Some(it->second);
+  auto guard = shardOf(task_id).lock();
+  const auto it = guard->m_taskMap.find(task_id);
+  return it == guard->m_taskMap.end() ? KFC::None : KFC::Some(it->second);
 }
 } // namespace TransportCore
@@ -6,6 +6,7 @@
 #include "KFC/Time.h"
 #include "TransportCore/task/Task.h"
 
+#include <array>
 #include <unordered_map>
 
 namespace TransportCore {
@@ -29,14 +30,22 @@ public:
   void OnSchedule(KFC::Tick);
 
 private:
+  // Tasks are spread over shards by id, so that calls on different tasks rarely contend for the
+  // same lock. Ids are handed out sequentially, a modulo spreads them evenly.
+  static constexpr size_t kTaskMapShards = 16;
+
   KFC::Option<Task> findTask(int32_t task_id);
 
   struct Guard {
     std::unordered_map<int32_t, Task> m_taskMap;
   };
 
+  KFC::Mutex<Guard> &shardOf(int32_t task_id) {
+    return m_guards[static_cast<uint32_t>(task_id) % kTaskMapShards];
+  }
+
   KFC::Time m_startTime;
-  KFC::Mutex<Guard> m_guard;
+  std::array<KFC::Mutex<Guard>, kTaskMapShards> m_guards;
   KFC::ScheduleHandle<TaskManager> m_scheduleHandle;
 };
 